@@ -1,77 +1,752 @@
 module;
 
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <optional>
 
 module TexFile:Tga;
 
+import <ColorPalette.h>;
+import <PixelSwizzle.h>;
+import <TemporaryPath.h>;
+import <ThreadPool.h>;
+
 using namespace Tga;
 
-EErrorCode TgaImage::LoadFromFile(const std::string& filename)
+namespace
 {
-	std::ifstream inStream(filename, std::ios::in | std::ios::binary);
+	/**
+	 * Get a block of the file.
+	 * @param file The contents of the file.
+	 * @param offset The position in the file the block starts at.
+	 * @param length The number of bytes in the block. Fewer are returned if the file ends first.
+	 */
+	std::span<const uint8_t> GetBlock(std::span<const uint8_t> file, const size_t offset, const size_t length)
+	{
+		if (offset >= file.size())
+		{
+			return {};
+		}
+
+		return file.subspan(offset, std::min(length, file.size() - offset));
+	}
+
+	/**
+	 * Read a little-endian value from the file and advance past it. The value is left unchanged if the file ends first.
+	 * @param file The contents of the file.
+	 * @param offset The position of the value in the file. Advanced by the size of the value.
+	 * @param value The value to read into.
+	 */
+	template<typename T>
+	void ReadValue(std::span<const uint8_t> file, size_t& offset, T& value)
+	{
+		std::span<const uint8_t> bytes = GetBlock(file, offset, sizeof(T));
+
+		if (bytes.size() == sizeof(T))
+		{
+			std::memcpy(&value, bytes.data(), sizeof(T));
+		}
+
+		offset += sizeof(T);
+	}
+
+	/**
+	 * Read the header fields from the start of a file.
+	 * @param file The contents of the file, or at least its first Header::SIZE bytes.
+	 * @param header The header to fill.
+	 */
+	void ReadHeader(std::span<const uint8_t> file, Header& header)
+	{
+		// Start at the beginning of the file.
+		size_t offset = 0;
+
+		ReadValue(file, offset, header.IdLength);
+		ReadValue(file, offset, header.ColorMapType);
+		ReadValue(file, offset, header.ImageType);
+
+		// Color Map Specification Fields. 5 bytes.
+		ReadValue(file, offset, header.ColorMapFirstEntryIndex);
+		ReadValue(file, offset, header.ColorMapLength);
+		ReadValue(file, offset, header.ColorMapEntrySize);
+
+		// Image Specification Fields. 10 bytes.
+		ReadValue(file, offset, header.XOrigin);
+		ReadValue(file, offset, header.YOrigin);
+		ReadValue(file, offset, header.Width);
+		ReadValue(file, offset, header.Height);
+		ReadValue(file, offset, header.PixelDepth);
+		ReadValue(file, offset, header.ImageDescriptor);
+	}
+
+	/**
+	 * Write the header fields at the current position of the output stream.
+	 * @param outFile The output stream.
+	 * @param header The header to write.
+	 */
+	void WriteHeader(std::ofstream& outFile, const Header& header)
+	{
+		outFile.write((char*)&header.IdLength, sizeof(uint8_t));
+		outFile.write((char*)&header.ColorMapType, sizeof(uint8_t));
+		outFile.write((char*)&header.ImageType, sizeof(uint8_t));
+		outFile.write((char*)&header.ColorMapFirstEntryIndex, sizeof(uint16_t));
+		outFile.write((char*)&header.ColorMapLength, sizeof(uint16_t));
+		outFile.write((char*)&header.ColorMapEntrySize, sizeof(uint8_t));
+		outFile.write((char*)&header.XOrigin, sizeof(uint16_t));
+		outFile.write((char*)&header.YOrigin, sizeof(uint16_t));
+		outFile.write((char*)&header.Width, sizeof(uint16_t));
+		outFile.write((char*)&header.Height, sizeof(uint16_t));
+		outFile.write((char*)&header.PixelDepth, sizeof(uint8_t));
+		outFile.write((char*)&header.ImageDescriptor, sizeof(uint8_t));
+	}
 
-	if (!inStream.good())
+	/**
+	 * Read the footer from the end of a file, if it has one.
+	 * @param file The contents of the file, or at least its last Footer::SIZE bytes.
+	 * @param footer The footer to fill.
+	 * @return False if the file does not end with the footer signature.
+	 */
+	bool ReadFooter(std::span<const uint8_t> file, Footer& footer)
 	{
-		inStream.close();
-		EErrorCode::FilePath;
+		if (file.size() < Footer::SIZE)
+		{
+			return false;
+		}
+
+		// Signature string of "TRUEVISION-XFILE" should always be in bytes 8-23 of the footer area, if the footer is valid.
+		std::string validSignature = Footer::SIGNATURE;
+		std::span<const uint8_t> signature = GetBlock(file, file.size() - Footer::SIG_SIZE, validSignature.length());
+
+		if (!std::equal(signature.begin(), signature.end(), validSignature.begin(), validSignature.end()))
+		{
+			return false;
+		}
+
+		// Start 26 bytes from the end.
+		size_t offset = file.size() - Footer::SIZE;
+
+		ReadValue(file, offset, footer.ExtensionAreaOffset);
+		ReadValue(file, offset, footer.DeveloperDirectoryOffset);
+		ReadValue(file, offset, footer.Signature);
+		ReadValue(file, offset, footer.ReservedCharacter);
+		ReadValue(file, offset, footer.ZeroTerminator);
+		return true;
+	}
+
+	/**
+	 * Read the extension area fields.
+	 * @param file The contents of the file, or a block of it holding the extension area.
+	 * @param offset The position of the extension area in file.
+	 * @param extensions The extension fields to fill.
+	 */
+	void ReadExtensions(std::span<const uint8_t> file, size_t offset, Extensions& extensions)
+	{
+		ReadValue(file, offset, extensions.ExtensionSize);
+		ReadValue(file, offset, extensions.AuthorName);
+		ReadValue(file, offset, extensions.AuthorComment);
+		ReadValue(file, offset, extensions.DateTimeStamp);
+		ReadValue(file, offset, extensions.JobId);
+		ReadValue(file, offset, extensions.JobTime);
+		ReadValue(file, offset, extensions.SoftwareId);
+		ReadValue(file, offset, extensions.SoftwareVersion);
+		ReadValue(file, offset, extensions.KeyColor);
+		ReadValue(file, offset, extensions.PixelAspectRatio);
+		ReadValue(file, offset, extensions.GammaValue);
+		ReadValue(file, offset, extensions.ColorCorrectionOffset);
+		ReadValue(file, offset, extensions.PostageStampOffset);
+		ReadValue(file, offset, extensions.ScanLineOffset);
+		ReadValue(file, offset, extensions.AttributesType);
+	}
+
+	/**
+	 * Write a TGA scan line table at the current position of the output stream.
+	 * @param outFile The output stream.
+	 * @param scanLineTable The offset of every scanline.
+	 * @return The offset the table was written at, or 0 if there is no table.
+	 */
+	uint32_t WriteScanLineTable(std::ofstream& outFile, const std::vector<uint32_t>& scanLineTable)
+	{
+		std::streamoff offset = outFile.tellp();
+
+		if (!outFile.good() || scanLineTable.empty() || offset > (std::streamoff)UINT32_MAX)
+		{
+			return 0;
+		}
+
+		outFile.write((char*)scanLineTable.data(), scanLineTable.size() * sizeof(uint32_t));
+
+		return (uint32_t)offset;
 	}
 
-	this->PopulateHeader(inStream);
+	/**
+	 * Write a TGA extension area at the current position of the output stream.
+	 * @param outFile The output stream.
+	 * @param source The extension fields of the source image, or null if it had none.
+	 * @param scanLineOffset The offset of the scan line table, or 0 if there is none.
+	 * @return The offset the extensions were written at, or 0 if there are none.
+	 */
+	uint32_t WriteExtensions(std::ofstream& outFile, const Extensions* source, const uint32_t scanLineOffset)
+	{
+		std::streamoff offset = outFile.tellp();
+
+		if (!outFile.good() || (source == nullptr && scanLineOffset == 0) || offset > (std::streamoff)UINT32_MAX)
+		{
+			return 0;
+		}
+
+		// Run-length encoded images always get an extension area, to hold their scan line table.
+		Extensions extensions = source != nullptr ? *source : Extensions{};
+		extensions.ExtensionSize = Extensions::SIZE;
+
+		// The color correction table and postage stamp are not loaded, so they cannot be carried over.
+		extensions.ColorCorrectionOffset = 0;
+		extensions.PostageStampOffset = 0;
+		extensions.ScanLineOffset = scanLineOffset;
+
+		outFile.write((char*)&extensions.ExtensionSize, sizeof(uint16_t));
+		outFile.write((char*)&extensions.AuthorName, sizeof(extensions.AuthorName));
+		outFile.write((char*)&extensions.AuthorComment, sizeof(extensions.AuthorComment));
+		outFile.write((char*)&extensions.DateTimeStamp, sizeof(extensions.DateTimeStamp));
+		outFile.write((char*)&extensions.JobId, sizeof(extensions.JobId));
+		outFile.write((char*)&extensions.JobTime, sizeof(extensions.JobTime));
+		outFile.write((char*)&extensions.SoftwareId, sizeof(extensions.SoftwareId));
+		outFile.write((char*)&extensions.SoftwareVersion, sizeof(extensions.SoftwareVersion));
+		outFile.write((char*)&extensions.KeyColor, sizeof(uint32_t));
+		outFile.write((char*)&extensions.PixelAspectRatio, sizeof(uint32_t));
+		outFile.write((char*)&extensions.GammaValue, sizeof(uint32_t));
+		outFile.write((char*)&extensions.ColorCorrectionOffset, sizeof(uint32_t));
+		outFile.write((char*)&extensions.PostageStampOffset, sizeof(uint32_t));
+		outFile.write((char*)&extensions.ScanLineOffset, sizeof(uint32_t));
+		outFile.write((char*)&extensions.AttributesType, sizeof(uint8_t));
+
+		return (uint32_t)offset;
+	}
+
+	/**
+	 * Write a TGA footer at the current position of the output stream.
+	 * @param outFile The output stream.
+	 * @param hadFooter Indicates the source image had a footer, which is kept even without an extension area.
+	 * @param extensionAreaOffset The offset of the extension area, or 0 if there is none.
+	 */
+	void WriteFooter(std::ofstream& outFile, const bool hadFooter, const uint32_t extensionAreaOffset)
+	{
+		if (!outFile.good() || (!hadFooter && extensionAreaOffset == 0))
+		{
+			return;
+		}
+
+		Footer footer = {};
+		footer.ExtensionAreaOffset = extensionAreaOffset;
+		std::memcpy(footer.Signature, Footer::SIGNATURE, sizeof(footer.Signature));
+
+		outFile.write((char*)&footer.ExtensionAreaOffset, sizeof(uint32_t));
+		outFile.write((char*)&footer.DeveloperDirectoryOffset, sizeof(uint32_t));
+		outFile.write((char*)&footer.Signature, sizeof(footer.Signature));
+		outFile.write((char*)&footer.ReservedCharacter, sizeof(uint8_t));
+		outFile.write((char*)&footer.ZeroTerminator, sizeof(uint8_t));
+	}
+
+	/**
+	 * Convert one pixel from file byte order to Vec4.
+	 * True color pixels are B, G, R(, A), black and white pixels are the value, then any alpha.
+	 * @param source The bytes of the pixel.
+	 */
+	template <size_t BytesPerPixel>
+	Vec4 ReadPixel(const uint8_t* source)
+	{
+		if constexpr (BytesPerPixel == 4)
+		{
+			return { source[2], source[1], source[0], source[3] };
+		}
+		else if constexpr (BytesPerPixel == 3)
+		{
+			return { source[2], source[1], source[0], 0 };
+		}
+		else if constexpr (BytesPerPixel == 2)
+		{
+			return { source[0], 0, 0, source[1] };
+		}
+		else
+		{
+			return { source[0], 0, 0, 0 };
+		}
+	}
+
+	/**
+	 * Convert a block of pixels from file byte order to Vec4.
+	 * @param source The packed source pixels.
+	 * @param destination The pixels to write to.
+	 * @param count The number of pixels to convert.
+	 */
+	template <size_t BytesPerPixel>
+	void ReadPixels(const uint8_t* source, Vec4* destination, const size_t count)
+	{
+		if constexpr (BytesPerPixel == 4)
+		{
+			PixelSwizzle::BgraToVec4(source, destination, count);
+		}
+		else if constexpr (BytesPerPixel == 3)
+		{
+			PixelSwizzle::BgrToVec4(source, destination, count);
+		}
+		else if constexpr (BytesPerPixel == 2)
+		{
+			PixelSwizzle::GrayAlphaToVec4(source, destination, count);
+		}
+		else
+		{
+			PixelSwizzle::GrayToVec4(source, destination, count);
+		}
+	}
+
+	/**
+	 * Decode run-length packets into pixels. Every read is checked against the end of the file
+	 * and every write against the end of the pixels, so a truncated or corrupt file cannot overrun either.
+	 * @param file The contents of the file.
+	 * @param offset The position in the file the packets start at. Moved past the packets that were decoded.
+	 * @param pixels The pixels to write to. Any pixels the packets do not reach are set to zero.
+	 * @param pixelCount The number of pixels to decode.
+	 * @return The number of pixels decoded, fewer than pixelCount if the file ended first.
+	 */
+	template <size_t BytesPerPixel>
+	size_t DecodeRunLengthPixels(std::span<const uint8_t> file, size_t& offset, Vec4* pixels, const size_t pixelCount)
+	{
+		std::span<const uint8_t> packets = GetBlock(file, offset, file.size());
+		const uint8_t* position = packets.data();
+		const uint8_t* end = position + packets.size();
+
+		size_t i = 0;
+		while (i < pixelCount && position < end)
+		{
+			uint8_t packet = *position;
+			position++;
+
+			// A packet that runs past the end of the image is cut short.
+			size_t count = std::min((size_t)(packet & EPacketMask::PixelCount) + 1, pixelCount - i);
+
+			if (packet & EPacketMask::RunLengthPacket)
+			{
+				if ((size_t)(end - position) < BytesPerPixel)
+				{
+					break;
+				}
+
+				Vec4 value = ReadPixel<BytesPerPixel>(position);
+				position += BytesPerPixel;
+
+				// Short runs are written as one block of four pixels when there is room, and the pixels past the
+				// run are overwritten by the packets that follow. This avoids a loop whose length changes every packet.
+				if (count <= 4 && pixelCount - i >= 4)
+				{
+					const Vec4 block[4] = { value, value, value, value };
+					std::memcpy(pixels + i, block, sizeof(block));
+				}
+				else
+				{
+					PixelSwizzle::Fill(pixels + i, value, count);
+				}
+
+				i += count;
+				continue;
+			}
+
+			// A raw packet that runs past the end of the file keeps its whole pixels and ends the image.
+			size_t available = (size_t)(end - position) / BytesPerPixel;
+			bool truncated = count > available;
+			count = std::min(count, available);
+
+			// Short raw packets are common between runs and cheaper to convert directly.
+			if (count <= 4)
+			{
+				for (size_t j = 0; j < count; j++)
+				{
+					pixels[i + j] = ReadPixel<BytesPerPixel>(position + (j * BytesPerPixel));
+				}
+			}
+			else
+			{
+				ReadPixels<BytesPerPixel>(position, pixels + i, count);
+			}
+
+			position += count * BytesPerPixel;
+			i += count;
+
+			if (truncated)
+			{
+				break;
+			}
+		}
+
+		// This also clears anything a short run wrote past the last decoded pixel.
+		std::fill(pixels + i, pixels + pixelCount, Vec4{});
+
+		offset += (size_t)(position - packets.data());
+		return i;
+	}
+
+	/**
+	 * Convert one pixel from Vec4 to file byte order.
+	 * @param source The pixel to convert.
+	 * @param destination Where to write the bytes of the pixel.
+	 */
+	template <size_t BytesPerPixel>
+	void WritePixel(const Vec4 source, uint8_t* destination)
+	{
+		if constexpr (BytesPerPixel >= 3)
+		{
+			destination[0] = source.z;
+			destination[1] = source.y;
+			destination[2] = source.x;
+
+			if constexpr (BytesPerPixel == 4)
+			{
+				destination[3] = source.w;
+			}
+		}
+		else
+		{
+			destination[0] = source.x;
+
+			if constexpr (BytesPerPixel == 2)
+			{
+				destination[1] = source.w;
+			}
+		}
+	}
+
+	/**
+	 * Convert a block of pixels from Vec4 to file byte order.
+	 * @param source The pixels to convert.
+	 * @param destination The packed pixels to write to.
+	 * @param count The number of pixels to convert.
+	 */
+	template <size_t BytesPerPixel>
+	void WritePixels(const Vec4* source, uint8_t* destination, const size_t count)
+	{
+		if constexpr (BytesPerPixel == 4)
+		{
+			PixelSwizzle::Vec4ToBgra(source, destination, count);
+		}
+		else if constexpr (BytesPerPixel == 3)
+		{
+			PixelSwizzle::Vec4ToBgr(source, destination, count);
+		}
+		else if constexpr (BytesPerPixel == 2)
+		{
+			PixelSwizzle::Vec4ToGrayAlpha(source, destination, count);
+		}
+		else
+		{
+			PixelSwizzle::Vec4ToGray(source, destination, count);
+		}
+	}
+
+	/**
+	 * Convert pixels to file byte order and write them to a file. The pixels are converted into a staging buffer
+	 * a block at a time, so the file is written in large blocks whatever the size of the image.
+	 * @param outFile The file to write to.
+	 * @param pixels The pixels to write.
+	 * @param count The number of pixels to write.
+	 * @param bytesPerPixel The size of each pixel in the file, 1 to 4 bytes.
+	 */
+	void WritePackedPixels(std::ofstream& outFile, const Vec4* pixels, const size_t count, const size_t bytesPerPixel)
+	{
+		const size_t blockPixels = 256 * 1024;
+		std::vector<uint8_t> buffer(std::min(count, blockPixels) * bytesPerPixel);
+
+		for (size_t i = 0; i < count; i += blockPixels)
+		{
+			size_t blockCount = std::min(blockPixels, count - i);
+
+			switch (bytesPerPixel)
+			{
+			case 4:
+				WritePixels<4>(pixels + i, buffer.data(), blockCount);
+				break;
+
+			case 3:
+				WritePixels<3>(pixels + i, buffer.data(), blockCount);
+				break;
+
+			case 2:
+				WritePixels<2>(pixels + i, buffer.data(), blockCount);
+				break;
+
+			default:
+				WritePixels<1>(pixels + i, buffer.data(), blockCount);
+				break;
+			}
+
+			outFile.write((char*)buffer.data(), blockCount * bytesPerPixel);
+		}
+	}
+
+	/**
+	 * Run-length encode one scanline. Runs of two or more identical pixels become run-length packets,
+	 * everything else raw packets that end where the next run starts. No packet crosses the end of the scanline.
+	 * @param pixels The scanline.
+	 * @param width The number of pixels in the scanline.
+	 * @param output Where to write the packets. At least width * (BytesPerPixel + 1) bytes.
+	 * @return The number of bytes written.
+	 */
+	template <size_t BytesPerPixel>
+	size_t EncodeRunLengthScanline(const Vec4* pixels, const size_t width, uint8_t* output)
+	{
+		const size_t maxPacketPixels = (size_t)EPacketMask::PixelCount + 1;
+
+		// Only the channels stored in the file decide whether two pixels are the same.
+		const Vec4 channelMask = BytesPerPixel >= 3
+			? Vec4{ 0xFF, 0xFF, 0xFF, BytesPerPixel == 4 ? (uint8_t)0xFF : (uint8_t)0 }
+			: Vec4{ 0xFF, 0, 0, BytesPerPixel == 2 ? (uint8_t)0xFF : (uint8_t)0 };
+
+		uint8_t* position = output;
+
+		size_t i = 0;
+		while (i < width)
+		{
+			size_t remaining = std::min(width - i, maxPacketPixels);
+			size_t runLength = PixelSwizzle::CountRepeats(pixels + i, remaining, channelMask);
+
+			if (runLength > 1)
+			{
+				*position = (uint8_t)(EPacketMask::RunLengthPacket | (runLength - 1));
+				WritePixel<BytesPerPixel>(pixels[i], position + 1);
+
+				position += 1 + BytesPerPixel;
+				i += runLength;
+				continue;
+			}
+
+			size_t rawLength = PixelSwizzle::CountUntilRepeat(pixels + i, remaining, channelMask);
+
+			*position = (uint8_t)(EPacketMask::RawPacket | (rawLength - 1));
+			WritePixels<BytesPerPixel>(pixels + i, position + 1, rawLength);
+
+			position += 1 + (rawLength * BytesPerPixel);
+			i += rawLength;
+		}
+
+		return (size_t)(position - output);
+	}
+
+	/**
+	 * Run-length encode one scanline.
+	 * @param pixels The scanline.
+	 * @param width The number of pixels in the scanline.
+	 * @param bytesPerPixel The size of each pixel in the file, 1 to 4 bytes.
+	 * @param output Where to write the packets. At least width * (bytesPerPixel + 1) bytes.
+	 * @return The number of bytes written.
+	 */
+	size_t EncodeRunLengthScanline(const Vec4* pixels, const size_t width, const size_t bytesPerPixel, uint8_t* output)
+	{
+		switch (bytesPerPixel)
+		{
+		case 4:
+			return EncodeRunLengthScanline<4>(pixels, width, output);
+
+		case 3:
+			return EncodeRunLengthScanline<3>(pixels, width, output);
+
+		case 2:
+			return EncodeRunLengthScanline<2>(pixels, width, output);
+
+		default:
+			return EncodeRunLengthScanline<1>(pixels, width, output);
+		}
+	}
+
+	/**
+	 * Get the thread pool the caller gave, or start one with a thread per hardware thread if there is none.
+	 * @param threadPool The pool passed to LoadFromFile or SaveToFile, or null.
+	 * @param ownedPool Holds the pool started for the call, so it lives as long as the caller's copy of this.
+	 */
+	ThreadPool& GetThreadPool(ThreadPool* threadPool, std::optional<ThreadPool>& ownedPool)
+	{
+		if (threadPool != nullptr)
+		{
+			return *threadPool;
+		}
+
+		return ownedPool.emplace(0);
+	}
+
+	/**
+	 * Run-length encode a whole image and write it to a file. Every scanline is encoded on its own, so bands of
+	 * scanlines are encoded in parallel, each into its own buffer, and the buffers are written out in order.
+	 * @param outFile The file to write to, positioned where the pixel data starts.
+	 * @param pixels The pixels of the image.
+	 * @param width The width of the image.
+	 * @param height The height of the image.
+	 * @param bytesPerPixel The size of each pixel in the file, 1 to 4 bytes.
+	 * @param scanLineTable Filled with the offset in the file of every scanline, or left empty if the file is too large for one.
+	 * @param threadPool The threads to encode on, or null to start one thread per hardware thread.
+	 */
+	void WriteRunLengthPixels(std::ofstream& outFile, const Vec4* pixels, const size_t width, const size_t height, const size_t bytesPerPixel, std::vector<uint32_t>& scanLineTable, ThreadPool* threadPool)
+	{
+		const size_t minBandSize = 1024 * 1024;
+		const size_t maxScanlineSize = width * (bytesPerPixel + 1);
+		const size_t bandRows = std::max(minBandSize / std::max(maxScanlineSize, (size_t)1), (size_t)1);
+
+		std::optional<ThreadPool> ownedPool;
+		ThreadPool& pool = GetThreadPool(threadPool, ownedPool);
+		const size_t bandCount = pool.GetThreadCount();
+
+		// The buffers are reused for every batch of bands, so memory stays at one band per thread whatever the image size.
+		std::vector<std::vector<uint8_t>> bands(bandCount, std::vector<uint8_t>(bandRows * maxScanlineSize));
+		std::vector<size_t> scanlineSizes(bandCount * bandRows);
+
+		std::vector<uint64_t> offsets(height);
+		uint64_t offset = (uint64_t)outFile.tellp();
+
+		for (size_t firstRow = 0; firstRow < height; firstRow += bandCount * bandRows)
+		{
+			size_t batchRows = std::min(bandCount * bandRows, height - firstRow);
+			size_t batchBands = (batchRows + bandRows - 1) / bandRows;
+
+			pool.ParallelFor(batchBands, [&](size_t firstBand, size_t lastBand)
+			{
+				for (size_t band = firstBand; band < lastBand; band++)
+				{
+					size_t used = 0;
+
+					for (size_t row = band * bandRows; row < std::min((band + 1) * bandRows, batchRows); row++)
+					{
+						scanlineSizes[row] = EncodeRunLengthScanline(pixels + ((firstRow + row) * width), width, bytesPerPixel, bands[band].data() + used);
+						used += scanlineSizes[row];
+					}
+				}
+			});
+
+			// Join the bands in scanline order.
+			for (size_t band = 0; band < batchBands; band++)
+			{
+				size_t used = 0;
+
+				for (size_t row = band * bandRows; row < std::min((band + 1) * bandRows, batchRows); row++)
+				{
+					offsets[firstRow + row] = offset + used;
+					used += scanlineSizes[row];
+				}
+
+				outFile.write((char*)bands[band].data(), used);
+				offset += used;
+			}
+		}
+
+		// Offsets in the TGA 2.0 fields are 32 bit, so a file past 4 GB has no scan line table.
+		scanLineTable.clear();
+
+		if (offset <= UINT32_MAX)
+		{
+			scanLineTable.resize(height);
+			std::transform(offsets.begin(), offsets.end(), scanLineTable.begin(), [](const uint64_t rowOffset) { return static_cast<uint32_t>(rowOffset); });
+		}
+	}
+}
+
+EErrorCode TgaImage::LoadFromFile(const std::string& filename, const bool mapPixels, ThreadPool* threadPool)
+{
+	std::unique_ptr<MappedFile> inFile = std::make_unique<MappedFile>();
+
+	if (!inFile->Open(filename))
+	{
+		return EErrorCode::FilePath;
+	}
+
+	std::span<const uint8_t> file = inFile->GetData();
+
+	if (file.size() < Header::SIZE)
+	{
+		return EErrorCode::NoImageDataOrTypeNotSupported;
+	}
+
+	this->pixelBuffer.reset();
+	this->mappedPixels = nullptr;
+	this->mappedFile.reset();
+	this->footer.reset();
+	this->developerDirectory.reset();
+	this->extensions.reset();
+
+	this->PopulateHeader(file);
+
+	// Check for a TGA 2.0 footer first, as its scan line table lets run-length encoded images be decoded in parallel.
+	this->PopulateFooter(file);
+	this->PopulateDeveloperField(file);
+	this->PopulateExtensions(file);
 
 	switch (this->header->ImageType)
 	{
 	case EImageType::NoImageData:
-		inStream.close();
 		return EErrorCode::NoImageDataOrTypeNotSupported;
 		break;
 
 	case EImageType::UncompressedColorMapped:
-		this->ParseColorMapped(inStream);
+		this->ParseColorMapped(file);
 		break;
 
 	case EImageType::UncompressedTrueColor:
-		this->ParseTrueColor(inStream);
+		if (mapPixels && this->GetAlphaChannelDepth() == 8 && file.size() - Header::SIZE >= (size_t)this->header->Width * this->header->Height * sizeof(Vec4))
+		{
+			// 32 bit pixels are already laid out like Vec4, only the channel order differs, so they can be used in place.
+			this->mappedPixels = (const Vec4*)(file.data() + Header::SIZE);
+		}
+		else
+		{
+			this->ParseTrueColor(file);
+		}
 		break;
 
 	case EImageType::UncompressedBlackAndWhite:
-		this->ParseBlackWhite(inStream);
+		this->ParseBlackWhite(file);
 		break;
 
 	case EImageType::RunLengthEncodedColorMapped:
 		// Will not implement.
-		inStream.close();
 		return EErrorCode::NoImageDataOrTypeNotSupported;
 		break;
 
 	case EImageType::RunLengthEncodedTrueColor:
-		this->ParseRLETrueColor(inStream);
+		this->ParseRLETrueColor(file, threadPool);
 		break;
 
 	case EImageType::RunLengthEncodedBlackAndWhite:
-		this->ParseRLEBlackWhite(inStream);
+		this->ParseRLEBlackWhite(file, threadPool);
 		break;
 
 	default:
 		this->header->ImageType = EImageType::NoImageData;
-		inStream.close();
 		return EErrorCode::NoImageDataOrTypeNotSupported;
 		break;
 	}
 
-	// Check for a TGA 2.0 footer.
-	this->PopulateFooter(inStream);
-	this->PopulateDeveloperField(inStream);
-	this->PopulateExtensions(inStream);
+	// Keep the file mapped for as long as its pixels are viewed in place, otherwise it is unmapped here.
+	if (this->mappedPixels != nullptr)
+	{
+		this->mappedFile = std::move(inFile);
+	}
 
-	inStream.close();
 	return EErrorCode::NoError;
 }
 
 TgaImage::~TgaImage() { }
 
-void TgaImage::SetPixelData(std::unique_ptr<Vec4[]> newPixels)
+void TgaImage::SetPixelData(PixelPool::Buffer newPixels)
 {
 	this->pixelBuffer = std::move(newPixels);
+
+	// The mapped pixels are superseded, so the file no longer needs to stay mapped.
+	this->mappedPixels = nullptr;
+	this->mappedFile.reset();
+}
+
+void TgaImage::SetMappedPixelData(PixelPool::Buffer newPixels)
+{
+	size_t pixelsLength = (size_t)this->header->Width * this->header->Height;
+	PixelSwizzle::BgraToVec4((const uint8_t*)newPixels.get(), newPixels.get(), pixelsLength);
+
+	this->SetPixelData(std::move(newPixels));
 }
 
 bool TgaImage::IsRightToLeftPixelOrder() const
@@ -84,18 +759,54 @@ bool TgaImage::IsTopToBottomPixelOrder() const
 	return this->header->ImageDescriptor & EImageDescriptorMask::TopToBottomOrdering;
 }
 
+void TgaImage::SetColorMapDithering(const bool dither)
+{
+	this->ditherColorMap = dither;
+}
+
 uint8_t TgaImage::GetAlphaChannelDepth() const
 {
 	return this->header->ImageDescriptor & EImageDescriptorMask::AlphaDepth;
 }
 
-void TgaImage::SaveToFile(const std::string& filename, const EImageType fileFormat)
+uint8_t TgaImage::GetChannelCount() const
 {
-	std::ofstream outFile(filename, std::ios::out | std::ios::binary);
+	bool hasAlpha = this->GetAlphaChannelDepth() == 8;
+
+	switch (this->header->ImageType)
+	{
+	case EImageType::UncompressedBlackAndWhite:
+	case EImageType::RunLengthEncodedBlackAndWhite:
+		return hasAlpha ? 2 : 1;
+
+	case EImageType::UncompressedColorMapped:
+		return this->header->ColorMapEntrySize == 32 ? 4 : 3;
+
+	default:
+		return hasAlpha ? 4 : 3;
+	}
+}
+
+EErrorCode TgaImage::SaveToFile(const std::string& filename, const EImageType fileFormat, const bool replaceAtomically, ThreadPool* threadPool)
+{
+	// Pixels that were only mapped have to be decoded before they can be written in another format. This is done
+	// before the file is opened, as opening it for writing would truncate the mapping if it is the same file.
+	if (this->mappedPixels != nullptr)
+	{
+		this->PopulatePixelBuffer(this->mappedFile->GetData());
+		this->mappedPixels = nullptr;
+		this->mappedFile.reset();
+	}
+
+	// An atomic save writes the whole image to a file next to the destination and then renames it over the destination,
+	// so nothing reading the destination ever sees a partly written image, and a failed save leaves any old file untouched.
+	// Each save gets a name of its own, so two saves to the same destination never write into one temporary file.
+	std::string writePath = replaceAtomically ? TemporaryPath::Make(filename).string() : filename;
+	std::ofstream outFile(writePath, std::ios::out | std::ios::binary);
 
 	if (!outFile.good())
 	{
-		return;
+		return EErrorCode::FilePath;
 	}
 
 	this->header->ImageType = fileFormat;
@@ -105,286 +816,256 @@ void TgaImage::SaveToFile(const std::string& filename, const EImageType fileForm
 		this->UpdateColorMapping();
 	}
 
+	// The TGA 2.0 fields follow the pixel data, whose size depends on the format, so they are written after it
+	// with new offsets. Developer fields are not carried over, as only their directory is loaded.
+	std::vector<uint32_t> scanLineTable = {};
+
 	this->WriteHeaderToFile(outFile);
-	this->WritePixelDataToFile(outFile);
-	this->WriteDeveloperDirectoryToFile(outFile);
-	this->WriteExtensionsToFile(outFile);
-	this->WriteFooterToFile(outFile);
-	
+	this->WritePixelDataToFile(outFile, scanLineTable, threadPool);
+	uint32_t scanLineOffset = this->WriteScanLineTableToFile(outFile, scanLineTable);
+	uint32_t extensionAreaOffset = this->WriteExtensionsToFile(outFile, scanLineOffset);
+	this->WriteFooterToFile(outFile, extensionAreaOffset);
+
 	outFile.close();
-}
 
-void TgaImage::ParseColorMapped(std::ifstream& inStream)
-{
-	if (!inStream.good())
+	std::error_code error;
+	if (outFile.fail())
 	{
-		return;
+		if (replaceAtomically)
+		{
+			std::filesystem::remove(writePath, error);
+		}
+
+		return EErrorCode::FilePath;
 	}
 
-	// Color mapped images only allowed 256 colors, and one-byte pixel indices into the color map.
-	if (this->header->ColorMapLength <= 256 && this->header->PixelDepth == 8)
+	if (replaceAtomically)
 	{
-		this->PopulateColorMap(inStream);
-		this->PopulateColorMappedPixels(inStream);
-		this->PopulatePixelBuffer(this->colorMap);
+		std::filesystem::rename(writePath, filename, error);
+
+		if (error)
+		{
+			std::filesystem::remove(writePath, error);
+			return EErrorCode::FilePath;
+		}
 	}
+
+	return EErrorCode::NoError;
 }
 
-void TgaImage::PopulateColorMap(std::ifstream& inStream)
+void TgaImage::ParseColorMapped(std::span<const uint8_t> file)
 {
-	if (!inStream.good())
+	// Color mapped images only allowed 256 colors, and one-byte pixel indices into the color map.
+	if (this->header->ColorMapLength <= 256 && this->header->PixelDepth == 8)
 	{
-		return;
+		this->PopulateColorMap(file);
+		this->PopulateColorMappedPixels(file);
+		this->PopulatePixelBuffer(this->colorMap);
 	}
+}
 
+void TgaImage::PopulateColorMap(std::span<const uint8_t> file)
+{
 	this->colorMap = std::make_shared<Vec4[]>(this->header->ColorMapLength);
 
-	// Go to start of color map entries.
-	inStream.seekg((size_t)Header::SIZE + this->header->ColorMapFirstEntryIndex, std::ios::beg);
+	size_t entrySize = this->header->ColorMapEntrySize == 32 ? 4 : 3;
 
-	for (size_t i = 0; i < this->header->ColorMapLength; i++)
-	{
-		inStream.read((char*)&this->colorMap[i].z, sizeof(uint8_t));
-		inStream.read((char*)&this->colorMap[i].y, sizeof(uint8_t));
-		inStream.read((char*)&this->colorMap[i].x, sizeof(uint8_t));
+	// The color map entries start from the first entry index.
+	std::span<const uint8_t> entries = GetBlock(file, (size_t)Header::SIZE + this->header->ColorMapFirstEntryIndex, this->header->ColorMapLength * entrySize);
+	size_t entryCount = entries.size() / entrySize;
 
-		if (this->header->ColorMapEntrySize == 32) // 32 bits
-		{
-			inStream.read((char*)&this->colorMap[i].w, sizeof(uint8_t));
-		}
+	if (entrySize == 4)
+	{
+		PixelSwizzle::BgraToVec4(entries.data(), this->colorMap.get(), entryCount);
 	}
-}
-
-void TgaImage::ParseTrueColor(std::ifstream& inStream)
-{
-	if (!inStream.good())
+	else
 	{
-		return;
+		PixelSwizzle::BgrToVec4(entries.data(), this->colorMap.get(), entryCount);
 	}
+}
 
-	this->PopulatePixelBuffer(inStream);
+void TgaImage::ParseTrueColor(std::span<const uint8_t> file)
+{
+	this->PopulatePixelBuffer(file);
 }
 
-void TgaImage::ParseBlackWhite(std::ifstream& inStream)
+void TgaImage::ParseBlackWhite(std::span<const uint8_t> file)
 {
-	if (!inStream.good())
-	{
-		return;
-	}
+	size_t pixelsLength = (size_t)this->header->Width * this->header->Height;
+	this->pixelBuffer = PixelPool::GetShared().Allocate(pixelsLength);
 
-	size_t pixelsLength = (size_t)(this->header->Width * this->header->Height);
-	this->pixelBuffer = std::make_shared<Vec4[]>(pixelsLength);
+	bool hasAlpha = this->header->PixelDepth == 16 && this->GetAlphaChannelDepth() == 8;
+	size_t bytesPerPixel = hasAlpha ? 2 : 1;
 
-	// Go to the pixel data position.
-	inStream.seekg(Header::SIZE, std::ios::beg);
+	// Widen all the pixel data to Vec4 at once. A truncated file leaves the missing pixels black.
+	std::span<const uint8_t> pixels = GetBlock(file, Header::SIZE, pixelsLength * bytesPerPixel);
+	size_t pixelCount = pixels.size() / bytesPerPixel;
 
-	for (size_t i = 0; i < pixelsLength; i++)
+	if (hasAlpha)
 	{
-		inStream.read((char*)&this->pixelBuffer[i].x, sizeof(uint8_t));
-
-		if (this->header->PixelDepth == 16 && this->GetAlphaChannelDepth() == 8)
-		{
-			inStream.read((char*)&this->pixelBuffer[i].w, sizeof(uint8_t));
-		}
+		PixelSwizzle::GrayAlphaToVec4(pixels.data(), this->pixelBuffer.get(), pixelCount);
+	}
+	else
+	{
+		PixelSwizzle::GrayToVec4(pixels.data(), this->pixelBuffer.get(), pixelCount);
 	}
+
+	std::fill(this->pixelBuffer.get() + pixelCount, this->pixelBuffer.get() + pixelsLength, Vec4{});
 }
 
-void TgaImage::ParseRLETrueColor(std::ifstream& inStream)
+void TgaImage::ParseRLETrueColor(std::span<const uint8_t> file, ThreadPool* threadPool)
 {
-	if (!inStream.good())
+	size_t pixelsLength = (size_t)this->header->Width * this->header->Height;
+	this->pixelBuffer = PixelPool::GetShared().Allocate(pixelsLength);
+
+	bool hasAlpha = this->GetAlphaChannelDepth() == 8; // 32 bit pixels
+
+	if (hasAlpha)
+	{
+		this->DecodeRunLengthPixelData(file, DecodeRunLengthPixels<4>, threadPool);
+	}
+	else
 	{
-		return;
+		this->DecodeRunLengthPixelData(file, DecodeRunLengthPixels<3>, threadPool);
 	}
+}
 
-	size_t pixelsLength = (size_t)(this->header->Width * this->header->Height);
-	this->pixelBuffer = std::make_shared<Vec4[]>(pixelsLength);
+void TgaImage::ParseRLEBlackWhite(std::span<const uint8_t> file, ThreadPool* threadPool)
+{
+	size_t pixelsLength = (size_t)this->header->Width * this->header->Height;
+	this->pixelBuffer = PixelPool::GetShared().Allocate(pixelsLength);
 
-	// Go to the pixel data position.
-	inStream.seekg(Header::SIZE, std::ios::beg);
+	bool hasAlpha = this->GetAlphaChannelDepth() == 8; // 16 bit pixels
 
-	size_t i = 0;
-	while (i < pixelsLength)
+	if (hasAlpha)
 	{
-		uint8_t packet = 0;
-		inStream.read((char*)&packet, sizeof(uint8_t));
+		this->DecodeRunLengthPixelData(file, DecodeRunLengthPixels<2>, threadPool);
+	}
+	else
+	{
+		this->DecodeRunLengthPixelData(file, DecodeRunLengthPixels<1>, threadPool);
+	}
+}
 
-		uint8_t pixelCount = (packet & EPacketMask::PixelCount) + 1;
+void TgaImage::DecodeRunLengthPixelData(std::span<const uint8_t> file, RunLengthDecoder decode, ThreadPool* threadPool)
+{
+	size_t width = this->header->Width;
+	size_t height = this->header->Height;
+	Vec4* pixels = this->pixelBuffer.get();
 
-		if (packet & EPacketMask::RunLengthPacket)
-		{
-			Vec4 pixelValue = {};
-			inStream.read((char*)&pixelValue.z, sizeof(uint8_t));
-			inStream.read((char*)&pixelValue.y, sizeof(uint8_t));
-			inStream.read((char*)&pixelValue.x, sizeof(uint8_t));
+	std::vector<uint32_t> scanLineTable = this->GetScanLineTable(file);
 
-			if (this->GetAlphaChannelDepth() == 8) // 32 bit pixels
-			{
-				inStream.read((char*)&pixelValue.w, sizeof(uint8_t));
-			}
+	if (!scanLineTable.empty())
+	{
+		// The scan line table gives where every scanline starts, so bands of scanlines are decoded in parallel.
+		// Every scanline has to end exactly where the next one starts, or the table does not match the packets.
+		std::atomic<bool> complete = true;
 
-			// Run length packet.
-			for (size_t j = 0; j < pixelCount; j++)
-			{
-				this->pixelBuffer[i] = pixelValue;
-				i++;
-			}
-		}
-		else
+		std::optional<ThreadPool> ownedPool;
+		GetThreadPool(threadPool, ownedPool).ParallelFor(height, [&](size_t firstRow, size_t lastRow)
 		{
-			// Raw packet.
-			for (size_t j = 0; j < pixelCount; j++)
+			for (size_t i = firstRow; i < lastRow && complete; i++)
 			{
-				inStream.read((char*)&this->pixelBuffer[i].z, sizeof(uint8_t));
-				inStream.read((char*)&this->pixelBuffer[i].y, sizeof(uint8_t));
-				inStream.read((char*)&this->pixelBuffer[i].x, sizeof(uint8_t));
+				size_t offset = scanLineTable[i];
+				size_t decoded = decode(file, offset, pixels + (i * width), width);
 
-				if (this->GetAlphaChannelDepth() == 8) // 32 bit pixels
+				if (decoded != width || (i + 1 < height && offset != scanLineTable[i + 1]))
 				{
-					inStream.read((char*)&this->pixelBuffer[i].w, sizeof(uint8_t));
+					complete = false;
 				}
-
-				i++;
 			}
+		});
+
+		// A table that does not match the packets, such as one for packets that cross scanlines, is ignored.
+		if (complete)
+		{
+			return;
 		}
 	}
+
+	// Otherwise the packets are decoded in one pass. A truncated file leaves the missing pixels black.
+	size_t offset = Header::SIZE;
+	decode(file, offset, pixels, width * height);
 }
 
-void TgaImage::ParseRLEBlackWhite(std::ifstream& inStream)
+std::vector<uint32_t> TgaImage::GetScanLineTable(std::span<const uint8_t> file) const
 {
-	if (!inStream.good())
+	if (this->extensions == nullptr || this->extensions->ScanLineOffset == 0)
 	{
-		return;
+		return {};
 	}
 
-	size_t pixelsLength = (size_t)(this->header->Width * this->header->Height);
-	this->pixelBuffer = std::make_shared<Vec4[]>(pixelsLength);
+	size_t height = this->header->Height;
+	std::span<const uint8_t> table = GetBlock(file, this->extensions->ScanLineOffset, height * sizeof(uint32_t));
 
-	// Go to the pixel data position.
-	inStream.seekg(Header::SIZE, std::ios::beg);
-
-	size_t i = 0;
-	while (i < pixelsLength)
+	if (table.size() != height * sizeof(uint32_t))
 	{
-		uint8_t packet = 0;
-		inStream.read((char*)&packet, sizeof(uint8_t));
-
-		uint8_t pixelCount = (packet & EPacketMask::PixelCount) + 1;
+		return {};
+	}
 
-		if (packet & EPacketMask::RunLengthPacket)
-		{
-			Vec4 pixelValue = {};
-			inStream.read((char*)&pixelValue.x, sizeof(uint8_t));
+	std::vector<uint32_t> scanLineTable(height);
+	std::memcpy(scanLineTable.data(), table.data(), table.size());
 
-			if (this->GetAlphaChannelDepth() == 8) // 32 bit pixels
-			{
-				inStream.read((char*)&pixelValue.w, sizeof(uint8_t));
-			}
+	// Scanlines are stored in order after the header, so the offsets can only increase.
+	for (size_t i = 0; i < height; i++)
+	{
+		uint32_t previous = i > 0 ? scanLineTable[i - 1] : Header::SIZE;
 
-			// Run length packet.
-			for (size_t j = 0; j < pixelCount; j++)
-			{
-				this->pixelBuffer[i] = pixelValue;
-				i++;
-			}
-		}
-		else
+		if (scanLineTable[i] < previous || scanLineTable[i] >= file.size())
 		{
-			// Raw packet.
-			for (size_t j = 0; j < pixelCount; j++)
-			{
-				inStream.read((char*)&this->pixelBuffer[i].x, sizeof(uint8_t));
-
-				if (this->GetAlphaChannelDepth() == 8) // 32 bit pixels
-				{
-					inStream.read((char*)&this->pixelBuffer[i].w, sizeof(uint8_t));
-				}
-
-				i++;
-			}
+			return {};
 		}
 	}
+
+	return scanLineTable;
 }
 
-void TgaImage::PopulateHeader(std::ifstream& inStream)
+void TgaImage::PopulateHeader(std::span<const uint8_t> file)
 {
-	if (!inStream.good())
-	{
-		return;
-	}
-
 	this->header = std::make_unique<Header>();
-
-	// Go to the beginning of the file.
-	inStream.seekg(0, std::ios::beg);
-
-	inStream.read((char*)&header->IdLength, sizeof(uint8_t));
-	inStream.read((char*)&header->ColorMapType, sizeof(uint8_t));
-	inStream.read((char*)&header->ImageType, sizeof(uint8_t));
-
-	// Color Map Specification Fields. 5 bytes.
-	inStream.read((char*)&header->ColorMapFirstEntryIndex, sizeof(uint16_t));
-	inStream.read((char*)&header->ColorMapLength, sizeof(uint16_t));
-	inStream.read((char*)&header->ColorMapEntrySize, sizeof(uint8_t));
-
-	// Image Specification Fields. 10 bytes.
-	inStream.read((char*)&header->XOrigin, sizeof(uint16_t));
-	inStream.read((char*)&header->YOrigin, sizeof(uint16_t));
-	inStream.read((char*)&header->Width, sizeof(uint16_t));
-	inStream.read((char*)&header->Height, sizeof(uint16_t));
-	inStream.read((char*)&header->PixelDepth, sizeof(uint8_t));
-	inStream.read((char*)&header->ImageDescriptor, sizeof(uint8_t));
+	ReadHeader(file, *this->header);
 }
 
-void TgaImage::PopulatePixelBuffer(std::ifstream& inStream)
+void TgaImage::PopulatePixelBuffer(std::span<const uint8_t> file)
 {
-	if (!inStream.good())
-	{
-		return;
-	}
+	size_t pixelsLength = (size_t)this->header->Width * this->header->Height;
+	this->pixelBuffer = PixelPool::GetShared().Allocate(pixelsLength);
 
-	size_t pixelsLength = (size_t)(this->header->Width * this->header->Height);
-	this->pixelBuffer = std::make_shared<Vec4[]>(pixelsLength);
+	bool hasAlpha = this->GetAlphaChannelDepth() == 8; // 32 bit pixels
+	size_t bytesPerPixel = hasAlpha ? 4 : 3;
 
-	// Go to the pixel data position.
-	inStream.seekg(Header::SIZE, std::ios::beg);
+	// Swizzle all the pixel data to Vec4 at once. A truncated file leaves the missing pixels black.
+	std::span<const uint8_t> pixels = GetBlock(file, Header::SIZE, pixelsLength * bytesPerPixel);
+	size_t pixelCount = pixels.size() / bytesPerPixel;
 
-	for (size_t i = 0; i < pixelsLength; i++)
+	if (hasAlpha)
 	{
-		inStream.read((char*)&this->pixelBuffer[i].z, sizeof(uint8_t));
-		inStream.read((char*)&this->pixelBuffer[i].y, sizeof(uint8_t));
-		inStream.read((char*)&this->pixelBuffer[i].x, sizeof(uint8_t));
-
-		if (this->GetAlphaChannelDepth() == 8) // 32 bit pixels
-		{
-			inStream.read((char*)&this->pixelBuffer[i].w, sizeof(uint8_t));
-		}
+		PixelSwizzle::BgraToVec4(pixels.data(), this->pixelBuffer.get(), pixelCount);
 	}
-}
-
-void TgaImage::PopulateColorMappedPixels(std::ifstream& inStream)
-{
-	if (!inStream.good())
+	else
 	{
-		return;
+		PixelSwizzle::BgrToVec4(pixels.data(), this->pixelBuffer.get(), pixelCount);
 	}
 
+	std::fill(this->pixelBuffer.get() + pixelCount, this->pixelBuffer.get() + pixelsLength, Vec4{});
+}
+
+void TgaImage::PopulateColorMappedPixels(std::span<const uint8_t> file)
+{
 	size_t pixelsLength = (size_t)this->header->Width * this->header->Height;
 	size_t colorMapLengthBytes = (size_t)this->header->ColorMapLength * (this->header->ColorMapEntrySize / 8);
 
-	// Go to the pixel data position.
-	inStream.seekg((size_t)Header::SIZE + this->header->ColorMapFirstEntryIndex + colorMapLengthBytes, std::ios::beg);
+	// The indices follow the color map.
+	std::span<const uint8_t> indices = GetBlock(file, (size_t)Header::SIZE + this->header->ColorMapFirstEntryIndex + colorMapLengthBytes, pixelsLength);
 
 	this->colorMappedPixels = std::make_shared<uint8_t[]>(pixelsLength);
-	for (size_t i = 0; i < pixelsLength; i++)
-	{
-		inStream.read((char*)&this->colorMappedPixels[i], sizeof(uint8_t));
-	}
+	std::copy(indices.begin(), indices.end(), this->colorMappedPixels.get());
 }
 
 void TgaImage::PopulatePixelBuffer(const std::shared_ptr<Vec4[]>& colorMap)
 {
 	size_t pixelsLength = (size_t)this->header->Width * this->header->Height;
-	this->pixelBuffer = std::make_shared<Vec4[]>(pixelsLength);
+	this->pixelBuffer = PixelPool::GetShared().Allocate(pixelsLength);
 
 	for (size_t i = 0; i < pixelsLength; i++)
 	{
@@ -392,123 +1073,77 @@ void TgaImage::PopulatePixelBuffer(const std::shared_ptr<Vec4[]>& colorMap)
 	}
 }
 
-void TgaImage::PopulateFooter(std::ifstream& inStream)
+void TgaImage::PopulateFooter(std::span<const uint8_t> file)
 {
-	if (!inStream.good())
-	{
-		return;
-	}
-
-	// Go to 18 bytes from the end.
-	inStream.seekg(-Footer::SIG_SIZE, std::ios_base::end);
-
-	// Signature string of "TRUEVISION-XFILE" should always be in bytes 8-23 of the footer area, if the footer is valid.
-	std::string validSignature = "TRUEVISION-XFILE";
-	char sig[Footer::SIG_SIZE];
-	inStream.read(sig, Footer::SIG_SIZE);
-
-	if (validSignature.compare(0, validSignature.length(), sig) == 0)
+	Footer footer;
+	if (ReadFooter(file, footer))
 	{
-		this->footer = std::make_unique<Footer>();
-
-		// Go to 26 bytes from the end.
-		inStream.seekg(-Footer::SIZE, std::ios_base::end);
-
-		inStream.read((char*)&this->footer->ExtensionAreaOffset, sizeof(uint32_t));
-		inStream.read((char*)&this->footer->DeveloperDirectoryOffset, sizeof(uint32_t));
-		inStream.read((char*)&this->footer->Signature, sizeof(this->footer->Signature));
-		inStream.read((char*)&this->footer->ReservedCharacter, sizeof(uint8_t));
-		inStream.read((char*)&this->footer->ZeroTerminator, sizeof(uint8_t));
+		this->footer = std::make_unique<Footer>(footer);
 	}
 }
 
-void TgaImage::PopulateDeveloperField(std::ifstream& inStream)
+void TgaImage::PopulateDeveloperField(std::span<const uint8_t> file)
 {
-	if (!inStream.good() || this->footer == nullptr || this->footer->DeveloperDirectoryOffset == 0)
+	if (this->footer == nullptr || this->footer->DeveloperDirectoryOffset == 0)
 	{
 		return;
 	}
 
 	this->developerDirectory = std::make_unique<DeveloperDirectory>();
 
-	// Go to the developer directory position.
-	inStream.seekg(this->footer->DeveloperDirectoryOffset, std::ios::beg);
+	// Start at the developer directory position.
+	size_t offset = this->footer->DeveloperDirectoryOffset;
 
-	inStream.read((char*)&this->developerDirectory->NumTagsInDirectory, sizeof(uint16_t));
+	ReadValue(file, offset, this->developerDirectory->NumTagsInDirectory);
 
 	this->developerDirectory->Tags.resize(this->developerDirectory->NumTagsInDirectory);
 	this->developerDirectory->Tags.shrink_to_fit();
 
 	for (auto& tag : this->developerDirectory->Tags)
 	{
-		inStream.read((char*)&tag.Tag, sizeof(uint16_t));
-		inStream.read((char*)&tag.Offset, sizeof(uint32_t));
-		inStream.read((char*)&tag.FieldSize, sizeof(uint32_t));
+		ReadValue(file, offset, tag.Tag);
+		ReadValue(file, offset, tag.Offset);
+		ReadValue(file, offset, tag.FieldSize);
 	}
 }
 
-void TgaImage::PopulateExtensions(std::ifstream& inStream)
+void TgaImage::PopulateExtensions(std::span<const uint8_t> file)
 {
-	if (!inStream.good() || this->footer == nullptr || this->footer->ExtensionAreaOffset == 0)
+	if (this->footer == nullptr || this->footer->ExtensionAreaOffset == 0)
 	{
 		return;
 	}
 
 	this->extensions = std::make_unique<Extensions>();
-
-	/// Go to the extensions position.
-	inStream.seekg(this->footer->ExtensionAreaOffset, std::ios::beg);
-
-	inStream.read((char*)&this->extensions->ExtensionSize, sizeof(uint16_t));
-	inStream.read((char*)&this->extensions->AuthorName, sizeof(this->extensions->AuthorName));
-	inStream.read((char*)&this->extensions->AuthorComment, sizeof(this->extensions->AuthorComment));
-	inStream.read((char*)&this->extensions->DateTimeStamp, sizeof(this->extensions->DateTimeStamp));
-	inStream.read((char*)&this->extensions->JobId, sizeof(this->extensions->JobId));
-	inStream.read((char*)&this->extensions->JobTime, sizeof(this->extensions->JobTime));
-	inStream.read((char*)&this->extensions->SoftwareId, sizeof(this->extensions->SoftwareId));
-	inStream.read((char*)&this->extensions->SoftwareVersion, sizeof(this->extensions->SoftwareVersion));
-	inStream.read((char*)&this->extensions->KeyColor, sizeof(uint32_t));
-	inStream.read((char*)&this->extensions->PixelAspectRatio, sizeof(uint32_t));
-	inStream.read((char*)&this->extensions->GammaValue, sizeof(uint32_t));
-	inStream.read((char*)&this->extensions->ColorCorrectionOffset, sizeof(uint32_t));
-	inStream.read((char*)&this->extensions->PostageStampOffset, sizeof(uint32_t));
-	inStream.read((char*)&this->extensions->ScanLineOffset, sizeof(uint32_t));
-	inStream.read((char*)&this->extensions->AttributesType, sizeof(uint8_t));
+	ReadExtensions(file, this->footer->ExtensionAreaOffset, *this->extensions);
 }
 
 void TgaImage::UpdateColorMapping()
 {
-	this->header->ColorMapEntrySize = this->header->PixelDepth;
+	// Each pixel is stored as an 8 bit index into a 24 or 32 bit color map, depending on whether the image has alpha.
+	this->header->ColorMapEntrySize = this->GetAlphaChannelDepth() == 8 ? 32 : 24;
+	this->header->PixelDepth = 8;
 	this->header->ColorMapFirstEntryIndex = 0;
 	this->header->ColorMapType = 1;
 
 	size_t pixelsLength = (size_t)this->header->Width * this->header->Height;
-	std::unordered_map<Vec4, size_t> newMap;
+	this->colorMappedPixels = std::make_shared<uint8_t[]>(pixelsLength);
 
-	size_t j = 0;
-	for (size_t i = 0; i < pixelsLength; i++)
-	{
-		if (newMap.count(this->pixelBuffer[i]) == 0)
-		{
-			newMap[this->pixelBuffer[i]] = j;
-			j++;
-		}
-	}
+	// Only the channels stored in the color map decide whether two pixels are the same color.
+	const Vec4 channelMask = { 0xFF, 0xFF, 0xFF, this->header->ColorMapEntrySize == 32 ? (uint8_t)0xFF : (uint8_t)0 };
 
-	this->colorMap.reset();
-	this->colorMap = std::make_shared<Vec4[]>(newMap.size());
+	Vec4 palette[ColorPalette::MAX_COLORS];
+	size_t colorCount = 0;
 
-	for (const auto& entry : newMap)
+	if (!ColorPalette::Build(this->pixelBuffer.get(), pixelsLength, channelMask, palette, this->colorMappedPixels.get(), colorCount))
 	{
-		this->colorMap[entry.second] = entry.first;
+		colorCount = ColorPalette::Quantize(this->pixelBuffer.get(), this->header->Width, this->header->Height, channelMask, this->ditherColorMap, palette, this->colorMappedPixels.get());
 	}
 
-	this->header->ColorMapLength = (uint16_t)newMap.size();
+	this->colorMap = std::make_shared<Vec4[]>(colorCount);
+	std::copy(palette, palette + colorCount, this->colorMap.get());
 
-	for (size_t i = 0; i < pixelsLength; i++)
-	{
-		this->colorMappedPixels[i] = newMap[this->pixelBuffer[i]];
-	}
+	this->header->ColorMapLength = (uint16_t)colorCount;
 }
 
 void TgaImage::WriteHeaderToFile(std::ofstream& outFile) const
@@ -519,22 +1154,10 @@ void TgaImage::WriteHeaderToFile(std::ofstream& outFile) const
 	}
 
 	outFile.seekp(0, std::ios::beg);
-
-	outFile.write((char*)&this->header->IdLength, sizeof(uint8_t));
-	outFile.write((char*)&this->header->ColorMapType, sizeof(uint8_t));
-	outFile.write((char*)&this->header->ImageType, sizeof(uint8_t));
-	outFile.write((char*)&this->header->ColorMapFirstEntryIndex, sizeof(uint16_t));
-	outFile.write((char*)&this->header->ColorMapLength, sizeof(uint16_t));
-	outFile.write((char*)&this->header->ColorMapEntrySize, sizeof(uint8_t));
-	outFile.write((char*)&this->header->XOrigin, sizeof(uint16_t));
-	outFile.write((char*)&this->header->YOrigin, sizeof(uint16_t));
-	outFile.write((char*)&this->header->Width, sizeof(uint16_t));
-	outFile.write((char*)&this->header->Height, sizeof(uint16_t));
-	outFile.write((char*)&this->header->PixelDepth, sizeof(uint8_t));
-	outFile.write((char*)&this->header->ImageDescriptor, sizeof(uint8_t));
+	WriteHeader(outFile, *this->header);
 }
 
-void TgaImage::WritePixelDataToFile(std::ofstream& outFile) const
+void TgaImage::WritePixelDataToFile(std::ofstream& outFile, std::vector<uint32_t>& scanLineTable, ThreadPool* threadPool) const
 {
 	switch (this->header->ImageType)
 	{
@@ -558,11 +1181,11 @@ void TgaImage::WritePixelDataToFile(std::ofstream& outFile) const
 		break;
 
 	case EImageType::RunLengthEncodedTrueColor:
-		this->WriteEncodedTrueColorPixelDataToFile(outFile);
+		this->WriteEncodedTrueColorPixelDataToFile(outFile, scanLineTable, threadPool);
 		break;
 
 	case EImageType::RunLengthEncodedBlackAndWhite:
-		this->WriteEncodedBlackWhitePixelDataToFile(outFile);
+		this->WriteEncodedBlackWhitePixelDataToFile(outFile, scanLineTable, threadPool);
 		break;
 
 	default:
@@ -575,325 +1198,387 @@ void TgaImage::WriteColorMappedPixelDataToFile(std::ofstream& outFile) const
 	outFile.seekp((size_t)Header::SIZE + this->header->ColorMapFirstEntryIndex, std::ios::beg);
 	size_t pixelsLength = (size_t)this->header->Width * this->header->Height;
 
-	for (size_t i = 0; i < this->header->ColorMapLength; i++)
-	{
-		outFile.write((char*)&this->colorMap[i].z, sizeof(uint8_t));
-		outFile.write((char*)&this->colorMap[i].y, sizeof(uint8_t));
-		outFile.write((char*)&this->colorMap[i].x, sizeof(uint8_t));
-
-		if (this->header->ColorMapEntrySize == 32) // 32 bits
-		{
-			outFile.write((char*)&this->colorMap[i].w, sizeof(uint8_t));
-		}
-	}
+	size_t entrySize = this->header->ColorMapEntrySize == 32 ? 4 : 3; // 32 bits
+	WritePackedPixels(outFile, this->colorMap.get(), this->header->ColorMapLength, entrySize);
 
-	for (size_t i = 0; i < pixelsLength; i++)
-	{
-		outFile.write((char*)&this->colorMappedPixels[i], sizeof(uint8_t));
-	}
+	outFile.write((char*)this->colorMappedPixels.get(), pixelsLength);
 }
 
 void TgaImage::WriteTrueColorPixelDataToFile(std::ofstream& outFile) const
 {
 	outFile.seekp(Header::SIZE, std::ios::beg);
-	size_t pixelsLength = (size_t)(this->header->Width * this->header->Height);
-
-	for (size_t i = 0; i < pixelsLength; i++)
-	{
-		outFile.write((char*)&this->pixelBuffer[i].z, sizeof(uint8_t));
-		outFile.write((char*)&this->pixelBuffer[i].y, sizeof(uint8_t));
-		outFile.write((char*)&this->pixelBuffer[i].x, sizeof(uint8_t));
+	size_t pixelsLength = (size_t)this->header->Width * this->header->Height;
 
-		if (this->GetAlphaChannelDepth() == 8)
-		{
-			outFile.write((char*)&this->pixelBuffer[i].w, sizeof(uint8_t));
-		}
-	}
+	size_t bytesPerPixel = this->GetAlphaChannelDepth() == 8 ? 4 : 3;
+	WritePackedPixels(outFile, this->pixelBuffer.get(), pixelsLength, bytesPerPixel);
 }
 
 void TgaImage::WriteBlackWhitePixelDataToFile(std::ofstream& outFile) const
 {
 	outFile.seekp(Header::SIZE, std::ios::beg);
-	size_t pixelsLength = (size_t)(this->header->Width * this->header->Height);
-
-	for (size_t i = 0; i < pixelsLength; i++)
-	{
-		outFile.write((char*)&this->pixelBuffer[i].x, sizeof(uint8_t));
+	size_t pixelsLength = (size_t)this->header->Width * this->header->Height;
 
-		if (this->header->PixelDepth == 16 && this->GetAlphaChannelDepth() == 8)
-		{
-			outFile.write((char*)&this->pixelBuffer[i].w, sizeof(uint8_t));
-		}
-	}
+	size_t bytesPerPixel = this->header->PixelDepth == 16 && this->GetAlphaChannelDepth() == 8 ? 2 : 1;
+	WritePackedPixels(outFile, this->pixelBuffer.get(), pixelsLength, bytesPerPixel);
 }
 
-void TgaImage::WriteEncodedTrueColorPixelDataToFile(std::ofstream& outFile) const
+void TgaImage::WriteEncodedTrueColorPixelDataToFile(std::ofstream& outFile, std::vector<uint32_t>& scanLineTable, ThreadPool* threadPool) const
 {
 	outFile.seekp(Header::SIZE, std::ios::beg);
-	size_t pixelsLength = (size_t)(this->header->Width * this->header->Height);
-
-	size_t i = 0;
-	while (i < pixelsLength)
-	{
-		std::vector<uint8_t> packet = {};
-		if (this->pixelBuffer[i] == this->pixelBuffer[i + 1])
-		{
-			packet = this->EncodeTrueColorRunLengthPacket(i);
-		}
-		else
-		{
-			packet = this->EncodeTrueColorRawPacket(i);
-		}
 
-		outFile.write((char*)packet.data(), packet.size());
-	}
+	size_t bytesPerPixel = this->GetAlphaChannelDepth() == 8 ? 4 : 3;
+	WriteRunLengthPixels(outFile, this->pixelBuffer.get(), this->header->Width, this->header->Height, bytesPerPixel, scanLineTable, threadPool);
 }
 
-void TgaImage::WriteEncodedBlackWhitePixelDataToFile(std::ofstream& outFile) const
+void TgaImage::WriteEncodedBlackWhitePixelDataToFile(std::ofstream& outFile, std::vector<uint32_t>& scanLineTable, ThreadPool* threadPool) const
 {
 	outFile.seekp(Header::SIZE, std::ios::beg);
-	size_t pixelsLength = (size_t)(this->header->Width * this->header->Height);
-
-	size_t i = 0;
-	while (i < pixelsLength)
-	{
-		std::vector<uint8_t> packet = {};
-		if (this->pixelBuffer[i] == this->pixelBuffer[i + 1])
-		{
-			packet = this->EncodeBlackWhiteRunLengthPacket(i);
-		}
-		else
-		{
-			packet = this->EncodeBlackWhiteRawPacket(i);
-		}
 
-		outFile.write((char*)packet.data(), packet.size());
-	}
+	size_t bytesPerPixel = this->GetAlphaChannelDepth() == 8 ? 2 : 1;
+	WriteRunLengthPixels(outFile, this->pixelBuffer.get(), this->header->Width, this->header->Height, bytesPerPixel, scanLineTable, threadPool);
 }
 
-std::vector<uint8_t> TgaImage::EncodeTrueColorRunLengthPacket(size_t& i) const
+uint32_t TgaImage::WriteScanLineTableToFile(std::ofstream& outFile, const std::vector<uint32_t>& scanLineTable) const
 {
-	std::vector<uint8_t> packet = {};
-	uint8_t runLengthBit = EPacketMask::RunLengthPacket;
-	uint8_t count = 0;
-	uint8_t j = 1;
+	return WriteScanLineTable(outFile, scanLineTable);
+}
 
-	while (count < 127 && (this->pixelBuffer[i] == this->pixelBuffer[i + j]))
-	{
-		count++;
-		j++;
+uint32_t TgaImage::WriteExtensionsToFile(std::ofstream& outFile, const uint32_t scanLineOffset) const
+{
+	return WriteExtensions(outFile, this->extensions.get(), scanLineOffset);
+}
 
-		if ((i + j) % (this->header->Width - 1) == 0)
-		{
-			// Packets should not cross scan lines. TGA 2.0 spec.
-			break;
-		}
-	}
+void TgaImage::WriteFooterToFile(std::ofstream& outFile, const uint32_t extensionAreaOffset) const
+{
+	WriteFooter(outFile, this->footer != nullptr, extensionAreaOffset);
+}
 
-	uint8_t repititionCountField = runLengthBit | count;
-	packet.push_back(repititionCountField);
+const std::shared_ptr<Vec4[]> TgaImage::GetPixelBuffer() const
+{
+	return this->pixelBuffer;
+}
 
-	packet.push_back(this->pixelBuffer[i].z);
-	packet.push_back(this->pixelBuffer[i].y);
-	packet.push_back(this->pixelBuffer[i].x);
+const Vec4* TgaImage::GetMappedPixels() const
+{
+	return this->mappedPixels;
+}
 
-	if (this->GetAlphaChannelDepth() == 8)
-	{
-		packet.push_back(this->pixelBuffer[i].w);
-	}
+uint16_t TgaImage::GetWidth() const
+{
+	return this->header->Width;
+}
 
-	i += count + 1;
+uint16_t TgaImage::GetHeight() const
+{
+	return this->header->Height;
+}
 
-	return packet;
+EImageType TgaImage::GetImageType() const
+{
+	return this->header->ImageType;
 }
 
-std::vector<uint8_t> TgaImage::EncodeTrueColorRawPacket(size_t& i) const
+EErrorCode TgaScanlineReader::Open(const std::string& filename)
 {
-	std::vector<uint8_t> packet = {};
-	uint8_t runLengthBit = EPacketMask::RawPacket;
-	uint8_t count = 0;
-	size_t currentI = i;
+	this->inStream.open(filename, std::ios::in | std::ios::binary);
 
-	while (count < 127 && (this->pixelBuffer[currentI] != this->pixelBuffer[currentI + 1]))
+	if (!this->inStream.good())
 	{
-		count++;
-		currentI++;
+		return EErrorCode::FilePath;
+	}
 
-		if ((currentI + 1) % (this->header->Width - 1) == 0)
-		{
-			// Packets should not cross scan lines. TGA 2.0 spec.
-			break;
-		}
+	uint8_t headerBytes[Header::SIZE] = {};
+	this->inStream.read((char*)headerBytes, Header::SIZE);
+
+	if (this->inStream.gcount() != Header::SIZE)
+	{
+		return EErrorCode::NoImageDataOrTypeNotSupported;
 	}
 
-	uint8_t repititionCountField = runLengthBit | count;
-	packet.push_back(repititionCountField);
+	this->header = {};
+	ReadHeader(std::span<const uint8_t>(headerBytes, Header::SIZE), this->header);
 
-	for (size_t k = 0; k <= count; k++)
+	switch (this->header.ImageType)
 	{
-		packet.push_back(this->pixelBuffer[i].z);
-		packet.push_back(this->pixelBuffer[i].y);
-		packet.push_back(this->pixelBuffer[i].x);
+	case EImageType::UncompressedTrueColor:
+	case EImageType::RunLengthEncodedTrueColor:
+		if (this->header.PixelDepth != 32 && this->header.PixelDepth != 24)
+		{
+			return EErrorCode::NoImageDataOrTypeNotSupported;
+		}
+
+		this->bytesPerPixel = this->header.PixelDepth / 8;
+		this->swizzle = this->bytesPerPixel == 4 ? &PixelSwizzle::BgraToVec4 : &PixelSwizzle::BgrToVec4;
+		break;
 
-		if (this->GetAlphaChannelDepth() == 8)
+	case EImageType::UncompressedBlackAndWhite:
+	case EImageType::RunLengthEncodedBlackAndWhite:
+		if (this->header.PixelDepth != 16 && this->header.PixelDepth != 8)
 		{
-			packet.push_back(this->pixelBuffer[i].w);
+			return EErrorCode::NoImageDataOrTypeNotSupported;
 		}
 
-		i++;
-	}
+		this->bytesPerPixel = this->header.PixelDepth / 8;
+		this->swizzle = this->bytesPerPixel == 2 ? &PixelSwizzle::GrayAlphaToVec4 : &PixelSwizzle::GrayToVec4;
+		break;
 
-	return packet;
-}
+	default:
+		// Color mapped images need every pixel to rebuild their palette when written, so they cannot be streamed.
+		return EErrorCode::NoImageDataOrTypeNotSupported;
+	}
 
-std::vector<uint8_t> TgaImage::EncodeBlackWhiteRunLengthPacket(size_t& i) const
-{
-	std::vector<uint8_t> packet = {};
-	uint8_t runLengthBit = EPacketMask::RunLengthPacket;
-	uint8_t count = 0;
-	uint8_t j = 1;
+	// The footer and extension area sit after the pixels, so they are read before seeking back to the first scanline.
+	this->footer = nullptr;
+	this->extensions = nullptr;
+	this->inStream.seekg(0, std::ios::end);
+	size_t fileSize = (size_t)this->inStream.tellg();
 
-	while (count < 127 && (this->pixelBuffer[i] == this->pixelBuffer[i + j]))
+	if (fileSize >= Footer::SIZE)
 	{
-		count++;
-		j++;
+		uint8_t footerBytes[Footer::SIZE] = {};
+		this->inStream.seekg(fileSize - Footer::SIZE, std::ios::beg);
+		this->inStream.read((char*)footerBytes, Footer::SIZE);
 
-		if ((i + j) % (this->header->Width - 1) == 0)
+		Footer footer;
+		if (this->inStream.gcount() == Footer::SIZE && ReadFooter(std::span<const uint8_t>(footerBytes, Footer::SIZE), footer))
 		{
-			// Packets should not cross scan lines. TGA 2.0 spec.
-			break;
+			this->footer = std::make_unique<Footer>(footer);
 		}
 	}
 
-	uint8_t repititionCountField = runLengthBit | count;
-	packet.push_back(repititionCountField);
-
-	packet.push_back(this->pixelBuffer[i].x);
-
-	if (this->GetAlphaChannelDepth() == 8)
+	if (this->footer != nullptr && this->footer->ExtensionAreaOffset != 0)
 	{
-		packet.push_back(this->pixelBuffer[i].w);
+		// Fields past the end of the file keep their defaults, as they do when the whole file is loaded.
+		std::vector<uint8_t> extensionBytes(Extensions::SIZE);
+		this->inStream.clear();
+		this->inStream.seekg(this->footer->ExtensionAreaOffset, std::ios::beg);
+		this->inStream.read((char*)extensionBytes.data(), Extensions::SIZE);
+		extensionBytes.resize((size_t)std::max<std::streamsize>(this->inStream.gcount(), 0));
+
+		this->extensions = std::make_unique<Extensions>();
+		ReadExtensions(extensionBytes, 0, *this->extensions);
 	}
 
-	i += count + 1;
+	this->inStream.clear();
+
+	// Skip the image ID and any color map to reach the first scanline.
+	size_t colorMapBytes = this->header.ColorMapType == 1 ? (size_t)this->header.ColorMapLength * ((this->header.ColorMapEntrySize + 7) / 8) : 0;
+	this->inStream.seekg((size_t)Header::SIZE + this->header.IdLength + colorMapBytes, std::ios::beg);
+
+	this->chunk.clear();
+	this->chunkPosition = 0;
+	this->packetRemaining = 0;
+	this->packetIsRun = false;
+	this->scanlineBytes.resize((size_t)this->header.Width * this->bytesPerPixel);
 
-	return packet;
+	return EErrorCode::NoError;
+}
+
+uint16_t TgaScanlineReader::GetWidth() const
+{
+	return this->header.Width;
+}
+
+uint16_t TgaScanlineReader::GetHeight() const
+{
+	return this->header.Height;
+}
+
+EImageType TgaScanlineReader::GetImageType() const
+{
+	return this->header.ImageType;
 }
 
-std::vector<uint8_t> TgaImage::EncodeBlackWhiteRawPacket(size_t& i) const
+bool TgaScanlineReader::ReadScanline(Vec4* row)
 {
-	std::vector<uint8_t> packet = {};
-	uint8_t runLengthBit = EPacketMask::RawPacket;
-	uint8_t count = 0;
-	size_t currentI = i;
+	size_t width = this->header.Width;
 
-	while (count < 127 && (this->pixelBuffer[currentI] != this->pixelBuffer[currentI + 1]))
+	if (this->header.ImageType == EImageType::UncompressedTrueColor || this->header.ImageType == EImageType::UncompressedBlackAndWhite)
 	{
-		count++;
-		currentI++;
+		size_t pixelsRead = this->ReadBytes(this->scanlineBytes.data(), this->scanlineBytes.size()) / this->bytesPerPixel;
+		this->swizzle(this->scanlineBytes.data(), row, pixelsRead);
 
-		if ((currentI + 1) % (this->header->Width - 1) == 0)
-		{
-			// Packets should not cross scan lines. TGA 2.0 spec.
-			break;
-		}
+		std::fill(row + pixelsRead, row + width, Vec4{});
+		return pixelsRead == width;
 	}
 
-	uint8_t repititionCountField = runLengthBit | count;
-	packet.push_back(repititionCountField);
-
-	for (size_t k = 0; k <= count; k++)
+	size_t x = 0;
+	while (x < width)
 	{
-		packet.push_back(this->pixelBuffer[i].x);
+		if (this->packetRemaining == 0)
+		{
+			uint8_t packet = 0;
+			if (this->ReadBytes(&packet, 1) != 1)
+			{
+				break;
+			}
 
-		if (this->GetAlphaChannelDepth() == 8)
+			this->packetRemaining = (size_t)(packet & EPacketMask::PixelCount) + 1;
+			this->packetIsRun = (packet & EPacketMask::RunLengthPacket) != 0;
+
+			if (this->packetIsRun)
+			{
+				if (this->ReadBytes(this->scanlineBytes.data(), this->bytesPerPixel) != this->bytesPerPixel)
+				{
+					this->packetRemaining = 0;
+					break;
+				}
+
+				this->swizzle(this->scanlineBytes.data(), &this->packetValue, 1);
+			}
+		}
+
+		size_t count = std::min(this->packetRemaining, width - x);
+
+		if (this->packetIsRun)
+		{
+			PixelSwizzle::Fill(row + x, this->packetValue, count);
+		}
+		else
 		{
-			packet.push_back(this->pixelBuffer[i].w);
+			size_t pixelsRead = this->ReadBytes(this->scanlineBytes.data(), count * this->bytesPerPixel) / this->bytesPerPixel;
+			this->swizzle(this->scanlineBytes.data(), row + x, pixelsRead);
+
+			if (pixelsRead < count)
+			{
+				x += pixelsRead;
+				this->packetRemaining = 0;
+				break;
+			}
 		}
 
-		i++;
+		x += count;
+		this->packetRemaining -= count;
 	}
 
-	return packet;
+	std::fill(row + x, row + width, Vec4{});
+	return x == width;
 }
 
-void TgaImage::WriteDeveloperDirectoryToFile(std::ofstream& outFile) const
+size_t TgaScanlineReader::ReadBytes(uint8_t* destination, const size_t count)
 {
-	if (!outFile.good() || this->footer == nullptr || this->developerDirectory == nullptr)
+	size_t copied = 0;
+
+	while (copied < count)
 	{
-		return;
-	}
+		if (this->chunkPosition == this->chunk.size())
+		{
+			// Reads of a chunk or more skip the chunk and go straight to their destination.
+			if (count - copied >= CHUNK_SIZE)
+			{
+				this->inStream.read((char*)destination + copied, count - copied);
+				return copied + (size_t)this->inStream.gcount();
+			}
+
+			this->chunk.resize(CHUNK_SIZE);
+			this->inStream.read((char*)this->chunk.data(), CHUNK_SIZE);
+			this->chunk.resize((size_t)this->inStream.gcount());
+			this->chunkPosition = 0;
 
-	outFile.seekp(this->footer->DeveloperDirectoryOffset, std::ios::beg);
+			if (this->chunk.empty())
+			{
+				break;
+			}
+		}
 
-	outFile.write((char*)&this->developerDirectory->NumTagsInDirectory, sizeof(uint16_t));
+		size_t available = std::min(count - copied, this->chunk.size() - this->chunkPosition);
+		std::memcpy(destination + copied, this->chunk.data() + this->chunkPosition, available);
 
-	for (const auto& tag : this->developerDirectory->Tags)
-	{
-		outFile.write((char*)&tag.Tag, sizeof(uint16_t));
-		outFile.write((char*)&tag.Offset, sizeof(uint32_t));
-		outFile.write((char*)&tag.FieldSize, sizeof(uint32_t));
+		this->chunkPosition += available;
+		copied += available;
 	}
+
+	return copied;
 }
 
-void TgaImage::WriteExtensionsToFile(std::ofstream& outFile) const
+EErrorCode TgaScanlineWriter::Open(const std::string& filename, const TgaScanlineReader& source)
 {
-	if (!outFile.good() || this->footer == nullptr || this->extensions == nullptr)
+	if (source.bytesPerPixel == 0)
 	{
-		return;
+		return EErrorCode::NoImageDataOrTypeNotSupported;
 	}
 
-	outFile.seekp(this->footer->ExtensionAreaOffset, std::ios::beg);
+	this->outFile.open(filename, std::ios::out | std::ios::binary);
 
-	outFile.write((char*)&this->extensions->ExtensionSize, sizeof(uint16_t));
-	outFile.write((char*)&this->extensions->AuthorName, sizeof(this->extensions->AuthorName));
-	outFile.write((char*)&this->extensions->AuthorComment, sizeof(this->extensions->AuthorComment));
-	outFile.write((char*)&this->extensions->DateTimeStamp, sizeof(this->extensions->DateTimeStamp));
-	outFile.write((char*)&this->extensions->JobId, sizeof(this->extensions->JobId));
-	outFile.write((char*)&this->extensions->JobTime, sizeof(this->extensions->JobTime));
-	outFile.write((char*)&this->extensions->SoftwareId, sizeof(this->extensions->SoftwareId));
-	outFile.write((char*)&this->extensions->SoftwareVersion, sizeof(this->extensions->SoftwareVersion));
-	outFile.write((char*)&this->extensions->KeyColor, sizeof(uint32_t));
-	outFile.write((char*)&this->extensions->PixelAspectRatio, sizeof(uint32_t));
-	outFile.write((char*)&this->extensions->GammaValue, sizeof(uint32_t));
-	outFile.write((char*)&this->extensions->ColorCorrectionOffset, sizeof(uint32_t));
-	outFile.write((char*)&this->extensions->PostageStampOffset, sizeof(uint32_t));
-	outFile.write((char*)&this->extensions->ScanLineOffset, sizeof(uint32_t));
-	outFile.write((char*)&this->extensions->AttributesType, sizeof(uint8_t));
-}
+	if (!this->outFile.good())
+	{
+		return EErrorCode::FilePath;
+	}
 
-void TgaImage::WriteFooterToFile(std::ofstream& outFile) const
-{
-	if (!outFile.good() || this->footer == nullptr)
+	// The image ID and color map are not carried over, so the pixels follow the header directly.
+	this->header = source.header;
+	this->header.IdLength = 0;
+	this->header.ColorMapType = 0;
+	this->header.ColorMapFirstEntryIndex = 0;
+	this->header.ColorMapLength = 0;
+	this->header.ColorMapEntrySize = 0;
+
+	this->bytesPerPixel = source.bytesPerPixel;
+	switch (this->bytesPerPixel)
 	{
-		return;
+	case 4:
+		this->swizzle = &PixelSwizzle::Vec4ToBgra;
+		break;
+
+	case 3:
+		this->swizzle = &PixelSwizzle::Vec4ToBgr;
+		break;
+
+	case 2:
+		this->swizzle = &PixelSwizzle::Vec4ToGrayAlpha;
+		break;
+
+	default:
+		this->swizzle = &PixelSwizzle::Vec4ToGray;
+		break;
 	}
 
-	outFile.seekp(-Footer::SIZE, std::ios_base::end);
+	// Room for the scanline either packed or run-length encoded, which can be up to one byte per pixel larger.
+	this->scanlineBytes.resize((size_t)this->header.Width * (this->bytesPerPixel + 1));
 
-	outFile.write((char*)&this->footer->ExtensionAreaOffset, sizeof(uint32_t));
-	outFile.write((char*)&this->footer->DeveloperDirectoryOffset, sizeof(uint32_t));
-	outFile.write((char*)&this->footer->Signature, sizeof(this->footer->Signature));
-	outFile.write((char*)&this->footer->ReservedCharacter, sizeof(uint8_t));
-	outFile.write((char*)&this->footer->ZeroTerminator, sizeof(uint8_t));
-}
+	this->extensions = source.extensions != nullptr ? std::make_unique<Extensions>(*source.extensions) : nullptr;
+	this->hadFooter = source.footer != nullptr;
+	this->scanLineOffsets.clear();
+	this->lastScanlineSize = 0;
 
-const std::shared_ptr<Vec4[]> TgaImage::GetPixelBuffer() const
-{
-	return this->pixelBuffer;
-}
+	WriteHeader(this->outFile, this->header);
 
-uint16_t TgaImage::GetWidth() const
-{
-	return this->header->Width;
+	return EErrorCode::NoError;
 }
 
-uint16_t TgaImage::GetHeight() const
+void TgaScanlineWriter::WriteScanline(const Vec4* row)
 {
-	return this->header->Height;
+	if (this->header.ImageType == EImageType::RunLengthEncodedTrueColor || this->header.ImageType == EImageType::RunLengthEncodedBlackAndWhite)
+	{
+		size_t size = EncodeRunLengthScanline(row, this->header.Width, this->bytesPerPixel, this->scanlineBytes.data());
+		this->scanLineOffsets.push_back(this->scanLineOffsets.empty() ? Header::SIZE : this->scanLineOffsets.back() + this->lastScanlineSize);
+		this->lastScanlineSize = size;
+		this->outFile.write((char*)this->scanlineBytes.data(), size);
+	}
+	else
+	{
+		// The buffer has room for run-length encoding, so only the packed pixels are written.
+		size_t size = (size_t)this->header.Width * this->bytesPerPixel;
+		this->swizzle(row, this->scanlineBytes.data(), this->header.Width);
+		this->outFile.write((char*)this->scanlineBytes.data(), size);
+	}
 }
 
-EImageType TgaImage::GetImageType() const
+bool TgaScanlineWriter::Close()
 {
-	return this->header->ImageType;
+	// Offsets in the TGA 2.0 fields are 32 bit, so a file past 4 GB has no scan line table.
+	std::vector<uint32_t> scanLineTable;
+	if (!this->scanLineOffsets.empty() && this->scanLineOffsets.back() + this->lastScanlineSize <= UINT32_MAX)
+	{
+		scanLineTable.resize(this->scanLineOffsets.size());
+		std::transform(this->scanLineOffsets.begin(), this->scanLineOffsets.end(), scanLineTable.begin(), [](const uint64_t rowOffset) { return static_cast<uint32_t>(rowOffset); });
+	}
+
+	// The TGA 2.0 fields follow the pixels, as they do when the whole image is saved.
+	uint32_t scanLineOffset = WriteScanLineTable(this->outFile, scanLineTable);
+	uint32_t extensionAreaOffset = WriteExtensions(this->outFile, this->extensions.get(), scanLineOffset);
+	WriteFooter(this->outFile, this->hadFooter, extensionAreaOffset);
+
+	this->outFile.close();
+	return !this->outFile.fail();
 }
\ No newline at end of file
@@ -4,7 +4,11 @@ import <Vector.h>;
 import <string>;
 import <memory>;
 import <vector>;
-import <unordered_map>;
+import <span>;
+import <fstream>;
+import <MappedFile.h>;
+import <PixelPool.h>;
+import <ThreadPool.h>;
 
 namespace Tga
 {
@@ -28,6 +32,14 @@ namespace Tga
 		NoImageDataOrTypeNotSupported = -2
 	};
 
+	/** Enumeration of TGA run-length packet repetition count masks. */
+	enum EPacketMask : uint8_t
+	{
+		RawPacket = 0,
+		RunLengthPacket = 0x80,
+		PixelCount = 0x7F
+	};
+
 	/** Fields of a TGA header. */
 	struct Header
 	{
@@ -67,6 +79,8 @@ namespace Tga
 	/** Fields of TGA extension. */
 	struct Extensions
 	{
+		static const uint16_t SIZE = 495;
+
 		uint16_t ExtensionSize = 0;
 		char AuthorName[41] = {};
 		char AuthorComment[324] = {};
@@ -89,6 +103,7 @@ namespace Tga
 	{
 		static const uint8_t SIZE = 26;
 		static const uint8_t SIG_SIZE = 18;
+		static constexpr const char* SIGNATURE = "TRUEVISION-XFILE";
 		uint32_t ExtensionAreaOffset = 0;
 		uint32_t DeveloperDirectoryOffset = 0;
 		char Signature[16] = {};
@@ -102,10 +117,14 @@ namespace Tga
 	public:
 
 		/**
-		 * Loads a TGA image from file.
+		 * Loads a TGA image from file. The file is memory mapped and parsed in place.
 		 * @param filename The path to a TGA file to load.
+		 * @param mapPixels If true and the image is uncompressed 32 bit true color, the pixels are not decoded.
+		 * The file stays mapped and GetMappedPixels views the pixels in place instead.
+		 * @param threadPool The threads run-length encoded scanlines are decoded on, or null to start one thread per
+		 * hardware thread for the call.
 		 */
-		EErrorCode LoadFromFile(const std::string& filename);
+		EErrorCode LoadFromFile(const std::string& filename, const bool mapPixels = false, ThreadPool* threadPool = nullptr);
 
 		/**
 		 * Get the width of the image.
@@ -128,15 +147,29 @@ namespace Tga
 		~TgaImage();
 
 		/**
-		 * Get the raw pixel buffer from the TGA image.
+		 * Get the raw pixel buffer from the TGA image. Null while the pixels are only mapped, see GetMappedPixels.
 		 */
 		const std::shared_ptr<Vec4[]> GetPixelBuffer() const;
 
+		/**
+		 * Get a read-only view of the pixels straight from the mapped file, or nullptr if they were decoded.
+		 * The channels are in file order, so x holds blue and z holds red. Effects that treat every channel alike
+		 * can read this directly and hand their result to SetMappedPixelData.
+		 */
+		const Vec4* GetMappedPixels() const;
+
 		/**
 		 * Set the pixel data of the TGA image.
 		 * @param newPixels The new pixel data. Must be same size as original pixel data.
 		 */
-		void SetPixelData(std::unique_ptr<Vec4[]> newPixels);
+		void SetPixelData(PixelPool::Buffer newPixels);
+
+		/**
+		 * Set the pixel data of the TGA image from pixels in the channel order of GetMappedPixels.
+		 * The channels are reordered in place, and the mapped file is released.
+		 * @param newPixels The new pixel data. Must be same size as original pixel data.
+		 */
+		void SetMappedPixelData(PixelPool::Buffer newPixels);
 
 		/**
 		 * Indicates the right-to-left pixel ordering of the TGA image.
@@ -148,16 +181,35 @@ namespace Tga
 		 */
 		bool IsTopToBottomPixelOrder() const;
 
+		/**
+		 * Set whether an ordered dither is used when an image with more than 256 colors is saved color-mapped.
+		 * Dithering hides the banding the smaller palette causes in smooth gradients. Off by default.
+		 * @param dither True to dither.
+		 */
+		void SetColorMapDithering(const bool dither);
+
 		/**
 		 * Get the alpha channel depth of the TGA image.
 		 */
 		uint8_t GetAlphaChannelDepth() const;
 
+		/**
+		 * Get the number of channels the pixels of the TGA image carry: 1 for black and white, 2 for black and white with alpha,
+		 * 3 for color and 4 for color with alpha. Pixels from GetPixelBuffer always have four channels, the extra ones are zero.
+		 */
+		uint8_t GetChannelCount() const;
+
 		/**
 		 * Save the TGA image as a new file at the path given.
 		 * @param filename The path to save the image to.
+		 * @param fileFormat The image type to save as.
+		 * @param replaceAtomically If true the image is written to a temporary file beside filename, which is then
+		 * renamed to filename. Anything reading filename sees either the old file or the whole new image.
+		 * @param threadPool The threads run-length encoded scanlines are encoded on, or null to start one thread per
+		 * hardware thread for the call.
+		 * @return FilePath if the file could not be written or renamed.
 		 */
-		void SaveToFile(const std::string& filename, const EImageType fileFormat);
+		EErrorCode SaveToFile(const std::string& filename, const EImageType fileFormat, const bool replaceAtomically = false, ThreadPool* threadPool = nullptr);
 
 	private:
 
@@ -169,14 +221,6 @@ namespace Tga
 			TopToBottomOrdering = 0x20
 		};
 
-		/** Enumeration of TGA run-length packet repetition count masks. */
-		enum EPacketMask : uint8_t
-		{
-			RawPacket = 0,
-			RunLengthPacket = 0x80,
-			PixelCount = 0x7F
-		};
-
 		/** The header of the TGA image. */
 		std::unique_ptr<Header> header = nullptr;
 
@@ -192,47 +236,77 @@ namespace Tga
 		/** Uncompressed pixel data stored as an array of Vec4. */
 		std::shared_ptr<Vec4[]> pixelBuffer = nullptr;
 
+		/** The file the image was loaded from. Only kept open while mappedPixels views it. */
+		std::unique_ptr<MappedFile> mappedFile = nullptr;
+
+		/** The pixels viewed in place in mappedFile, in file channel order. Only used until pixel data is set. */
+		const Vec4* mappedPixels = nullptr;
+
 		/** Pixels stored as an index into the colorMap. Only used if ImageType==1 (ColorMapped). */
 		std::shared_ptr<uint8_t[]> colorMappedPixels = nullptr;
 
 		/** A mapping of unique pixel values. Only used if ImageType==1 (ColorMapped). */
 		std::shared_ptr<Vec4[]> colorMap = nullptr;
 
+		/** Indicates an ordered dither is used when the pixels have to be quantized to fit the color map. */
+		bool ditherColorMap = false;
+
 		/**
 		 * Parses an uncompressed color mapped TGA image into internal fields.
-		 * @param inStream
+		 * @param file The contents of the file.
 		 */
-		void ParseColorMapped(std::ifstream& inStream);
+		void ParseColorMapped(std::span<const uint8_t> file);
 
 		/**
 		 * Parses an uncompressed true color TGA image into internal fields.
-		 * @param inStream
+		 * @param file The contents of the file.
 		 */
-		void ParseTrueColor(std::ifstream& inStream);
+		void ParseTrueColor(std::span<const uint8_t> file);
 
 		/**
 		 * Parses an uncompressed black and white TGA image into internal fields.
-		 * @param inStream
+		 * @param file The contents of the file.
 		 */
-		void ParseBlackWhite(std::ifstream& inStream);
+		void ParseBlackWhite(std::span<const uint8_t> file);
 
 		/**
 		 * Parses a run-length encoded true color TGA image into internal fields.
-		 * @param inStream
+		 * @param file The contents of the file.
+		 * @param threadPool The threads to decode on, or null.
 		 */
-		void ParseRLETrueColor(std::ifstream& inStream);
+		void ParseRLETrueColor(std::span<const uint8_t> file, ThreadPool* threadPool);
 
 		/**
 		 * Parses a run-length encoded black and white TGA image into internal fields.
-		 * @param inStream
+		 * @param file The contents of the file.
+		 * @param threadPool The threads to decode on, or null.
+		 */
+		void ParseRLEBlackWhite(std::span<const uint8_t> file, ThreadPool* threadPool);
+
+		/** Decodes run-length packets for one pixel size from an offset in the file, returning the number of pixels decoded. */
+		using RunLengthDecoder = size_t (*)(std::span<const uint8_t> file, size_t& offset, Vec4* pixels, const size_t pixelCount);
+
+		/**
+		 * Decodes the run-length encoded pixel data into the pixel buffer. When the file has a scan line table,
+		 * bands of scanlines are decoded in parallel, otherwise the packets are decoded in one pass.
+		 * @param file The contents of the file.
+		 * @param decode The decoder for the pixel size of the image.
+		 * @param threadPool The threads to split the bands across, or null to start one thread per hardware thread.
 		 */
-		void ParseRLEBlackWhite(std::ifstream& inStream);
+		void DecodeRunLengthPixelData(std::span<const uint8_t> file, RunLengthDecoder decode, ThreadPool* threadPool);
+
+		/**
+		 * Get the offset of every scanline from the scan line table in the extension area.
+		 * @param file The contents of the file.
+		 * @return The offsets, or an empty table if there is none or it does not fit the file.
+		 */
+		std::vector<uint32_t> GetScanLineTable(std::span<const uint8_t> file) const;
 
 		/**
 		 * Populate the internal color map from file.
-		 * @param inStream
+		 * @param file The contents of the file.
 		 */
-		void PopulateColorMap(std::ifstream& inStream);
+		void PopulateColorMap(std::span<const uint8_t> file);
 
 		/**
 		 * Update the internal color mapping from the pixelBuffer.
@@ -240,40 +314,40 @@ namespace Tga
 		void UpdateColorMapping();
 
 		/**
-		 * Populate the internal header field from the input stream.
-		 * @param inStream The input stream.
+		 * Populate the internal header field from the file.
+		 * @param file The contents of the file.
 		 */
-		void PopulateHeader(std::ifstream& inStream);
+		void PopulateHeader(std::span<const uint8_t> file);
 
 		/**
-		 * Populate the internal footer field from the input stream.
-		 * @param inStream The input stream.
+		 * Populate the internal footer field from the file.
+		 * @param file The contents of the file.
 		 */
-		void PopulateFooter(std::ifstream& inStream);
+		void PopulateFooter(std::span<const uint8_t> file);
 
 		/**
-		 * Populate the internal developer field from the input stream.
-		 * @param inStream The input stream.
+		 * Populate the internal developer field from the file.
+		 * @param file The contents of the file.
 		 */
-		void PopulateDeveloperField(std::ifstream& inStream);
+		void PopulateDeveloperField(std::span<const uint8_t> file);
 
 		/**
-		 * Populate the internal extensions field from the input stream.
-		 * @param inStream The input stream.
+		 * Populate the internal extensions field from the file.
+		 * @param file The contents of the file.
 		 */
-		void PopulateExtensions(std::ifstream& inStream);
+		void PopulateExtensions(std::span<const uint8_t> file);
 
 		/**
-		 * Populate the color mapped pixel data from the input stream.
-		 * @param inStream The input stream.
+		 * Populate the color mapped pixel data from the file.
+		 * @param file The contents of the file.
 		 */
-		void PopulateColorMappedPixels(std::ifstream& inStream);
+		void PopulateColorMappedPixels(std::span<const uint8_t> file);
 
 		/**
-		 * Populate the uncompressed pixel data from the input stream.
-		 * @param inStream The input stream.
+		 * Populate the uncompressed pixel data from the file.
+		 * @param file The contents of the file.
 		 */
-		void PopulatePixelBuffer(std::ifstream& inStream);
+		void PopulatePixelBuffer(std::span<const uint8_t> file);
 
 		/**
 		 * Takes a color mapping and indices into the color map and populates the raw pixel buffer.
@@ -290,8 +364,10 @@ namespace Tga
 		/**
 		 * Write the TGA pixel data to the output stream.
 		 * @param outFile The output stream.
+		 * @param scanLineTable Filled with the offset of every scanline when the pixels are run-length encoded.
+		 * @param threadPool The threads to encode on, or null.
 		 */
-		void WritePixelDataToFile(std::ofstream& outFile) const;
+		void WritePixelDataToFile(std::ofstream& outFile, std::vector<uint32_t>& scanLineTable, ThreadPool* threadPool) const;
 
 		/**
 		 * Writes the color map and the indices into the color map to the output stream.
@@ -312,61 +388,190 @@ namespace Tga
 		void WriteBlackWhitePixelDataToFile(std::ofstream& outfile) const;
 
 		/**
-		 * Encodes a true color run length packet.
-		 * @param i Index into the pixelBuffer data.
-		 * @return An encoded run length packet.
+		 * Write encoded true color packets to the output stream.
+		 * @param outFile The output stream to write to.
+		 * @param scanLineTable Filled with the offset of every scanline.
+		 * @param threadPool The threads to encode on, or null.
 		 */
-		std::vector<uint8_t> EncodeTrueColorRunLengthPacket(size_t& i) const;
+		void WriteEncodedTrueColorPixelDataToFile(std::ofstream& outFile, std::vector<uint32_t>& scanLineTable, ThreadPool* threadPool) const;
 
 		/**
-		 * Encodes a true color raw packet.
-		 * @param i Index into the pixelBuffer data.
-		 * @return An encoded raw packet.
+		 * Write encoded black and white packets to the output stream.
+		 * @param outFile The output stream to write to.
+		 * @param scanLineTable Filled with the offset of every scanline.
+		 * @param threadPool The threads to encode on, or null.
 		 */
-		std::vector<uint8_t> EncodeTrueColorRawPacket(size_t& i) const;
+		void WriteEncodedBlackWhitePixelDataToFile(std::ofstream& outFile, std::vector<uint32_t>& scanLineTable, ThreadPool* threadPool) const;
 
 		/**
-		 * Encodes a black and white run length packet.
-		 * @param i Index into the pixelBuffer data.
-		 * @return An encoded run length packet.
+		 * Write the TGA scan line table to the end of the output stream.
+		 * @param outFile The output stream to write to.
+		 * @param scanLineTable The offset of every scanline.
+		 * @return The offset the table was written at, or 0 if there is no table.
 		 */
-		std::vector<uint8_t> EncodeBlackWhiteRunLengthPacket(size_t& i) const;
+		uint32_t WriteScanLineTableToFile(std::ofstream& outFile, const std::vector<uint32_t>& scanLineTable) const;
 
 		/**
-		 * Encodes a black and white raw packet.
-		 * @param i Index into the pixelBuffer data.
-		 * @return An encoded raw packet.
+		 * Write the TGA extensions field to the end of the output stream.
+		 * @param outFile The output stream to write to.
+		 * @param scanLineOffset The offset of the scan line table, or 0 if there is none.
+		 * @return The offset the extensions were written at, or 0 if there are none.
 		 */
-		std::vector<uint8_t> EncodeBlackWhiteRawPacket(size_t& i) const;
+		uint32_t WriteExtensionsToFile(std::ofstream& outFile, const uint32_t scanLineOffset) const;
 
 		/**
-		 * Write encoded true color packets to the output stream.
+		 * Write the TGA footer info to the end of the output stream.
 		 * @param outFile The output stream to write to.
+		 * @param extensionAreaOffset The offset of the extensions field, or 0 if there is none.
 		 */
-		void WriteEncodedTrueColorPixelDataToFile(std::ofstream& outFile) const;
+		void WriteFooterToFile(std::ofstream& outFile, const uint32_t extensionAreaOffset) const;
+	};
+
+	/**
+	 * Reads a TGA image one scanline at a time, so images can be processed without holding them in memory.
+	 * Only the current scanline's worth of pixel data is buffered. Supports uncompressed and run-length encoded
+	 * true color and black and white images.
+	 */
+	export class TgaScanlineReader
+	{
+	public:
 
 		/**
-		 * Write encoded black and white packets to the output stream.
-		 * @param outFile The output stream to write to.
+		 * Opens a TGA file and reads its header, ready to read the first scanline.
+		 * @param filename The path to a TGA file to read.
 		 */
-		void WriteEncodedBlackWhitePixelDataToFile(std::ofstream& outFile) const;
+		EErrorCode Open(const std::string& filename);
 
 		/**
-		 * Write the TGA developer field to the output stream.
-		 * @param outFile The output stream to write to.
+		 * Get the width of the image.
 		 */
-		void WriteDeveloperDirectoryToFile(std::ofstream& outFile) const;
+		uint16_t GetWidth() const;
 
 		/**
-		 * Write the TGA extensions field to the output stream.
-		 * @param outFile The output stream to write to.
+		 * Get the height of the image.
 		 */
-		void WriteExtensionsToFile(std::ofstream& outFile) const;
+		uint16_t GetHeight() const;
 
 		/**
-		 * Write the TGA footer info to the output stream.
-		 * @param outFile The output stream to write to.
+		 * Get the image type.
 		 */
-		void WriteFooterToFile(std::ofstream& outFile) const;
+		EImageType GetImageType() const;
+
+		/**
+		 * Decodes the next scanline, in the order scanlines are stored in the file.
+		 * Run-length packets that carry on into the next scanline, which TGA 1.0 files may have, are handled.
+		 * @param row The row to fill, GetWidth() pixels. Pixels missing from a truncated file are set to zero.
+		 * @return False if the file ended before the scanline was complete.
+		 */
+		bool ReadScanline(Vec4* row);
+
+	private:
+
+		friend class TgaScanlineWriter;
+
+		/** The number of bytes read from the file at a time. */
+		static const size_t CHUNK_SIZE = 64 * 1024;
+
+		/** The file being read. */
+		std::ifstream inStream;
+
+		/** The header of the TGA image. */
+		Header header = {};
+
+		/** The size of each pixel in the file, in bytes. */
+		size_t bytesPerPixel = 0;
+
+		/** Converts pixels from file byte order to Vec4. */
+		void (*swizzle)(const uint8_t* source, Vec4* destination, const size_t count) = nullptr;
+
+		/** The extensions field of the TGA image, carried over when it is written. */
+		std::unique_ptr<Extensions> extensions = nullptr;
+
+		/** The footer field of the TGA image. */
+		std::unique_ptr<Footer> footer = nullptr;
+
+		/** The part of the file read ahead of the decoder. */
+		std::vector<uint8_t> chunk = {};
+
+		/** The position of the next unread byte in chunk. */
+		size_t chunkPosition = 0;
+
+		/** The raw pixel bytes of the current scanline. */
+		std::vector<uint8_t> scanlineBytes = {};
+
+		/** The number of pixels left in the current run-length packet. */
+		size_t packetRemaining = 0;
+
+		/** Indicates the current run-length packet repeats one pixel. */
+		bool packetIsRun = false;
+
+		/** The pixel the current run-length packet repeats. */
+		Vec4 packetValue = {};
+
+		/**
+		 * Read bytes from the file through chunk. Large reads go straight into the destination.
+		 * @param destination Where to copy the bytes.
+		 * @param count The number of bytes to read.
+		 * @return The number of bytes read, fewer than count if the file ended first.
+		 */
+		size_t ReadBytes(uint8_t* destination, const size_t count);
+	};
+
+	/**
+	 * Writes a TGA image one scanline at a time, as the scanlines are produced.
+	 * Run-length encoded images are encoded one scanline at a time, so no packet crosses a scanline as TGA 2.0 requires.
+	 */
+	export class TgaScanlineWriter
+	{
+	public:
+
+		/**
+		 * Creates a TGA file and writes its header, ready for the first scanline.
+		 * The image has the same size, type, pixel depth and pixel order as the source image.
+		 * @param filename The path to save the image to.
+		 * @param source The reader of the image the scanlines come from.
+		 */
+		EErrorCode Open(const std::string& filename, const TgaScanlineReader& source);
+
+		/**
+		 * Encodes and writes the next scanline, in the order scanlines are stored in the file.
+		 * @param row The row to write, the width of the image.
+		 */
+		void WriteScanline(const Vec4* row);
+
+		/**
+		 * Writes the scan line table, extension area and footer as a full save would, then closes the file.
+		 * @return True if every scanline was written.
+		 */
+		bool Close();
+
+	private:
+
+		/** The file being written. */
+		std::ofstream outFile;
+
+		/** The header of the TGA image. */
+		Header header = {};
+
+		/** The size of each pixel in the file, in bytes. */
+		size_t bytesPerPixel = 0;
+
+		/** Converts pixels from Vec4 to file byte order. */
+		void (*swizzle)(const Vec4* source, uint8_t* destination, const size_t count) = nullptr;
+
+		/** The current scanline in file byte order, or encoded as run-length packets. */
+		std::vector<uint8_t> scanlineBytes = {};
+
+		/** The extensions field of the source image, or null if it had none. */
+		std::unique_ptr<Extensions> extensions = nullptr;
+
+		/** Indicates the source image had a footer. */
+		bool hadFooter = false;
+
+		/** The offset of every run-length encoded scanline written so far. */
+		std::vector<uint64_t> scanLineOffsets = {};
+
+		/** The size of the last run-length encoded scanline, in bytes. */
+		size_t lastScanlineSize = 0;
 	};
 }
\ No newline at end of file
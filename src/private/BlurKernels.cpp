@@ -0,0 +1,455 @@
+#include <BlurKernels.h>
+#include <SimdTarget.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+
+namespace
+{
+	/**
+	 * Converts an accumulated channel to 8 bits the same way the vector kernels do: add a half, truncate, saturate.
+	 * Accumulated values are never negative since both the weights and the samples are non-negative.
+	 */
+	inline uint8_t RoundHalfUpSaturate(const float value)
+	{
+		return (uint8_t)std::min((int32_t)(value + 0.5f), 255);
+	}
+
+	/**
+	 * Fixed-point convolution of the pixels in [begin, end), shared by the scalar kernel and the tails of the vector kernels.
+	 * Integer arithmetic is exact, so this gives the same result as the vector kernels for every pixel.
+	 * A non-zero TapCount fixes the number of taps at compile time, and tapCount is ignored.
+	 */
+	template<size_t TapCount>
+	inline void ConvolveFixedPixels(const Vec4* const* taps, const uint16_t* weights, size_t tapCount, Vec4* destination, const size_t begin, const size_t end)
+	{
+		if constexpr (TapCount != 0)
+		{
+			tapCount = TapCount;
+		}
+
+		const uint32_t half = 1u << (BlurKernels::FIXED_POINT_SHIFT - 1);
+
+		for (size_t x = begin; x < end; x++)
+		{
+			uint32_t sumX = half;
+			uint32_t sumY = half;
+			uint32_t sumZ = half;
+			uint32_t sumW = half;
+
+			for (size_t k = 0; k < tapCount; k++)
+			{
+				const Vec4& sample = taps[k][x];
+				uint32_t kernelValue = weights[k];
+
+				sumX += sample.x * kernelValue;
+				sumY += sample.y * kernelValue;
+				sumZ += sample.z * kernelValue;
+				sumW += sample.w * kernelValue;
+			}
+
+			destination[x].x = (uint8_t)(sumX >> BlurKernels::FIXED_POINT_SHIFT);
+			destination[x].y = (uint8_t)(sumY >> BlurKernels::FIXED_POINT_SHIFT);
+			destination[x].z = (uint8_t)(sumZ >> BlurKernels::FIXED_POINT_SHIFT);
+			destination[x].w = (uint8_t)(sumW >> BlurKernels::FIXED_POINT_SHIFT);
+		}
+	}
+
+	/**
+	 * Builds a table of kernels indexed by radius. Entry 0 is the kernel for any tap count,
+	 * and entry r is the kernel with its tap count fixed at 2r + 1.
+	 * @param select Given std::integral_constant<size_t, TapCount>, returns the kernel for that tap count.
+	 */
+	template<typename Function, typename Select, size_t... Index>
+	std::array<Function, sizeof...(Index) + 1> MakeKernelTable(Select select, std::index_sequence<Index...>)
+	{
+		return { select(std::integral_constant<size_t, 0>()), select(std::integral_constant<size_t, (2 * (Index + 1)) + 1>())... };
+	}
+
+	/**
+	 * Get the index into a kernel table for a kernel with tapCount taps.
+	 */
+	inline size_t GetKernelTableIndex(const size_t tapCount)
+	{
+		size_t radius = tapCount / 2;
+		return tapCount % 2 == 1 && radius <= BlurKernels::MAX_SPECIALIZED_RADIUS ? radius : 0;
+	}
+}
+
+BlurKernels::EInstructionSet BlurKernels::GetSupportedInstructionSet()
+{
+	static const EInstructionSet supported = BlurKernels::DetectInstructionSet();
+	return supported;
+}
+
+BlurKernels::ConvolveFunction BlurKernels::GetConvolveFunction(const EInstructionSet maxInstructionSet, const size_t tapCount)
+{
+	using Radii = std::make_index_sequence<MAX_SPECIALIZED_RADIUS>;
+	static const auto scalarKernels = MakeKernelTable<ConvolveFunction>([](auto taps) { return &BlurKernels::ConvolveScalar<decltype(taps)::value>; }, Radii());
+	static const auto sse41Kernels = MakeKernelTable<ConvolveFunction>([](auto taps) { return &BlurKernels::ConvolveSSE41<decltype(taps)::value>; }, Radii());
+	static const auto avx2Kernels = MakeKernelTable<ConvolveFunction>([](auto taps) { return &BlurKernels::ConvolveAVX2<decltype(taps)::value>; }, Radii());
+
+	size_t index = GetKernelTableIndex(tapCount);
+	switch (std::min(maxInstructionSet, BlurKernels::GetSupportedInstructionSet()))
+	{
+	case EInstructionSet::AVX2:
+		return avx2Kernels[index];
+
+	case EInstructionSet::SSE41:
+		return sse41Kernels[index];
+
+	default:
+		return scalarKernels[index];
+	}
+}
+
+BlurKernels::ConvolveFixedFunction BlurKernels::GetConvolveFixedFunction(const EInstructionSet maxInstructionSet, const size_t tapCount, const uint16_t maxWeight)
+{
+	using Radii = std::make_index_sequence<MAX_SPECIALIZED_RADIUS>;
+	static const auto scalarKernels = MakeKernelTable<ConvolveFixedFunction>([](auto taps) { return &BlurKernels::ConvolveFixedScalar<decltype(taps)::value>; }, Radii());
+	static const auto sse41Kernels = MakeKernelTable<ConvolveFixedFunction>([](auto taps) { return &BlurKernels::ConvolveFixedSSE41<decltype(taps)::value>; }, Radii());
+	static const auto avx2Kernels = MakeKernelTable<ConvolveFixedFunction>([](auto taps) { return &BlurKernels::ConvolveFixedAVX2<decltype(taps)::value>; }, Radii());
+
+	size_t index = GetKernelTableIndex(tapCount);
+	if (maxWeight >= (1 << 15))
+	{
+		return scalarKernels[index];
+	}
+
+	switch (std::min(maxInstructionSet, BlurKernels::GetSupportedInstructionSet()))
+	{
+	case EInstructionSet::AVX2:
+		return avx2Kernels[index];
+
+	case EInstructionSet::SSE41:
+		return sse41Kernels[index];
+
+	default:
+		return scalarKernels[index];
+	}
+}
+
+BlurKernels::EInstructionSet BlurKernels::DetectInstructionSet()
+{
+#if SIMD_X86 && defined(_MSC_VER) && !defined(__clang__)
+	int registers[4] = {};
+	__cpuid(registers, 0);
+	int highestLeaf = registers[0];
+
+	__cpuid(registers, 1);
+	bool hasSse41 = (registers[2] & (1 << 19)) != 0;
+	bool hasFma = (registers[2] & (1 << 12)) != 0;
+	bool hasOsXsave = (registers[2] & (1 << 27)) != 0;
+	bool hasAvx = (registers[2] & (1 << 28)) != 0;
+
+	// The operating system must also save the upper halves of the YMM registers on a context switch.
+	bool osSavesYmm = hasOsXsave && hasAvx && (_xgetbv(0) & 0x6) == 0x6;
+
+	bool hasAvx2 = false;
+	if (highestLeaf >= 7)
+	{
+		__cpuidex(registers, 7, 0);
+		hasAvx2 = (registers[1] & (1 << 5)) != 0;
+	}
+
+	if (osSavesYmm && hasAvx2 && hasFma)
+	{
+		return EInstructionSet::AVX2;
+	}
+
+	return hasSse41 ? EInstructionSet::SSE41 : EInstructionSet::Scalar;
+#elif SIMD_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	{
+		return EInstructionSet::AVX2;
+	}
+
+	return __builtin_cpu_supports("sse4.1") ? EInstructionSet::SSE41 : EInstructionSet::Scalar;
+#else
+	return EInstructionSet::Scalar;
+#endif
+}
+
+template<size_t TapCount>
+void BlurKernels::ConvolveScalar(const Vec4* const* taps, const float* weights, size_t tapCount, Vec4* destination, const size_t count)
+{
+	if constexpr (TapCount != 0)
+	{
+		tapCount = TapCount;
+	}
+
+	for (size_t x = 0; x < count; x++)
+	{
+		Vec4f pixel = {};
+
+		for (size_t k = 0; k < tapCount; k++)
+		{
+			const Vec4& sample = taps[k][x];
+			float kernelValue = weights[k];
+
+			pixel.w += sample.w * kernelValue;
+			pixel.x += sample.x * kernelValue;
+			pixel.y += sample.y * kernelValue;
+			pixel.z += sample.z * kernelValue;
+		}
+
+		destination[x].w = (uint8_t)std::clamp(std::round(pixel.w), 0.0f, 255.0f);
+		destination[x].x = (uint8_t)std::clamp(std::round(pixel.x), 0.0f, 255.0f);
+		destination[x].y = (uint8_t)std::clamp(std::round(pixel.y), 0.0f, 255.0f);
+		destination[x].z = (uint8_t)std::clamp(std::round(pixel.z), 0.0f, 255.0f);
+	}
+}
+
+template<size_t TapCount>
+void BlurKernels::ConvolveFixedScalar(const Vec4* const* taps, const uint16_t* weights, size_t tapCount, Vec4* destination, const size_t count)
+{
+	ConvolveFixedPixels<TapCount>(taps, weights, tapCount, destination, 0, count);
+}
+
+#if SIMD_X86
+
+template<size_t TapCount>
+SIMD_TARGET_SSE41 void BlurKernels::ConvolveSSE41(const Vec4* const* taps, const float* weights, size_t tapCount, Vec4* destination, const size_t count)
+{
+	if constexpr (TapCount != 0)
+	{
+		tapCount = TapCount;
+	}
+
+	const __m128 half = _mm_set1_ps(0.5f);
+	size_t x = 0;
+
+	// Four pixels (16 channels) per iteration, widened from u8 to four vectors of f32.
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128 sum0 = _mm_setzero_ps();
+		__m128 sum1 = _mm_setzero_ps();
+		__m128 sum2 = _mm_setzero_ps();
+		__m128 sum3 = _mm_setzero_ps();
+
+		for (size_t k = 0; k < tapCount; k++)
+		{
+			__m128i samples = _mm_loadu_si128((const __m128i*)(taps[k] + x));
+			__m128 weight = _mm_set1_ps(weights[k]);
+
+			sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(samples)), weight));
+			sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(samples, 4))), weight));
+			sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(samples, 8))), weight));
+			sum3 = _mm_add_ps(sum3, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(samples, 12))), weight));
+		}
+
+		__m128i channels01 = _mm_packus_epi32(_mm_cvttps_epi32(_mm_add_ps(sum0, half)), _mm_cvttps_epi32(_mm_add_ps(sum1, half)));
+		__m128i channels23 = _mm_packus_epi32(_mm_cvttps_epi32(_mm_add_ps(sum2, half)), _mm_cvttps_epi32(_mm_add_ps(sum3, half)));
+		_mm_storeu_si128((__m128i*)(destination + x), _mm_packus_epi16(channels01, channels23));
+	}
+
+	// Remaining pixels use the same separate multiply and add, so results don't depend on where a span ends.
+	for (; x < count; x++)
+	{
+		Vec4f pixel = {};
+
+		for (size_t k = 0; k < tapCount; k++)
+		{
+			const Vec4& sample = taps[k][x];
+			float kernelValue = weights[k];
+
+			pixel.x = pixel.x + (float)sample.x * kernelValue;
+			pixel.y = pixel.y + (float)sample.y * kernelValue;
+			pixel.z = pixel.z + (float)sample.z * kernelValue;
+			pixel.w = pixel.w + (float)sample.w * kernelValue;
+		}
+
+		destination[x].x = RoundHalfUpSaturate(pixel.x);
+		destination[x].y = RoundHalfUpSaturate(pixel.y);
+		destination[x].z = RoundHalfUpSaturate(pixel.z);
+		destination[x].w = RoundHalfUpSaturate(pixel.w);
+	}
+}
+
+template<size_t TapCount>
+SIMD_TARGET_AVX2 void BlurKernels::ConvolveAVX2(const Vec4* const* taps, const float* weights, size_t tapCount, Vec4* destination, const size_t count)
+{
+	if constexpr (TapCount != 0)
+	{
+		tapCount = TapCount;
+	}
+
+	const __m256 half = _mm256_set1_ps(0.5f);
+
+	// Packing works within 128 bit lanes, which leaves the pixels in the order 0 2 4 6 1 3 5 7.
+	const __m256i pixelOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	size_t x = 0;
+
+	// Eight pixels (32 channels) per iteration, widened from u8 to four vectors of f32.
+	for (; x + 8 <= count; x += 8)
+	{
+		__m256 sum0 = _mm256_setzero_ps();
+		__m256 sum1 = _mm256_setzero_ps();
+		__m256 sum2 = _mm256_setzero_ps();
+		__m256 sum3 = _mm256_setzero_ps();
+
+		for (size_t k = 0; k < tapCount; k++)
+		{
+			const Vec4* samples = taps[k] + x;
+			__m256 weight = _mm256_set1_ps(weights[k]);
+
+			sum0 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(samples + 0)))), weight, sum0);
+			sum1 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(samples + 2)))), weight, sum1);
+			sum2 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(samples + 4)))), weight, sum2);
+			sum3 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(samples + 6)))), weight, sum3);
+		}
+
+		__m256i channels01 = _mm256_packus_epi32(_mm256_cvttps_epi32(_mm256_add_ps(sum0, half)), _mm256_cvttps_epi32(_mm256_add_ps(sum1, half)));
+		__m256i channels23 = _mm256_packus_epi32(_mm256_cvttps_epi32(_mm256_add_ps(sum2, half)), _mm256_cvttps_epi32(_mm256_add_ps(sum3, half)));
+		__m256i packed = _mm256_packus_epi16(channels01, channels23);
+		_mm256_storeu_si256((__m256i*)(destination + x), _mm256_permutevar8x32_epi32(packed, pixelOrder));
+	}
+
+	// Remaining pixels use a fused multiply-add too, so results don't depend on where a span ends.
+	for (; x < count; x++)
+	{
+		Vec4f pixel = {};
+
+		for (size_t k = 0; k < tapCount; k++)
+		{
+			const Vec4& sample = taps[k][x];
+			float kernelValue = weights[k];
+
+			pixel.x = std::fma((float)sample.x, kernelValue, pixel.x);
+			pixel.y = std::fma((float)sample.y, kernelValue, pixel.y);
+			pixel.z = std::fma((float)sample.z, kernelValue, pixel.z);
+			pixel.w = std::fma((float)sample.w, kernelValue, pixel.w);
+		}
+
+		destination[x].x = RoundHalfUpSaturate(pixel.x);
+		destination[x].y = RoundHalfUpSaturate(pixel.y);
+		destination[x].z = RoundHalfUpSaturate(pixel.z);
+		destination[x].w = RoundHalfUpSaturate(pixel.w);
+	}
+}
+
+template<size_t TapCount>
+SIMD_TARGET_SSE41 void BlurKernels::ConvolveFixedSSE41(const Vec4* const* taps, const uint16_t* weights, size_t tapCount, Vec4* destination, const size_t count)
+{
+	if constexpr (TapCount != 0)
+	{
+		tapCount = TapCount;
+	}
+
+	const __m128i half = _mm_set1_epi32(1 << (FIXED_POINT_SHIFT - 1));
+	size_t x = 0;
+
+	// Four pixels (16 channels) per iteration. Samples from two taps are interleaved into 16 bit lanes
+	// so that one multiply-add applies both taps: a * weight[k] + b * weight[k + 1].
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128i sum0 = half;
+		__m128i sum1 = half;
+		__m128i sum2 = half;
+		__m128i sum3 = half;
+
+		for (size_t k = 0; k < tapCount; k += 2)
+		{
+			// An odd tap count pairs the last tap with itself at zero weight.
+			bool hasPair = k + 1 < tapCount;
+			__m128i samplesA = _mm_loadu_si128((const __m128i*)(taps[k] + x));
+			__m128i samplesB = hasPair ? _mm_loadu_si128((const __m128i*)(taps[k + 1] + x)) : samplesA;
+			__m128i weightPair = _mm_set1_epi32((int32_t)(((uint32_t)(hasPair ? weights[k + 1] : 0) << 16) | weights[k]));
+
+			__m128i lowA = _mm_cvtepu8_epi16(samplesA);
+			__m128i highA = _mm_cvtepu8_epi16(_mm_srli_si128(samplesA, 8));
+			__m128i lowB = _mm_cvtepu8_epi16(samplesB);
+			__m128i highB = _mm_cvtepu8_epi16(_mm_srli_si128(samplesB, 8));
+
+			sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi16(lowA, lowB), weightPair));
+			sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi16(lowA, lowB), weightPair));
+			sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi16(highA, highB), weightPair));
+			sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi16(highA, highB), weightPair));
+		}
+
+		__m128i channels01 = _mm_packus_epi32(_mm_srli_epi32(sum0, FIXED_POINT_SHIFT), _mm_srli_epi32(sum1, FIXED_POINT_SHIFT));
+		__m128i channels23 = _mm_packus_epi32(_mm_srli_epi32(sum2, FIXED_POINT_SHIFT), _mm_srli_epi32(sum3, FIXED_POINT_SHIFT));
+		_mm_storeu_si128((__m128i*)(destination + x), _mm_packus_epi16(channels01, channels23));
+	}
+
+	ConvolveFixedPixels<TapCount>(taps, weights, tapCount, destination, x, count);
+}
+
+template<size_t TapCount>
+SIMD_TARGET_AVX2 void BlurKernels::ConvolveFixedAVX2(const Vec4* const* taps, const uint16_t* weights, size_t tapCount, Vec4* destination, const size_t count)
+{
+	if constexpr (TapCount != 0)
+	{
+		tapCount = TapCount;
+	}
+
+	const __m256i half = _mm256_set1_epi32(1 << (FIXED_POINT_SHIFT - 1));
+	size_t x = 0;
+
+	// Eight pixels (32 channels) per iteration, two taps per multiply-add as in the SSE4.1 kernel.
+	for (; x + 8 <= count; x += 8)
+	{
+		__m256i sum0 = half;
+		__m256i sum1 = half;
+		__m256i sum2 = half;
+		__m256i sum3 = half;
+
+		for (size_t k = 0; k < tapCount; k += 2)
+		{
+			bool hasPair = k + 1 < tapCount;
+			__m256i samplesA = _mm256_loadu_si256((const __m256i*)(taps[k] + x));
+			__m256i samplesB = hasPair ? _mm256_loadu_si256((const __m256i*)(taps[k + 1] + x)) : samplesA;
+			__m256i weightPair = _mm256_set1_epi32((int32_t)(((uint32_t)(hasPair ? weights[k + 1] : 0) << 16) | weights[k]));
+
+			__m256i lowA = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(samplesA));
+			__m256i highA = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(samplesA, 1));
+			__m256i lowB = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(samplesB));
+			__m256i highB = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(samplesB, 1));
+
+			sum0 = _mm256_add_epi32(sum0, _mm256_madd_epi16(_mm256_unpacklo_epi16(lowA, lowB), weightPair));
+			sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(_mm256_unpackhi_epi16(lowA, lowB), weightPair));
+			sum2 = _mm256_add_epi32(sum2, _mm256_madd_epi16(_mm256_unpacklo_epi16(highA, highB), weightPair));
+			sum3 = _mm256_add_epi32(sum3, _mm256_madd_epi16(_mm256_unpackhi_epi16(highA, highB), weightPair));
+		}
+
+		// Unpacking within 128 bit lanes and packing back cancel out for the 16 bit channels,
+		// which leaves the pixels in the order 0 1 4 5 2 3 6 7 after the final pack.
+		__m256i channels01 = _mm256_packus_epi32(_mm256_srli_epi32(sum0, FIXED_POINT_SHIFT), _mm256_srli_epi32(sum1, FIXED_POINT_SHIFT));
+		__m256i channels23 = _mm256_packus_epi32(_mm256_srli_epi32(sum2, FIXED_POINT_SHIFT), _mm256_srli_epi32(sum3, FIXED_POINT_SHIFT));
+		__m256i packed = _mm256_packus_epi16(channels01, channels23);
+		_mm256_storeu_si256((__m256i*)(destination + x), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	ConvolveFixedPixels<TapCount>(taps, weights, tapCount, destination, x, count);
+}
+
+#else
+
+template<size_t TapCount>
+void BlurKernels::ConvolveSSE41(const Vec4* const* taps, const float* weights, size_t tapCount, Vec4* destination, const size_t count)
+{
+	BlurKernels::ConvolveScalar<TapCount>(taps, weights, tapCount, destination, count);
+}
+
+template<size_t TapCount>
+void BlurKernels::ConvolveAVX2(const Vec4* const* taps, const float* weights, size_t tapCount, Vec4* destination, const size_t count)
+{
+	BlurKernels::ConvolveScalar<TapCount>(taps, weights, tapCount, destination, count);
+}
+
+template<size_t TapCount>
+void BlurKernels::ConvolveFixedSSE41(const Vec4* const* taps, const uint16_t* weights, size_t tapCount, Vec4* destination, const size_t count)
+{
+	BlurKernels::ConvolveFixedScalar<TapCount>(taps, weights, tapCount, destination, count);
+}
+
+template<size_t TapCount>
+void BlurKernels::ConvolveFixedAVX2(const Vec4* const* taps, const uint16_t* weights, size_t tapCount, Vec4* destination, const size_t count)
+{
+	BlurKernels::ConvolveFixedScalar<TapCount>(taps, weights, tapCount, destination, count);
+}
+
+#endif
@@ -0,0 +1,465 @@
+#include <ColorPalette.h>
+#include <BlurKernels.h>
+#include <SimdTarget.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	/** The pixels of an image that fall in one cell of its color histogram. */
+	struct ColorCell
+	{
+		/** The number of pixels in the cell. */
+		uint64_t Count = 0;
+
+		/** The sum of each channel over the pixels in the cell. */
+		uint64_t Sum[4] = {};
+
+		/** The mean color of the pixels in the cell. */
+		Vec4 Mean = {};
+	};
+
+	/** A box of colors being split by median cut, held as a range of the occupied histogram cells. */
+	struct ColorBox
+	{
+		/** The first cell in the box. */
+		size_t Begin = 0;
+
+		/** One past the last cell in the box. */
+		size_t End = 0;
+
+		/** The number of pixels in the box. */
+		uint64_t Count = 0;
+
+		/** The channel whose cell means are furthest apart, which the box is split across. */
+		size_t Channel = 0;
+
+		/** The smallest cell mean in that channel. */
+		uint8_t Low = 0;
+
+		/** The largest cell mean in that channel. */
+		uint8_t High = 0;
+	};
+
+	uint8_t Vec4::* const CHANNELS[4] = { &Vec4::x, &Vec4::y, &Vec4::z, &Vec4::w };
+
+	/** The most pixels counted into the histogram. Larger images are sampled evenly. */
+	constexpr size_t HISTOGRAM_SAMPLES = (size_t)1 << 21;
+
+	/** The 4 x 4 Bayer matrix the ordered dither is made from, in row order. */
+	constexpr int32_t BAYER_MATRIX[16] = { 0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5 };
+
+	/**
+	 * Fill a table giving, for each channel and value, that value's bits of the histogram cell, after adding offset.
+	 * A cell is the top cellBits bits of each channel in turn, so the cell of a pixel is its four entries ORed together.
+	 */
+	void BuildCellTable(const int32_t offset, const Vec4 channelMask, const size_t cellBits, const size_t channelCount, uint16_t table[4][256])
+	{
+		for (size_t c = 0; c < 4; c++)
+		{
+			for (int32_t value = 0; value < 256; value++)
+			{
+				uint32_t shifted = (uint32_t)std::clamp(value + offset, 0, 255) & (channelMask.*CHANNELS[c]);
+				table[c][value] = c < channelCount ? (uint16_t)((shifted >> (8 - cellBits)) << (c * cellBits)) : 0;
+			}
+		}
+	}
+
+	/**
+	 * Get the color at the center of a histogram cell, which is zero in every channel the cell does not hold.
+	 */
+	void GetCellCenter(const size_t cell, const Vec4 channelMask, const size_t cellBits, const size_t channelCount, int32_t center[4])
+	{
+		const size_t levelMask = ((size_t)1 << cellBits) - 1;
+		const int32_t half = (int32_t)1 << (7 - cellBits);
+
+		for (size_t c = 0; c < 4; c++)
+		{
+			size_t level = (cell >> (c * cellBits)) & levelMask;
+			center[c] = c < channelCount && channelMask.*CHANNELS[c] != 0 ? (int32_t)(level << (8 - cellBits)) + half : 0;
+		}
+	}
+
+	/**
+	 * Count the pixels in a box and find the channel its cell means are spread furthest across.
+	 */
+	void MeasureBox(ColorBox& box, const std::vector<ColorCell>& cells, const size_t channelCount)
+	{
+		uint8_t low[4] = { 255, 255, 255, 255 };
+		uint8_t high[4] = {};
+		box.Count = 0;
+
+		for (size_t i = box.Begin; i < box.End; i++)
+		{
+			box.Count += cells[i].Count;
+
+			for (size_t c = 0; c < channelCount; c++)
+			{
+				low[c] = std::min(low[c], cells[i].Mean.*CHANNELS[c]);
+				high[c] = std::max(high[c], cells[i].Mean.*CHANNELS[c]);
+			}
+		}
+
+		box.Channel = 0;
+		box.Low = low[0];
+		box.High = high[0];
+
+		for (size_t c = 1; c < channelCount; c++)
+		{
+			if (high[c] - low[c] > box.High - box.Low)
+			{
+				box.Channel = c;
+				box.Low = low[c];
+				box.High = high[c];
+			}
+		}
+	}
+
+	/**
+	 * Split a box across its widest channel at the value that leaves about half of its pixels on each side.
+	 * The cells are only partitioned around that value, not sorted, so each split is linear in the size of the box.
+	 * @return The upper half. The lower half is left in box.
+	 */
+	ColorBox SplitBox(ColorBox& box, std::vector<ColorCell>& cells, const size_t channelCount)
+	{
+		uint8_t Vec4::* channel = CHANNELS[box.Channel];
+
+		uint64_t counts[256] = {};
+		for (size_t i = box.Begin; i < box.End; i++)
+		{
+			counts[cells[i].Mean.*channel] += cells[i].Count;
+		}
+
+		// Both halves must hold at least one cell, so the split value lies in (Low, High].
+		uint32_t split = (uint32_t)box.Low + 1;
+		uint64_t below = counts[box.Low];
+
+		while (split < box.High && below + counts[split] <= box.Count / 2)
+		{
+			below += counts[split];
+			split++;
+		}
+
+		auto middle = std::partition(cells.begin() + box.Begin, cells.begin() + box.End, [channel, split](const ColorCell& cell)
+		{
+			return cell.Mean.*channel < split;
+		});
+
+		ColorBox upper = {};
+		upper.Begin = (size_t)(middle - cells.begin());
+		upper.End = box.End;
+		box.End = upper.Begin;
+
+		MeasureBox(box, cells, channelCount);
+		MeasureBox(upper, cells, channelCount);
+
+		return upper;
+	}
+}
+
+bool ColorPalette::Build(const Vec4* pixels, const size_t count, const Vec4 channelMask, Vec4* palette, uint8_t* indices, size_t& colorCount)
+{
+	// Twice as many slots as colors keeps the probe sequences short, and the table never fills so every probe ends.
+	constexpr size_t TABLE_BITS = 9;
+	constexpr size_t TABLE_SIZE = (size_t)1 << TABLE_BITS;
+	constexpr uint16_t EMPTY_SLOT = 0xFFFF;
+	static_assert(TABLE_SIZE >= MAX_COLORS * 2);
+
+	uint32_t keys[TABLE_SIZE];
+	uint16_t slots[TABLE_SIZE];
+	std::fill(slots, slots + TABLE_SIZE, EMPTY_SLOT);
+
+	const uint32_t mask = ColorPalette::Pack(channelMask, 0xFFFFFFFF);
+	colorCount = 0;
+
+	// Neighbouring pixels are often the same color, so the last color found skips the table entirely.
+	uint32_t lastKey = 0;
+	uint8_t lastIndex = 0;
+	bool hasLast = false;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t key = ColorPalette::Pack(pixels[i], mask);
+
+		if (!hasLast || key != lastKey)
+		{
+			// Fibonacci hashing spreads colors that differ only in their low bits across the table.
+			size_t slot = (size_t)((key * 0x9E3779B1u) >> (32 - TABLE_BITS));
+
+			while (slots[slot] != EMPTY_SLOT && keys[slot] != key)
+			{
+				slot = (slot + 1) & (TABLE_SIZE - 1);
+			}
+
+			if (slots[slot] == EMPTY_SLOT)
+			{
+				if (colorCount == MAX_COLORS)
+				{
+					return false;
+				}
+
+				keys[slot] = key;
+				slots[slot] = (uint16_t)colorCount;
+				palette[colorCount] = {
+					(uint8_t)(pixels[i].x & channelMask.x),
+					(uint8_t)(pixels[i].y & channelMask.y),
+					(uint8_t)(pixels[i].z & channelMask.z),
+					(uint8_t)(pixels[i].w & channelMask.w) };
+				colorCount++;
+			}
+
+			lastKey = key;
+			lastIndex = (uint8_t)slots[slot];
+			hasLast = true;
+		}
+
+		indices[i] = lastIndex;
+	}
+
+	return true;
+}
+
+size_t ColorPalette::Quantize(const Vec4* pixels, const size_t width, const size_t height, const Vec4 channelMask, const bool dither, Vec4* palette, uint8_t* indices)
+{
+	const size_t channelCount = channelMask.w != 0 ? 4 : 3;
+	const size_t cellBits = channelCount == 4 ? 4 : 5;
+	const size_t cellCount = (size_t)1 << (cellBits * channelCount);
+	const size_t count = width * height;
+
+	uint16_t cellTable[4][256];
+	BuildCellTable(0, channelMask, cellBits, channelCount, cellTable);
+
+	// The histogram is too large to stay in cache, so on large images an even sample of the pixels chooses the palette.
+	// Every pixel is still mapped to it.
+	std::vector<ColorCell> cells(cellCount);
+	const size_t step = std::max((count + HISTOGRAM_SAMPLES - 1) / HISTOGRAM_SAMPLES, (size_t)1);
+
+	for (size_t i = 0; i < count; i += step)
+	{
+		const Vec4 pixel = pixels[i];
+		ColorCell& cell = cells[cellTable[0][pixel.x] | cellTable[1][pixel.y] | cellTable[2][pixel.z] | cellTable[3][pixel.w]];
+		cell.Count++;
+		cell.Sum[0] += pixel.x & channelMask.x;
+		cell.Sum[1] += pixel.y & channelMask.y;
+		cell.Sum[2] += pixel.z & channelMask.z;
+		cell.Sum[3] += pixel.w & channelMask.w;
+	}
+
+	// Median cut works on the occupied cells alone, each standing in for every pixel in it.
+	std::vector<ColorCell> occupied;
+
+	for (ColorCell& cell : cells)
+	{
+		if (cell.Count == 0)
+		{
+			continue;
+		}
+
+		for (size_t c = 0; c < 4; c++)
+		{
+			cell.Mean.*CHANNELS[c] = (uint8_t)((cell.Sum[c] + (cell.Count / 2)) / cell.Count);
+		}
+
+		occupied.push_back(cell);
+	}
+
+	if (occupied.empty())
+	{
+		return 0;
+	}
+
+	// Keep splitting the box with the most pixels times the widest spread, until there is a box for every palette entry
+	// or no box holds cells of more than one color.
+	std::vector<ColorBox> boxes;
+	boxes.reserve(MAX_COLORS);
+	boxes.push_back({ 0, occupied.size() });
+	MeasureBox(boxes[0], occupied, channelCount);
+
+	while (boxes.size() < MAX_COLORS)
+	{
+		ColorBox* widest = nullptr;
+		uint64_t widestScore = 0;
+
+		for (ColorBox& box : boxes)
+		{
+			uint64_t score = box.Count * (uint64_t)(box.High - box.Low);
+
+			if (score > widestScore)
+			{
+				widest = &box;
+				widestScore = score;
+			}
+		}
+
+		if (widest == nullptr)
+		{
+			break;
+		}
+
+		boxes.push_back(SplitBox(*widest, occupied, channelCount));
+	}
+
+	// Each palette entry is the mean of every pixel in its box.
+	const size_t colorCount = boxes.size();
+
+	for (size_t i = 0; i < colorCount; i++)
+	{
+		uint64_t sum[4] = {};
+
+		for (size_t j = boxes[i].Begin; j < boxes[i].End; j++)
+		{
+			for (size_t c = 0; c < 4; c++)
+			{
+				sum[c] += occupied[j].Sum[c];
+			}
+		}
+
+		for (size_t c = 0; c < 4; c++)
+		{
+			palette[i].*CHANNELS[c] = (uint8_t)((sum[c] + (boxes[i].Count / 2)) / boxes[i].Count);
+		}
+	}
+
+	std::vector<uint8_t> cube(cellCount);
+	ColorPalette::FillLookupCube(palette, colorCount, channelMask, cellBits, channelCount, cube.data());
+
+	// With dithering each position in the 4 x 4 pattern has its own cell table, offset by about a quarter of the distance
+	// between neighbouring palette colors either way. Otherwise every position shares the table the histogram used.
+	const size_t patternSize = dither ? 16 : 1;
+	std::vector<uint16_t> patternTables(patternSize * 4 * 256);
+	const float spread = 255.0f / std::cbrt((float)colorCount);
+
+	for (size_t i = 0; i < patternSize; i++)
+	{
+		int32_t offset = dither ? (int32_t)std::lround(((((float)BAYER_MATRIX[i] + 0.5f) / 16.0f) - 0.5f) * spread) : 0;
+		BuildCellTable(offset, channelMask, cellBits, channelCount, (uint16_t(*)[256])(patternTables.data() + (i * 4 * 256)));
+	}
+
+	for (size_t i = 0; i < height; i++)
+	{
+		const Vec4* row = pixels + (i * width);
+		uint8_t* rowIndices = indices + (i * width);
+
+		for (size_t j = 0; j < width; j++)
+		{
+			const uint16_t* table = patternTables.data() + (dither ? (((i & 3) * 4) + (j & 3)) * 4 * 256 : 0);
+			rowIndices[j] = cube[table[row[j].x] | table[256 + row[j].y] | table[512 + row[j].z] | table[768 + row[j].w]];
+		}
+	}
+
+	return colorCount;
+}
+
+uint32_t ColorPalette::Pack(const Vec4 pixel, const uint32_t channelMask)
+{
+	uint32_t value = 0;
+	std::memcpy(&value, &pixel, sizeof(value));
+
+	return value & channelMask;
+}
+
+bool ColorPalette::UseVectorSearch()
+{
+	static const bool useVector = SIMD_X86 && BlurKernels::GetSupportedInstructionSet() >= BlurKernels::EInstructionSet::SSE41;
+	return useVector;
+}
+
+void ColorPalette::FillLookupCube(const Vec4* palette, const size_t colorCount, const Vec4 channelMask, const size_t cellBits, const size_t channelCount, uint8_t* cube)
+{
+	if (ColorPalette::UseVectorSearch())
+	{
+		ColorPalette::FillLookupCubeSSE41(palette, colorCount, channelMask, cellBits, channelCount, cube);
+		return;
+	}
+
+	ColorPalette::FillLookupCubeScalar(palette, colorCount, channelMask, cellBits, channelCount, cube);
+}
+
+void ColorPalette::FillLookupCubeScalar(const Vec4* palette, const size_t colorCount, const Vec4 channelMask, const size_t cellBits, const size_t channelCount, uint8_t* cube)
+{
+	const size_t cellCount = (size_t)1 << (cellBits * channelCount);
+
+	for (size_t cell = 0; cell < cellCount; cell++)
+	{
+		int32_t center[4];
+		GetCellCenter(cell, channelMask, cellBits, channelCount, center);
+
+		// The distance and index are packed into one value, so the smallest value is the nearest entry, and the first on a tie.
+		int32_t nearest = INT32_MAX;
+
+		for (size_t i = 0; i < colorCount; i++)
+		{
+			int32_t dx = center[0] - palette[i].x;
+			int32_t dy = center[1] - palette[i].y;
+			int32_t dz = center[2] - palette[i].z;
+			int32_t dw = center[3] - palette[i].w;
+			int32_t distance = (dx * dx) + (dy * dy) + (dz * dz) + (dw * dw);
+
+			nearest = std::min(nearest, (distance << 8) | (int32_t)i);
+		}
+
+		cube[cell] = (uint8_t)(nearest & 0xFF);
+	}
+}
+
+#if SIMD_X86
+
+SIMD_TARGET_SSE41 void ColorPalette::FillLookupCubeSSE41(const Vec4* palette, const size_t colorCount, const Vec4 channelMask, const size_t cellBits, const size_t channelCount, uint8_t* cube)
+{
+	const size_t cellCount = (size_t)1 << (cellBits * channelCount);
+
+	// The palette is held as 16 bit x, y and z, w pairs, four entries to a register, so one multiply-add squares
+	// and sums two channels of four entries. It is padded to whole registers with copies of entry 0.
+	alignas(16) int16_t pairsXY[MAX_COLORS * 2];
+	alignas(16) int16_t pairsZW[MAX_COLORS * 2];
+	alignas(16) int32_t entries[MAX_COLORS];
+	const size_t paddedCount = (colorCount + 3) & ~(size_t)3;
+
+	for (size_t i = 0; i < paddedCount; i++)
+	{
+		const Vec4 color = palette[i < colorCount ? i : 0];
+		pairsXY[(i * 2)] = color.x;
+		pairsXY[(i * 2) + 1] = color.y;
+		pairsZW[(i * 2)] = color.z;
+		pairsZW[(i * 2) + 1] = color.w;
+		entries[i] = i < colorCount ? (int32_t)i : 0;
+	}
+
+	for (size_t cell = 0; cell < cellCount; cell++)
+	{
+		int32_t center[4];
+		GetCellCenter(cell, channelMask, cellBits, channelCount, center);
+
+		const __m128i centerXY = _mm_set1_epi32((center[1] << 16) | center[0]);
+		const __m128i centerZW = _mm_set1_epi32((center[3] << 16) | center[2]);
+
+		// The same packed distance and index as the scalar search, so both pick the same entry.
+		__m128i nearest = _mm_set1_epi32(INT32_MAX);
+
+		for (size_t i = 0; i < paddedCount; i += 4)
+		{
+			__m128i differenceXY = _mm_sub_epi16(centerXY, _mm_load_si128((const __m128i*)(pairsXY + (i * 2))));
+			__m128i differenceZW = _mm_sub_epi16(centerZW, _mm_load_si128((const __m128i*)(pairsZW + (i * 2))));
+			__m128i distance = _mm_add_epi32(_mm_madd_epi16(differenceXY, differenceXY), _mm_madd_epi16(differenceZW, differenceZW));
+
+			nearest = _mm_min_epi32(nearest, _mm_or_si128(_mm_slli_epi32(distance, 8), _mm_load_si128((const __m128i*)(entries + i))));
+		}
+
+		nearest = _mm_min_epi32(nearest, _mm_shuffle_epi32(nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+		nearest = _mm_min_epi32(nearest, _mm_shuffle_epi32(nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+
+		cube[cell] = (uint8_t)(_mm_cvtsi128_si32(nearest) & 0xFF);
+	}
+}
+
+#else
+
+void ColorPalette::FillLookupCubeSSE41(const Vec4* palette, const size_t colorCount, const Vec4 channelMask, const size_t cellBits, const size_t channelCount, uint8_t* cube)
+{
+	ColorPalette::FillLookupCubeScalar(palette, colorCount, channelMask, cellBits, channelCount, cube);
+}
+
+#endif
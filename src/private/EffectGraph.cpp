@@ -0,0 +1,332 @@
+#include <EffectGraph.h>
+#include <ThreadPool.h>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <optional>
+
+EffectGraph& EffectGraph::AddGaussianBlur(const float blurAmount)
+{
+	this->nodes.push_back({ EEffect::Blur, blurAmount });
+	return *this;
+}
+
+EffectGraph& EffectGraph::AddGaussianBlurSigma(const float sigma)
+{
+	this->nodes.push_back({ EEffect::BlurSigma, sigma });
+	return *this;
+}
+
+EffectGraph& EffectGraph::AddBrightness(const float factor)
+{
+	this->nodes.push_back({ EEffect::Brightness, factor });
+	return *this;
+}
+
+EffectGraph& EffectGraph::AddGamma(const float gamma)
+{
+	this->nodes.push_back({ EEffect::Gamma, gamma });
+	return *this;
+}
+
+EffectGraph& EffectGraph::AddSharpen(const float amount)
+{
+	this->nodes.push_back({ EEffect::Sharpen, amount });
+	return *this;
+}
+
+bool EffectGraph::Parse(const std::string& spec, EffectGraph& graph)
+{
+	size_t start = 0;
+	while (true)
+	{
+		size_t end = std::min(spec.find(',', start), spec.size());
+		std::string effect = spec.substr(start, end - start);
+
+		size_t colon = effect.find(':');
+		if (colon == std::string::npos)
+		{
+			return false;
+		}
+
+		std::string name = effect.substr(0, colon);
+		std::string value = effect.substr(colon + 1);
+		float amount = 0.0f;
+
+		try
+		{
+			size_t parsedLength = 0;
+			amount = std::stof(value, &parsedLength);
+
+			if (parsedLength != value.size())
+			{
+				return false;
+			}
+		}
+		catch (const std::exception&)
+		{
+			return false;
+		}
+
+		if (name == "blur" && amount >= 0.0f && amount <= 1.0f)
+		{
+			graph.AddGaussianBlur(amount);
+		}
+		else if (name == "sigma" && amount > 0.0f && amount <= Effects::MAX_SIGMA)
+		{
+			graph.AddGaussianBlurSigma(amount);
+		}
+		else if (name == "brightness" && amount >= 0.0f && amount <= MAX_FACTOR)
+		{
+			graph.AddBrightness(amount);
+		}
+		else if (name == "gamma" && amount >= MIN_GAMMA && amount <= MAX_GAMMA)
+		{
+			graph.AddGamma(amount);
+		}
+		else if (name == "sharpen" && amount >= 0.0f && amount <= MAX_FACTOR)
+		{
+			graph.AddSharpen(amount);
+		}
+		else
+		{
+			return false;
+		}
+
+		if (end == spec.size())
+		{
+			return true;
+		}
+
+		start = end + 1;
+	}
+}
+
+const std::vector<EffectGraph::Node>& EffectGraph::GetNodes() const
+{
+	return this->nodes;
+}
+
+PixelPool::Buffer EffectGraph::Apply(const Vec4* pixels, const size_t width, const size_t height, const EffectOptions& options) const
+{
+	Plan plan = this->Compile(options);
+	PixelPool::Buffer newPixels = PixelPool::GetShared().Allocate(width * height);
+
+	std::optional<ThreadPool> ownedPool;
+	ThreadPool& threadPool = Effects::GetThreadPool(options, ownedPool);
+
+	// Each band runs the whole chain on its own, starting a kernel's reach above its first row. Every output row depends
+	// only on the source, so the bands give the same result as a single one, at the cost of filtering their edges twice.
+	threadPool.ParallelFor(height, [&](size_t firstRow, size_t lastRow)
+	{
+		std::vector<StageRows> rows(plan.Stages.size() + 1);
+		rows[0].Output.resize(width);
+
+		for (size_t i = 0; i < plan.Stages.size(); i++)
+		{
+			const Stage& stage = plan.Stages[i];
+			size_t ringRows = (2 * (size_t)stage.Radius) + 1;
+
+			StageRows& stageRows = rows[i + 1];
+			stageRows.Filtered.resize(ringRows * width);
+			stageRows.Input.resize(stage.IsSharpen ? ringRows * width : 0);
+			stageRows.Output.resize(width);
+			stageRows.Taps.resize(ringRows);
+			stageRows.ZeroRow.resize(width);
+		}
+
+		for (size_t row = firstRow; row < lastRow; row++)
+		{
+			EffectGraph::GetStageRow(plan, rows, plan.Stages.size(), pixels, width, height, (int64_t)row, newPixels.get() + (row * width));
+		}
+	});
+
+	return newPixels;
+}
+
+EffectGraph::Plan EffectGraph::Compile(const EffectOptions& options) const
+{
+	Plan plan;
+
+	// Wrapping would need rows from the far edge of an intermediate image, which is never held whole.
+	EffectOptions stageOptions = options;
+	if (stageOptions.Boundary == EffectOptions::EBoundaryMode::Wrap)
+	{
+		stageOptions.Boundary = EffectOptions::EBoundaryMode::Clamp;
+	}
+
+	plan.Boundary = stageOptions.Boundary;
+
+	ChannelTable table;
+	std::iota(table.begin(), table.end(), (uint8_t)0);
+	bool hasTable = false;
+
+	// Point operations are collected into one table until the next convolution, then handed to whatever comes before it.
+	auto finishTable = [&]()
+	{
+		if (!hasTable)
+		{
+			return;
+		}
+
+		ChannelTable& target = plan.Stages.empty() ? plan.SourceTable : plan.Stages.back().Table;
+		bool& targetUsed = plan.Stages.empty() ? plan.HasSourceTable : plan.Stages.back().HasTable;
+
+		target = table;
+		targetUsed = true;
+
+		std::iota(table.begin(), table.end(), (uint8_t)0);
+		hasTable = false;
+	};
+
+	for (const Node& node : this->nodes)
+	{
+		switch (node.Effect)
+		{
+		case EEffect::Blur:
+		case EEffect::BlurSigma:
+		case EEffect::Sharpen:
+		{
+			finishTable();
+
+			int32_t radius = 0;
+			float sigma = 0.0f;
+
+			if (node.Effect == EEffect::Blur)
+			{
+				Effects::GetBlurParameters(node.Amount, radius, sigma);
+			}
+			else
+			{
+				// An unsharp mask subtracts a blur with a sigma of one pixel, which keeps only the finest detail.
+				sigma = node.Effect == EEffect::Sharpen ? 1.0f : std::clamp(node.Amount, 0.5f, Effects::MAX_SIGMA);
+				radius = Effects::GetSigmaRadius(sigma);
+			}
+
+			Stage stage;
+			stage.Radius = radius;
+			stage.Convolve = Effects::CreateSpanConvolver(radius, sigma, stageOptions);
+			stage.IsSharpen = node.Effect == EEffect::Sharpen;
+			stage.SharpenWeight = (int32_t)std::lround(std::clamp(node.Amount, 0.0f, MAX_FACTOR) * 256.0f);
+			plan.Stages.push_back(std::move(stage));
+			break;
+		}
+
+		case EEffect::Brightness:
+			for (uint8_t& value : table)
+			{
+				value = (uint8_t)std::clamp(std::lround(value * std::clamp(node.Amount, 0.0f, MAX_FACTOR)), 0l, 255l);
+			}
+
+			hasTable = true;
+			break;
+
+		case EEffect::Gamma:
+			for (uint8_t& value : table)
+			{
+				value = (uint8_t)std::clamp(std::lround(255.0 * std::pow(value / 255.0, 1.0 / std::clamp(node.Amount, MIN_GAMMA, MAX_GAMMA))), 0l, 255l);
+			}
+
+			hasTable = true;
+			break;
+		}
+	}
+
+	finishTable();
+	return plan;
+}
+
+const Vec4* EffectGraph::GetStageRow(const Plan& plan, std::vector<StageRows>& rows, const size_t stage, const Vec4* pixels, const size_t width, const size_t height, const int64_t row, Vec4* destination)
+{
+	StageRows& stageRows = rows[stage];
+	Vec4* target = destination != nullptr ? destination : stageRows.Output.data();
+
+	if (stage == 0)
+	{
+		const Vec4* source = pixels + (row * (int64_t)width);
+		if (!plan.HasSourceTable && destination == nullptr)
+		{
+			return source;
+		}
+
+		std::copy(source, source + width, target);
+
+		if (plan.HasSourceTable)
+		{
+			EffectGraph::ApplyTable(plan.SourceTable, target, width);
+		}
+
+		return target;
+	}
+
+	const Stage& current = plan.Stages[stage - 1];
+	const int64_t radius = current.Radius;
+	const size_t ringRows = (2 * (size_t)radius) + 1;
+
+	// Rows the kernel reaches below this one are filtered horizontally into the ring as they are first needed. A band starts
+	// radius rows above its first row, and every sample of a row maps back inside the radius rows either side of it.
+	if (stageRows.NextInputRow < 0)
+	{
+		stageRows.NextInputRow = std::max(row - radius, (int64_t)0);
+	}
+
+	int64_t lastInputRow = std::min(row + radius, (int64_t)height - 1);
+	for (; stageRows.NextInputRow <= lastInputRow; stageRows.NextInputRow++)
+	{
+		int64_t inputRow = stageRows.NextInputRow;
+		size_t slot = (size_t)inputRow % ringRows;
+
+		const Vec4* input = EffectGraph::GetStageRow(plan, rows, stage - 1, pixels, width, height, inputRow, nullptr);
+		Effects::BlurRowHorizontal(input, stageRows.Filtered.data() + (slot * width), width, current.Radius, plan.Boundary, current.Convolve, stageRows.Scanline, stageRows.ScanlineTaps);
+
+		if (current.IsSharpen)
+		{
+			std::copy(input, input + width, stageRows.Input.data() + (slot * width));
+		}
+	}
+
+	for (int64_t k = 0; k < (int64_t)ringRows; k++)
+	{
+		int64_t sample = Effects::GetBoundarySample(row + k - radius, (int64_t)height, plan.Boundary);
+		stageRows.Taps[k] = sample < 0 ? stageRows.ZeroRow.data() : stageRows.Filtered.data() + (((size_t)sample % ringRows) * width);
+	}
+
+	current.Convolve(stageRows.Taps.data(), target, width);
+
+	// An unsharp mask moves each color channel away from its blurred value, and keeps the alpha of the input.
+	if (current.IsSharpen)
+	{
+		const Vec4* input = stageRows.Input.data() + (((size_t)row % ringRows) * width);
+
+		auto sharpen = [&](const uint8_t original, const uint8_t blurred)
+		{
+			int32_t detail = (int32_t)original - (int32_t)blurred;
+			return (uint8_t)std::clamp((int32_t)original + ((current.SharpenWeight * detail + 128) >> 8), 0, 255);
+		};
+
+		for (size_t i = 0; i < width; i++)
+		{
+			target[i].x = sharpen(input[i].x, target[i].x);
+			target[i].y = sharpen(input[i].y, target[i].y);
+			target[i].z = sharpen(input[i].z, target[i].z);
+			target[i].w = input[i].w;
+		}
+	}
+
+	if (current.HasTable)
+	{
+		EffectGraph::ApplyTable(current.Table, target, width);
+	}
+
+	return target;
+}
+
+void EffectGraph::ApplyTable(const ChannelTable& table, Vec4* row, const size_t width)
+{
+	for (size_t i = 0; i < width; i++)
+	{
+		row[i].x = table[row[i].x];
+		row[i].y = table[row[i].y];
+		row[i].z = table[row[i].z];
+	}
+}
@@ -1,126 +1,1025 @@
 #include <Effects.h>
+#include <ThreadPool.h>
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <mutex>
+#include <unordered_map>
 #include <corecrt_math_defines.h>
 
-std::unique_ptr<Vec4[]> const Effects::GaussianBlur(const std::shared_ptr<Vec4[]>& pixels, const size_t width, const size_t height, float blurAmount)
+namespace
+{
+	/** The largest radius GetBlurParameters gives, reached in steps of one for every 0.05 of blur strength. */
+	constexpr int32_t TABLE_MAX_RADIUS = 20;
+
+	/** The number of weights in the widest kernel in the table. */
+	constexpr size_t TABLE_KERNEL_WIDTH = (2 * TABLE_MAX_RADIUS) + 1;
+
+	/** The most kernels a KernelCache holds. Explicit sigmas can ask for any number of kernels, so it is emptied when full. */
+	constexpr size_t KERNEL_CACHE_SIZE = 256;
+
+	/**
+	 * Limit a standard deviation to (0, Effects::MAX_SIGMA]. Values that are not positive, including NaN, become 0.
+	 */
+	float ClampSigma(const float sigma)
+	{
+		return sigma > 0.0f ? std::min(sigma, Effects::MAX_SIGMA) : 0.0f;
+	}
+
+	/**
+	 * e to the power of x, usable at compile time. The argument is reduced to r = x - k ln 2 with |r| <= ln 2 / 2, whose
+	 * Taylor series converges to double precision in 20 terms, and the result is scaled by 2^k, which is exact.
+	 */
+	constexpr double ConstexprExp(const double x)
+	{
+		constexpr double LN_2 = 0.693147180559945309417232121458;
+
+		int32_t k = (int32_t)(x / LN_2 + (x < 0.0 ? -0.5 : 0.5));
+		double r = x - (k * LN_2);
+
+		double term = 1.0;
+		double sum = 1.0;
+		for (int32_t n = 1; n <= 20; n++)
+		{
+			term *= r / n;
+			sum += term;
+		}
+
+		for (; k > 0; k--)
+		{
+			sum *= 2.0;
+		}
+
+		for (; k < 0; k++)
+		{
+			sum *= 0.5;
+		}
+
+		return sum;
+	}
+
+	/**
+	 * Compute a normalized 1D Gaussian kernel. This runs at compile time for the table and at runtime for every other
+	 * kernel, so a kernel has the same weights wherever it comes from.
+	 * @param kernel The weights to write, 2 * radius + 1 of them.
+	 */
+	constexpr void ComputeGaussianKernel(const int32_t radius, const float sigma, float* kernel)
+	{
+		// The constant factor of the Gaussian is left out, as normalizing cancels it.
+		auto gaussian = [&](const int32_t i) { return ConstexprExp(-(double)(i * i) / (2.0 * (double)sigma * (double)sigma)); };
+
+		double sum = 0.0;
+		for (int32_t i = -radius; i <= radius; i++)
+		{
+			sum += gaussian(i);
+		}
+
+		for (int32_t i = -radius; i <= radius; i++)
+		{
+			kernel[i + radius] = (float)(gaussian(i) / sum);
+		}
+	}
+
+	/**
+	 * Quantize a normalized kernel to 0.16 fixed point, with weights that sum to exactly 1 << 16.
+	 */
+	constexpr void QuantizeGaussianKernel(const float* kernel, const size_t kernelWidth, uint16_t* fixedKernel)
+	{
+		const int64_t one = (int64_t)1 << BlurKernels::FIXED_POINT_SHIFT;
+
+		int64_t sum = 0;
+		for (size_t i = 0; i < kernelWidth; i++)
+		{
+			int64_t weight = (int64_t)(((double)kernel[i] * one) + 0.5);
+			fixedKernel[i] = (uint16_t)std::clamp(weight, (int64_t)0, one - 1);
+			sum += fixedKernel[i];
+		}
+
+		// Rounding each weight leaves the sum a few units away from 1.0. Give the difference to the center weight,
+		// which is the largest, so the kernel stays symmetric and the weights sum to exactly 1 << 16.
+		size_t center = kernelWidth / 2;
+		fixedKernel[center] = (uint16_t)(fixedKernel[center] + (one - sum));
+	}
+
+	/** The kernels for every step of blur strength GetBlurParameters can give, in both precisions, indexed by radius. */
+	struct KernelTable
+	{
+		std::array<std::array<float, TABLE_KERNEL_WIDTH>, TABLE_MAX_RADIUS + 1> Weights = {};
+		std::array<std::array<uint16_t, TABLE_KERNEL_WIDTH>, TABLE_MAX_RADIUS + 1> FixedWeights = {};
+	};
+
+	constexpr KernelTable BuildKernelTable()
+	{
+		KernelTable table;
+
+		for (int32_t radius = 1; radius <= TABLE_MAX_RADIUS; radius++)
+		{
+			size_t kernelWidth = (2 * (size_t)radius) + 1;
+			ComputeGaussianKernel(radius, std::max(radius * 0.5f, 1.0f), table.Weights[radius].data());
+			QuantizeGaussianKernel(table.Weights[radius].data(), kernelWidth, table.FixedWeights[radius].data());
+		}
+
+		return table;
+	}
+
+	/** Every kernel a blur strength can ask for, computed while compiling. */
+	constexpr KernelTable KERNEL_TABLE = BuildKernelTable();
+
+	/**
+	 * Get the row of the table holding the kernel for a radius and sigma, or -1 if the table does not hold it.
+	 * A blur strength of k / 20 gives a radius of k and a sigma of k / 2, both at least 1.
+	 */
+	int32_t GetTableRow(const int32_t radius, const float sigma)
+	{
+		return radius >= 1 && radius <= TABLE_MAX_RADIUS && sigma == std::max(radius * 0.5f, 1.0f) ? radius : -1;
+	}
+
+	/**
+	 * The kernels built so far in one precision, keyed by radius and sigma, shared by every thread.
+	 * A kernel is built outside the lock, so two threads may both build a new kernel, and the first one stored is kept.
+	 */
+	template <typename T>
+	class KernelCache
+	{
+	public:
+
+		/**
+		 * Get the kernel for a radius and sigma, building it if it is not cached yet.
+		 * @param build Builds the kernel.
+		 */
+		template <typename Builder>
+		std::shared_ptr<const std::vector<T>> Get(const int32_t radius, const float sigma, Builder build)
+		{
+			uint64_t key = ((uint64_t)(uint32_t)radius << 32) | std::bit_cast<uint32_t>(sigma);
+
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				auto kernel = this->kernels.find(key);
+				if (kernel != this->kernels.end())
+				{
+					return kernel->second;
+				}
+			}
+
+			auto kernel = std::make_shared<const std::vector<T>>(build());
+
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (this->kernels.size() >= KERNEL_CACHE_SIZE)
+			{
+				this->kernels.clear();
+			}
+
+			return this->kernels.emplace(key, kernel).first->second;
+		}
+
+	private:
+
+		/** The kernels, keyed by radius in the high half and the bits of sigma in the low half. */
+		std::unordered_map<uint64_t, std::shared_ptr<const std::vector<T>>> kernels = {};
+
+		/** Guards kernels. */
+		std::mutex mutex;
+	};
+
+	KernelCache<float> floatKernels;
+	KernelCache<uint16_t> fixedKernels;
+}
+
+PixelPool::Buffer const Effects::GaussianBlur(const std::shared_ptr<Vec4[]>& pixels, const size_t width, const size_t height, float blurAmount, const EffectOptions& options)
+{
+	return Effects::GaussianBlur(pixels.get(), width, height, blurAmount, options);
+}
+
+PixelPool::Buffer const Effects::GaussianBlurSigma(const std::shared_ptr<Vec4[]>& pixels, const size_t width, const size_t height, float sigma, const EffectOptions& options)
+{
+	return Effects::GaussianBlurSigma(pixels.get(), width, height, sigma, options);
+}
+
+PixelPool::Buffer Effects::GaussianBlur(const Vec4* pixels, const size_t width, const size_t height, float blurAmount, const EffectOptions& options)
+{
+	int32_t radius = 0;
+	float sigma = 0.0f;
+	Effects::GetBlurParameters(blurAmount, radius, sigma);
+
+	return Effects::ApplyGaussianBlur(pixels, width, height, radius, sigma, options);
+}
+
+PixelPool::Buffer Effects::GaussianBlurSigma(const Vec4* pixels, const size_t width, const size_t height, float sigma, const EffectOptions& options)
+{
+	sigma = std::max(sigma, 0.5f);
+
+	return Effects::ApplyGaussianBlur(pixels, width, height, Effects::GetSigmaRadius(sigma), sigma, options);
+}
+
+PlanarImage Effects::GaussianBlur(const PlanarImage& image, float blurAmount, const EffectOptions& options)
+{
+	int32_t radius = 0;
+	float sigma = 0.0f;
+	Effects::GetBlurParameters(blurAmount, radius, sigma);
+
+	return Effects::ApplyGaussianBlur(image, radius, sigma, options);
+}
+
+PlanarImage Effects::GaussianBlurSigma(const PlanarImage& image, float sigma, const EffectOptions& options)
+{
+	sigma = std::max(sigma, 0.5f);
+
+	return Effects::ApplyGaussianBlur(image, Effects::GetSigmaRadius(sigma), sigma, options);
+}
+
+void Effects::GaussianBlurRows(const size_t width, const size_t height, const RowReader& readRow, const RowWriter& writeRow, float blurAmount, const EffectOptions& options)
+{
+	int32_t radius = 0;
+	float sigma = 0.0f;
+	Effects::GetBlurParameters(blurAmount, radius, sigma);
+
+	Effects::ApplyGaussianBlurRows(width, height, readRow, writeRow, radius, sigma, options);
+}
+
+void Effects::GaussianBlurRowsSigma(const size_t width, const size_t height, const RowReader& readRow, const RowWriter& writeRow, float sigma, const EffectOptions& options)
+{
+	sigma = std::max(sigma, 0.5f);
+
+	Effects::ApplyGaussianBlurRows(width, height, readRow, writeRow, Effects::GetSigmaRadius(sigma), sigma, options);
+}
+
+void Effects::GetBlurParameters(float blurAmount, int32_t& radius, float& sigma)
 {
 	blurAmount = std::clamp(blurAmount, 0.0f, 1.0f);
-	size_t length = width * height;
-	std::unique_ptr<Vec4[]> newPixels = std::make_unique<Vec4[]>(length);
 
 	// Scale the radius of the blurring effect by blurAmount, but we always want a radius of at least 1.
 	// A value of 20 is chosen here as a reasonable maximum value of the radius to get a near-unrecognizable image at blurAmount = 1.
-	int32_t radius = std::max((int)round(20 * blurAmount), 1);
+	radius = std::max((int)round(20 * blurAmount), 1);
 
 	// Scale the sigma value by the blurAmount, but we always want a sigma of at least 1.
 	// A value of 10 is chosen here as a reasonable maximum value for sigma to get a near-unrecognizable image at blurAmount = 1
-	float sigma = std::max(10.0f * blurAmount, 1.0f);
+	sigma = std::max(10.0f * blurAmount, 1.0f);
+}
 
-	std::vector<float> kernel = Effects::Get1DMatrix(radius, sigma);
+int32_t Effects::GetSigmaRadius(const float sigma)
+{
+	// Three standard deviations either side of the center covers 99.7% of the Gaussian.
+	return std::max((int32_t)std::ceil(3.0f * ClampSigma(sigma)), 1);
+}
 
-	// Apply a 1D kernel in the horizontal orientation to all pixels.
-	for (size_t i = 0; i < height; i++)
+PixelPool::Buffer Effects::ApplyGaussianBlur(const Vec4* pixels, const size_t width, const size_t height, const int32_t radius, const float sigma, const EffectOptions& options)
+{
+	size_t length = width * height;
+
+	// Both passes write every pixel, so the buffers are taken uninitialized from the pool, and the working copy goes back for the next blur.
+	PixelPool::Buffer horizontalPixels = PixelPool::GetShared().Allocate(length);
+	PixelPool::Buffer newPixels = PixelPool::GetShared().Allocate(length);
+
+	SeparableBlur blur = Effects::CreateSeparableBlur(radius, sigma, options);
+
+	// Every output pixel only depends on the source buffer of its pass, so the passes can be split into
+	// independent bands without changing the result. The vertical pass reads from a separate buffer so
+	// that rows which have already been blurred vertically are never sampled again.
+	std::optional<ThreadPool> ownedPool;
+	ThreadPool& threadPool = Effects::GetThreadPool(options, ownedPool);
+
+	// Blur all rows, one band of rows per thread.
+	threadPool.ParallelFor(height, [&](size_t firstRow, size_t lastRow)
 	{
-		for (size_t j = 0; j < width; j++)
+		RowBlur blurRow = blur.CreateRowBlur();
+
+		for (size_t i = firstRow; i < lastRow; i++)
 		{
-			Vec4f pixel = {};
-			size_t pixelIndex = j + (i * height);
+			blurRow(pixels + (i * width), horizontalPixels.get() + (i * width), width);
+		}
+	});
 
-			for (int32_t kernelColumn = -radius; kernelColumn <= radius; kernelColumn++)
-			{
-				int32_t kernelSamplePixelIndex = pixelIndex + kernelColumn;
+	// Blur all columns, one strip of columns per thread.
+	Effects::BlurColumnBlocks(threadPool, blur, horizontalPixels.get(), newPixels.get(), width, width, height);
+
+	return newPixels;
+}
+
+PlanarImage Effects::ApplyGaussianBlur(const PlanarImage& image, const int32_t radius, const float sigma, const EffectOptions& options)
+{
+	size_t width = image.GetWidth();
+	size_t height = image.GetHeight();
+
+	PlanarImage newImage(width, height, image.GetChannelCount());
+	PlanarImage horizontalPlane(width, height, 1);
+
+	SeparableBlur blur = Effects::CreateSeparableBlur(radius, sigma, options);
+	std::optional<ThreadPool> ownedPool;
+	ThreadPool& threadPool = Effects::GetThreadPool(options, ownedPool);
+
+	// A plane viewed as Vec4 puts four neighbouring samples of one row in each pixel. Every algorithm blurs
+	// the channels of a pixel independently, so in the vertical pass that view blurs four columns at once.
+	// The padding at the end of each row rounds the width up to whole pixels.
+	size_t pitch = image.GetStride() / sizeof(Vec4);
+	size_t columnCount = (width + sizeof(Vec4) - 1) / sizeof(Vec4);
 
-				if (kernelSamplePixelIndex < 0)
+	for (size_t c = 0; c < image.GetChannelCount(); c++)
+	{
+		// In the horizontal pass the samples of a row must be whole pixels apart, so four rows are packed
+		// into the four channels of a line, blurred as one row, then unpacked.
+		threadPool.ParallelFor((height + 3) / 4, [&](size_t firstGroup, size_t lastGroup)
+		{
+			RowBlur blurRow = blur.CreateRowBlur();
+			std::vector<Vec4> packedRow(width);
+			std::vector<Vec4> blurredRow(width);
+
+			// Groups at the bottom of the image with fewer than four rows read zeros and discard the result.
+			std::vector<uint8_t> zeroRow(width);
+			std::vector<uint8_t> discardedRow(width);
+
+			for (size_t group = firstGroup; group < lastGroup; group++)
+			{
+				const uint8_t* sourceRows[4] = {};
+				uint8_t* destinationRows[4] = {};
+				for (size_t k = 0; k < 4; k++)
 				{
-					kernelSamplePixelIndex = 0;
+					size_t i = (group * 4) + k;
+					sourceRows[k] = i < height ? image.GetRow(c, i) : zeroRow.data();
+					destinationRows[k] = i < height ? horizontalPlane.GetRow(0, i) : discardedRow.data();
 				}
-				else if (kernelSamplePixelIndex >= length)
+
+				for (size_t j = 0; j < width; j++)
 				{
-					kernelSamplePixelIndex = length - 1;
+					packedRow[j] = { sourceRows[0][j], sourceRows[1][j], sourceRows[2][j], sourceRows[3][j] };
 				}
 
-				float kernelValue = kernel[kernelColumn + radius];
+				blurRow(packedRow.data(), blurredRow.data(), width);
 
-				pixel.w += pixels[kernelSamplePixelIndex].w * kernelValue;
-				pixel.x += pixels[kernelSamplePixelIndex].x * kernelValue;
-				pixel.y += pixels[kernelSamplePixelIndex].y * kernelValue;
-				pixel.z += pixels[kernelSamplePixelIndex].z * kernelValue;
+				for (size_t j = 0; j < width; j++)
+				{
+					destinationRows[0][j] = blurredRow[j].x;
+					destinationRows[1][j] = blurredRow[j].y;
+					destinationRows[2][j] = blurredRow[j].z;
+					destinationRows[3][j] = blurredRow[j].w;
+				}
 			}
+		});
 
-			newPixels[pixelIndex].w = (uint8_t)std::clamp(round(pixel.w), 0.0f, 255.0f);
-			newPixels[pixelIndex].x = (uint8_t)std::clamp(round(pixel.x), 0.0f, 255.0f);
-			newPixels[pixelIndex].y = (uint8_t)std::clamp(round(pixel.y), 0.0f, 255.0f);
-			newPixels[pixelIndex].z = (uint8_t)std::clamp(round(pixel.z), 0.0f, 255.0f);
-		}
+		Effects::BlurColumnBlocks(threadPool, blur, (Vec4*)horizontalPlane.GetRow(0, 0), (Vec4*)newImage.GetRow(c, 0), pitch, columnCount, height);
 	}
 
-	// Apply a 1D kernel in the vertical direction to all pixels.
-	for (size_t i = 0; i < height; i++)
+	return newImage;
+}
+
+void Effects::ApplyGaussianBlurRows(const size_t width, const size_t height, const RowReader& readRow, const RowWriter& writeRow, const int32_t radius, const float sigma, const EffectOptions& options)
+{
+	// Wrapping would need rows from the far edge of the image before they have been read.
+	EffectOptions rowOptions = options;
+	if (rowOptions.Boundary == EffectOptions::EBoundaryMode::Wrap)
+	{
+		rowOptions.Boundary = EffectOptions::EBoundaryMode::Clamp;
+	}
+
+	SeparableBlur blur = Effects::CreateExactBlur(radius, sigma, rowOptions);
+	SpanConvolver convolve = Effects::CreateSpanConvolver(radius, sigma, rowOptions);
+	std::optional<ThreadPool> ownedPool;
+	ThreadPool& threadPool = Effects::GetThreadPool(options, ownedPool);
+
+	// Output rows are produced a batch at a time, one row per thread. A batch needs the rows radius above
+	// and below it, so the ring holds 2 * radius rows on top of a batch. Rows beyond the edges of the image
+	// always map back inside that window: clamping and mirroring only reach radius rows in from the edge.
+	size_t batchRows = std::min(threadPool.GetThreadCount(), height);
+	size_t ringRows = (2 * (size_t)radius) + batchRows;
+
+	std::vector<Vec4> ring(ringRows * width);
+	std::vector<Vec4> inputRows((batchRows + radius) * width);
+	std::vector<Vec4> outputRows(batchRows * width);
+	std::vector<Vec4> zeroRow(width);
+
+	size_t rowsRead = 0;
+	for (size_t firstRow = 0; firstRow < height; firstRow += batchRows)
 	{
-		for (size_t j = 0; j < width; j++)
+		size_t lastRow = std::min(firstRow + batchRows, height);
+
+		// Read every row the batch depends on that hasn't arrived yet, then blur them horizontally into the ring.
+		size_t firstRead = rowsRead;
+		size_t readCount = std::min(lastRow + radius, height) - firstRead;
+		for (size_t i = 0; i < readCount; i++)
+		{
+			readRow(inputRows.data() + (i * width));
+		}
+
+		rowsRead += readCount;
+
+		threadPool.ParallelFor(readCount, [&](size_t begin, size_t end)
 		{
-			Vec4f pixel = {};
-			size_t pixelIndex = j + (i * height);
+			RowBlur blurRow = blur.CreateRowBlur();
 
-			for (int32_t kernelRow = -radius; kernelRow <= radius; kernelRow++)
+			for (size_t i = begin; i < end; i++)
 			{
-				int32_t kernelSamplePixelIndex = pixelIndex + (width * kernelRow);
+				blurRow(inputRows.data() + (i * width), ring.data() + (((firstRead + i) % ringRows) * width), width);
+			}
+		});
+
+		// Each output row is one span convolved against the ring rows above and below it.
+		threadPool.ParallelFor(lastRow - firstRow, [&](size_t begin, size_t end)
+		{
+			std::vector<const Vec4*> taps((2 * radius) + 1);
 
-				if (kernelSamplePixelIndex < 0)
+			for (size_t i = begin; i < end; i++)
+			{
+				int64_t row = (int64_t)(firstRow + i);
+
+				for (int32_t k = 0; k < (int32_t)taps.size(); k++)
 				{
-					kernelSamplePixelIndex = 0;
+					int64_t sample = Effects::GetBoundarySample(row + k - radius, (int64_t)height, rowOptions.Boundary);
+					taps[k] = sample < 0 ? zeroRow.data() : ring.data() + (((size_t)sample % ringRows) * width);
 				}
-				else if (kernelSamplePixelIndex >= length)
+
+				convolve(taps.data(), outputRows.data() + (i * width), width);
+			}
+		});
+
+		for (size_t i = 0; i < lastRow - firstRow; i++)
+		{
+			writeRow(outputRows.data() + (i * width));
+		}
+	}
+}
+
+Effects::SeparableBlur Effects::CreateSeparableBlur(const int32_t radius, const float sigma, const EffectOptions& options)
+{
+	switch (options.Mode)
+	{
+	case EffectOptions::EBlurMode::Box:
+		return Effects::CreateBoxBlur(sigma, options);
+
+	case EffectOptions::EBlurMode::Recursive:
+		return Effects::CreateRecursiveBlur(sigma);
+
+	case EffectOptions::EBlurMode::Exact:
+	default:
+		return Effects::CreateExactBlur(radius, sigma, options);
+	}
+}
+
+Effects::SeparableBlur Effects::CreateExactBlur(const int32_t radius, const float sigma, const EffectOptions& options)
+{
+	SpanConvolver convolve = Effects::CreateSpanConvolver(radius, sigma, options);
+	EffectOptions::EBoundaryMode boundary = options.Boundary;
+
+	SeparableBlur blur;
+	blur.CreateRowBlur = [radius, boundary, convolve]() -> RowBlur
+	{
+		return [radius, boundary, convolve, scanline = std::vector<Vec4>(), taps = std::vector<const Vec4*>()](const Vec4* source, Vec4* destination, const size_t width) mutable
+		{
+			Effects::BlurRowHorizontal(source, destination, width, radius, boundary, convolve, scanline, taps);
+		};
+	};
+
+	blur.CreateColumnBlur = [radius, boundary, convolve]() -> ColumnBlur
+	{
+		return [radius, boundary, convolve](Vec4* source, Vec4* destination, const size_t pitch, const size_t height, const size_t firstColumn, const size_t lastColumn)
+		{
+			Effects::BlurColumnsVertical(source, destination, pitch, height, radius, boundary, convolve, firstColumn, lastColumn);
+		};
+	};
+
+	// Each output row reads 2 * radius + 1 source rows, so columns are walked in blocks narrow enough for
+	// those rows to stay in cache as the block moves down, rather than being fetched again for every row.
+	blur.ColumnBlockWidth = Effects::GetColumnBlockWidth(((2 * (size_t)radius) + 2) * sizeof(Vec4));
+
+	return blur;
+}
+
+Effects::SpanConvolver Effects::CreateSpanConvolver(const int32_t radius, const float sigma, const EffectOptions& options)
+{
+	// Bind the kernel weights to the span kernel for the chosen precision, so the passes don't need to know about either.
+	SpanConvolver convolve;
+
+	if (options.Precision == EffectOptions::EPrecision::FixedPoint)
+	{
+		std::shared_ptr<const std::vector<uint16_t>> fixedKernel = Effects::Get1DMatrixFixed(radius, sigma);
+		uint16_t maxWeight = *std::max_element(fixedKernel->begin(), fixedKernel->end());
+		BlurKernels::ConvolveFixedFunction convolveFixed = BlurKernels::GetConvolveFixedFunction(options.MaxInstructionSet, fixedKernel->size(), maxWeight);
+
+		convolve = [fixedKernel, convolveFixed](const Vec4* const* taps, Vec4* destination, const size_t count)
+		{
+			convolveFixed(taps, fixedKernel->data(), fixedKernel->size(), destination, count);
+		};
+	}
+	else
+	{
+		std::shared_ptr<const std::vector<float>> kernel = Effects::Get1DMatrix(radius, sigma);
+		BlurKernels::ConvolveFunction convolveFloat = BlurKernels::GetConvolveFunction(options.MaxInstructionSet, kernel->size());
+
+		convolve = [kernel, convolveFloat](const Vec4* const* taps, Vec4* destination, const size_t count)
+		{
+			convolveFloat(taps, kernel->data(), kernel->size(), destination, count);
+		};
+	}
+
+	return convolve;
+}
+
+Effects::SeparableBlur Effects::CreateBoxBlur(const float sigma, const EffectOptions& options)
+{
+	std::vector<int32_t> boxRadii = Effects::GetBoxRadii(sigma, std::clamp(options.BoxPassCount, 3u, 5u));
+
+	SeparableBlur blur;
+
+	// Every box pass over a row only needs that row, so all of them run on a row before moving on.
+	blur.CreateRowBlur = [boxRadii]() -> RowBlur
+	{
+		return [boxRadii, lineA = std::vector<Vec4>(), lineB = std::vector<Vec4>()](const Vec4* source, Vec4* destination, const size_t width) mutable
+		{
+			lineA.resize(width);
+			lineB.resize(width);
+
+			for (size_t pass = 0; pass < boxRadii.size(); pass++)
+			{
+				bool lastPass = pass + 1 == boxRadii.size();
+				Vec4* passDestination = lastPass ? destination : (pass % 2 == 0 ? lineA.data() : lineB.data());
+
+				Effects::BoxBlurRow(source, passDestination, width, boxRadii[pass]);
+				source = passDestination;
+			}
+		};
+	};
+
+	// Likewise every vertical box pass over a block of columns only needs that block. The passes ping-pong
+	// between the two buffers, so an even number of passes ends in source and is copied across.
+	blur.CreateColumnBlur = [boxRadii]() -> ColumnBlur
+	{
+		return [boxRadii](Vec4* source, Vec4* destination, const size_t pitch, const size_t height, const size_t firstColumn, const size_t lastColumn)
+		{
+			Vec4* passSource = source;
+			Vec4* passDestination = destination;
+
+			for (size_t pass = 0; pass < boxRadii.size(); pass++)
+			{
+				Effects::BoxBlurColumns(passSource, passDestination, pitch, height, boxRadii[pass], firstColumn, lastColumn);
+				std::swap(passSource, passDestination);
+			}
+
+			if (passSource != destination)
+			{
+				for (size_t i = 0; i < height; i++)
 				{
-					kernelSamplePixelIndex = length - 1;
+					std::copy(source + (i * pitch) + firstColumn, source + (i * pitch) + lastColumn, destination + (i * pitch) + firstColumn);
 				}
+			}
+		};
+	};
+
+	// A pass keeps a running sum per channel and touches three rows for each column.
+	blur.ColumnBlockWidth = Effects::GetColumnBlockWidth((4 * sizeof(uint32_t)) + (3 * sizeof(Vec4)));
+
+	return blur;
+}
+
+Effects::SeparableBlur Effects::CreateRecursiveBlur(const float sigma)
+{
+	RecursiveFilter filter = Effects::GetRecursiveFilter(sigma);
+
+	SeparableBlur blur;
+	blur.CreateRowBlur = [filter]() -> RowBlur
+	{
+		return [filter, causal = std::vector<double>()](const Vec4* source, Vec4* destination, const size_t width) mutable
+		{
+			Effects::RecursiveBlurLines(source, destination, width, 1, 1, filter, causal);
+		};
+	};
+
+	// A block of columns is filtered row by row, so memory is read contiguously, and the forwards pass output for the block stays small.
+	blur.CreateColumnBlur = [filter]() -> ColumnBlur
+	{
+		return [filter, causal = std::vector<double>()](Vec4* source, Vec4* destination, const size_t pitch, const size_t height, const size_t firstColumn, const size_t lastColumn) mutable
+		{
+			Effects::RecursiveBlurLines(source + firstColumn, destination + firstColumn, height, lastColumn - firstColumn, pitch, filter, causal);
+		};
+	};
+
+	blur.ColumnBlockWidth = 32;
+
+	return blur;
+}
+
+ThreadPool& Effects::GetThreadPool(const EffectOptions& options, std::optional<ThreadPool>& ownedPool)
+{
+	if (options.Pool != nullptr)
+	{
+		return *options.Pool;
+	}
+
+	return ownedPool.emplace(options.WorkerCount);
+}
+
+void Effects::BlurColumnBlocks(ThreadPool& threadPool, const SeparableBlur& blur, Vec4* source, Vec4* destination, const size_t pitch, const size_t columnCount, const size_t height)
+{
+	threadPool.ParallelFor(columnCount, [&](size_t firstColumn, size_t lastColumn)
+	{
+		ColumnBlur blurColumns = blur.CreateColumnBlur();
+
+		for (size_t blockStart = firstColumn; blockStart < lastColumn; blockStart += blur.ColumnBlockWidth)
+		{
+			size_t blockEnd = std::min(blockStart + blur.ColumnBlockWidth, lastColumn);
+			blurColumns(source, destination, pitch, height, blockStart, blockEnd);
+		}
+	});
+}
+
+Effects::RecursiveFilter Effects::GetRecursiveFilter(const float sigma)
+{
+	// Young and van Vliet, "Recursive implementation of the Gaussian filter", 1995.
+	double s = std::max((double)ClampSigma(sigma), 0.5);
+	double q = s >= 2.5 ? (0.98711 * s) - 0.96330 : 3.97156 - (4.14554 * std::sqrt(1.0 - (0.26891 * s)));
+
+	double b0 = 1.57825 + (2.44413 * q) + (1.4281 * q * q) + (0.422205 * q * q * q);
+	double b1 = (2.44413 * q) + (2.85619 * q * q) + (1.26661 * q * q * q);
+	double b2 = -((1.4281 * q * q) + (1.26661 * q * q * q));
+	double b3 = 0.422205 * q * q * q;
 
-				float kernelValue = kernel[kernelRow + radius];
+	RecursiveFilter filter;
+	filter.A[0] = b1 / b0;
+	filter.A[1] = b2 / b0;
+	filter.A[2] = b3 / b0;
+	filter.B = 1.0 - (filter.A[0] + filter.A[1] + filter.A[2]);
+
+	// Past the end of a clamped line the input is constant, so the causal output decays from its final state
+	// towards the edge value. Run that decay for each unit state until it has died out, then run the anti-causal
+	// filter back over it, to find how each part of the final state feeds into the anti-causal initial state.
+	// This is equivalent to the closed form of Triggs and Sdika, "Boundary conditions for Young-van Vliet recursive filtering", 2006.
+	size_t decayLength = (size_t)(10.0 * s) + 100;
+	std::vector<double> decay(decayLength + 3);
+
+	for (size_t j = 0; j < 3; j++)
+	{
+		double previous[3] = {};
+		previous[j] = 1.0;
+
+		for (size_t n = 0; n < decayLength; n++)
+		{
+			double value = (filter.A[0] * previous[0]) + (filter.A[1] * previous[1]) + (filter.A[2] * previous[2]);
+			decay[n] = value;
+			previous[2] = previous[1];
+			previous[1] = previous[0];
+			previous[0] = value;
+		}
 
-				pixel.w += newPixels[kernelSamplePixelIndex].w * kernelValue;
-				pixel.x += newPixels[kernelSamplePixelIndex].x * kernelValue;
-				pixel.y += newPixels[kernelSamplePixelIndex].y * kernelValue;
-				pixel.z += newPixels[kernelSamplePixelIndex].z * kernelValue;
+		double next[3] = {};
+		for (size_t n = decayLength; n-- > 0;)
+		{
+			double value = (filter.B * decay[n]) + (filter.A[0] * next[0]) + (filter.A[1] * next[1]) + (filter.A[2] * next[2]);
+			next[2] = next[1];
+			next[1] = next[0];
+			next[0] = value;
+
+			if (n < 3)
+			{
+				filter.EndMatrix[n][j] = value;
 			}
+		}
+	}
+
+	return filter;
+}
+
+void Effects::RecursiveBlurLines(const Vec4* source, Vec4* destination, const size_t lineLength, const size_t lineCount, const size_t sampleStride, const RecursiveFilter& filter, std::vector<double>& causal)
+{
+	// Every channel of every line is filtered independently. Channels of neighbouring lines are next to each other,
+	// so the inner loops walk contiguous memory whichever direction the lines run in.
+	size_t channelCount = lineCount * 4;
+	causal.resize((lineLength + 3) * channelCount);
+
+	auto channelsAt = [sampleStride](const Vec4* pixels, size_t n)
+	{
+		return (const uint8_t*)(pixels + (n * sampleStride));
+	};
 
-			newPixels[pixelIndex].w = (uint8_t)std::clamp(round(pixel.w), 0.0f, 255.0f);
-			newPixels[pixelIndex].x = (uint8_t)std::clamp(round(pixel.x), 0.0f, 255.0f);
-			newPixels[pixelIndex].y = (uint8_t)std::clamp(round(pixel.y), 0.0f, 255.0f);
-			newPixels[pixelIndex].z = (uint8_t)std::clamp(round(pixel.z), 0.0f, 255.0f);
+	// The first three slots hold the state before the line starts. Clamping to the edge means the input
+	// before the line is the first sample forever, which the filter passes through unchanged.
+	const uint8_t* first = channelsAt(source, 0);
+	for (size_t k = 0; k < 3; k++)
+	{
+		for (size_t c = 0; c < channelCount; c++)
+		{
+			causal[(k * channelCount) + c] = first[c];
 		}
 	}
 
-	return newPixels;
+	// Causal pass, forwards along the lines.
+	for (size_t n = 0; n < lineLength; n++)
+	{
+		const uint8_t* input = channelsAt(source, n);
+		double* output = &causal[(n + 3) * channelCount];
+
+		for (size_t c = 0; c < channelCount; c++)
+		{
+			output[c] = (filter.B * input[c])
+				+ (filter.A[0] * output[c - channelCount])
+				+ (filter.A[1] * output[c - (2 * channelCount)])
+				+ (filter.A[2] * output[c - (3 * channelCount)]);
+		}
+	}
+
+	// Anti-causal pass, backwards along the lines, starting from the state a clamped edge would leave.
+	const uint8_t* last = channelsAt(source, lineLength - 1);
+	std::vector<double> next(channelCount * 3);
+
+	for (size_t c = 0; c < channelCount; c++)
+	{
+		double edge = last[c];
+		double offsets[3] = {};
+		for (size_t k = 0; k < 3; k++)
+		{
+			offsets[k] = causal[((lineLength + 2 - k) * channelCount) + c] - edge;
+		}
+
+		for (size_t k = 0; k < 3; k++)
+		{
+			next[(k * channelCount) + c] = edge + (filter.EndMatrix[k][0] * offsets[0]) + (filter.EndMatrix[k][1] * offsets[1]) + (filter.EndMatrix[k][2] * offsets[2]);
+		}
+	}
+
+	double* next0 = &next[0];
+	double* next1 = &next[channelCount];
+	double* next2 = &next[2 * channelCount];
+
+	for (size_t n = lineLength; n-- > 0;)
+	{
+		const double* input = &causal[(n + 3) * channelCount];
+		uint8_t* output = (uint8_t*)(destination + (n * sampleStride));
+
+		for (size_t c = 0; c < channelCount; c++)
+		{
+			double value = (filter.B * input[c]) + (filter.A[0] * next0[c]) + (filter.A[1] * next1[c]) + (filter.A[2] * next2[c]);
+			next2[c] = next1[c];
+			next1[c] = next0[c];
+			next0[c] = value;
+
+			output[c] = (uint8_t)std::clamp(std::round(value), 0.0, 255.0);
+		}
+	}
+}
+
+size_t Effects::GetColumnBlockWidth(const size_t bytesPerColumn)
+{
+	size_t blockWidth = Effects::VERTICAL_PASS_CACHE_BYTES / std::max(bytesPerColumn, (size_t)1);
+
+	// Large radii would otherwise leave blocks too narrow to fill a cache line per row, or a vector register.
+	blockWidth = std::max(blockWidth, (size_t)16);
+	return blockWidth - (blockWidth % 8);
+}
+
+std::vector<int32_t> Effects::GetBoxRadii(const float sigma, const uint32_t passCount)
+{
+	// n box blurs of width w have a combined variance of n(w^2 - 1)/12. Choose the odd widths either side of the
+	// ideal width, and how many of each, so that the combined variance is as close to sigma^2 as possible.
+	// See "Fast Almost-Gaussian Filtering", Peter Kovesi.
+	double clampedSigma = ClampSigma(sigma);
+	double variance = clampedSigma * clampedSigma;
+	double idealWidth = std::sqrt((12.0 * variance / passCount) + 1.0);
+
+	int32_t lowerWidth = (int32_t)std::floor(idealWidth);
+	if (lowerWidth % 2 == 0)
+	{
+		lowerWidth--;
+	}
+
+	lowerWidth = std::max(lowerWidth, 1);
+	int32_t upperWidth = lowerWidth + 2;
+
+	// Worked in doubles, as passCount * lowerWidth^2 overflows 32 bits long before the widths do.
+	double idealLowerCount = ((12.0 * variance) - ((double)passCount * lowerWidth * lowerWidth) - (4.0 * passCount * lowerWidth) - (3.0 * passCount)) / ((-4.0 * lowerWidth) - 4.0);
+	int32_t lowerCount = std::clamp((int32_t)std::round(idealLowerCount), 0, (int32_t)passCount);
+
+	std::vector<int32_t> radii(passCount);
+	for (int32_t i = 0; i < (int32_t)passCount; i++)
+	{
+		int32_t boxWidth = i < lowerCount ? lowerWidth : upperWidth;
+		radii[i] = (boxWidth - 1) / 2;
+	}
+
+	return radii;
+}
+
+void Effects::BoxBlurRow(const Vec4* source, Vec4* destination, const size_t length, const int32_t radius)
+{
+	int64_t last = (int64_t)length - 1;
+	uint32_t boxWidth = (2 * radius) + 1;
+
+	// Divide by the box width with a multiply and shift. Sums are at most 255 * boxWidth, which leaves
+	// enough headroom in 64 bits for the result to be exact for any box that fits in an image.
+	const uint32_t shift = 40;
+	uint64_t reciprocal = (((uint64_t)1 << shift) + boxWidth - 1) / boxWidth;
+	uint32_t half = boxWidth / 2;
+
+	// Start with the window centred on the first pixel. Samples before the start are all the first pixel,
+	// and samples past the end are all the last pixel.
+	int64_t insideCount = std::min((int64_t)radius, last);
+	uint32_t firstCount = radius + 1;
+	uint32_t lastCount = (uint32_t)(radius - insideCount);
+
+	uint32_t sumX = (source[0].x * firstCount) + (source[last].x * lastCount);
+	uint32_t sumY = (source[0].y * firstCount) + (source[last].y * lastCount);
+	uint32_t sumZ = (source[0].z * firstCount) + (source[last].z * lastCount);
+	uint32_t sumW = (source[0].w * firstCount) + (source[last].w * lastCount);
+
+	for (int64_t k = 1; k <= insideCount; k++)
+	{
+		sumX += source[k].x;
+		sumY += source[k].y;
+		sumZ += source[k].z;
+		sumW += source[k].w;
+	}
+
+	for (int64_t x = 0; x <= last; x++)
+	{
+		destination[x].x = (uint8_t)(((sumX + half) * reciprocal) >> shift);
+		destination[x].y = (uint8_t)(((sumY + half) * reciprocal) >> shift);
+		destination[x].z = (uint8_t)(((sumZ + half) * reciprocal) >> shift);
+		destination[x].w = (uint8_t)(((sumW + half) * reciprocal) >> shift);
+
+		// Slide the window one pixel along.
+		const Vec4& entering = source[std::min(x + radius + 1, last)];
+		const Vec4& leaving = source[std::max(x - radius, (int64_t)0)];
+
+		sumX = sumX + entering.x - leaving.x;
+		sumY = sumY + entering.y - leaving.y;
+		sumZ = sumZ + entering.z - leaving.z;
+		sumW = sumW + entering.w - leaving.w;
+	}
+}
+
+void Effects::BoxBlurColumns(const Vec4* source, Vec4* destination, const size_t width, const size_t height, const int32_t radius, const size_t firstColumn, const size_t lastColumn)
+{
+	int64_t last = (int64_t)height - 1;
+	size_t columnCount = lastColumn - firstColumn;
+	uint32_t boxWidth = (2 * radius) + 1;
+
+	const uint32_t shift = 40;
+	uint64_t reciprocal = (((uint64_t)1 << shift) + boxWidth - 1) / boxWidth;
+	uint32_t half = boxWidth / 2;
+
+	// One running sum per channel per column, interleaved the same way as the pixels.
+	std::vector<uint32_t> sums(columnCount * 4);
+
+	int64_t insideCount = std::min((int64_t)radius, last);
+	uint32_t firstCount = radius + 1;
+	uint32_t lastCount = (uint32_t)(radius - insideCount);
+
+	const Vec4* firstRow = source + firstColumn;
+	const Vec4* lastRow = source + (last * width) + firstColumn;
+	for (size_t j = 0; j < columnCount; j++)
+	{
+		sums[(j * 4) + 0] = (firstRow[j].x * firstCount) + (lastRow[j].x * lastCount);
+		sums[(j * 4) + 1] = (firstRow[j].y * firstCount) + (lastRow[j].y * lastCount);
+		sums[(j * 4) + 2] = (firstRow[j].z * firstCount) + (lastRow[j].z * lastCount);
+		sums[(j * 4) + 3] = (firstRow[j].w * firstCount) + (lastRow[j].w * lastCount);
+	}
+
+	for (int64_t k = 1; k <= insideCount; k++)
+	{
+		const Vec4* row = source + (k * width) + firstColumn;
+		for (size_t j = 0; j < columnCount; j++)
+		{
+			sums[(j * 4) + 0] += row[j].x;
+			sums[(j * 4) + 1] += row[j].y;
+			sums[(j * 4) + 2] += row[j].z;
+			sums[(j * 4) + 3] += row[j].w;
+		}
+	}
+
+	for (int64_t i = 0; i <= last; i++)
+	{
+		Vec4* outputRow = destination + (i * width) + firstColumn;
+		const Vec4* enteringRow = source + (std::min(i + radius + 1, last) * width) + firstColumn;
+		const Vec4* leavingRow = source + (std::max(i - radius, (int64_t)0) * width) + firstColumn;
+
+		for (size_t j = 0; j < columnCount; j++)
+		{
+			uint32_t* sum = &sums[j * 4];
+
+			outputRow[j].x = (uint8_t)(((sum[0] + half) * reciprocal) >> shift);
+			outputRow[j].y = (uint8_t)(((sum[1] + half) * reciprocal) >> shift);
+			outputRow[j].z = (uint8_t)(((sum[2] + half) * reciprocal) >> shift);
+			outputRow[j].w = (uint8_t)(((sum[3] + half) * reciprocal) >> shift);
+
+			// Slide the window one row down.
+			sum[0] = sum[0] + enteringRow[j].x - leavingRow[j].x;
+			sum[1] = sum[1] + enteringRow[j].y - leavingRow[j].y;
+			sum[2] = sum[2] + enteringRow[j].z - leavingRow[j].z;
+			sum[3] = sum[3] + enteringRow[j].w - leavingRow[j].w;
+		}
+	}
 }
 
-std::vector<float> Effects::Get1DMatrix(const int32_t radius, const float sigma)
+int64_t Effects::GetBoundarySample(const int64_t index, const int64_t length, const EffectOptions::EBoundaryMode boundary)
 {
-	// Kernel width is a function of the radius passed in.
-	// But we always want a width of at least 3, and width should be odd so there is always a center pixel.
-	size_t kernelWidth = std::max(((2 * radius) + 1), 3);
+	if (index >= 0 && index < length)
+	{
+		return index;
+	}
+
+	switch (boundary)
+	{
+	case EffectOptions::EBoundaryMode::Mirror:
+	{
+		// Reflections repeat every 2 * (length - 1) samples, which also covers radii longer than the row.
+		if (length == 1)
+		{
+			return 0;
+		}
+
+		int64_t period = 2 * (length - 1);
+		int64_t position = ((index % period) + period) % period;
+		return position < length ? position : period - position;
+	}
+	case EffectOptions::EBoundaryMode::Wrap:
+		return ((index % length) + length) % length;
+	case EffectOptions::EBoundaryMode::Zero:
+		return -1;
+	case EffectOptions::EBoundaryMode::Clamp:
+	default:
+		return std::clamp(index, (int64_t)0, length - 1);
+	}
+}
+
+void Effects::BlurRowHorizontal(const Vec4* source, Vec4* destination, const size_t width, const int32_t radius, const EffectOptions::EBoundaryMode boundary, const SpanConvolver& convolve, std::vector<Vec4>& scanline, std::vector<const Vec4*>& taps)
+{
+	scanline.resize(width + (2 * (size_t)radius));
+	Vec4* scanlineStart = scanline.data() + radius;
+	std::copy(source, source + width, scanlineStart);
+
+	for (int32_t k = 0; k < radius; k++)
+	{
+		int64_t before = Effects::GetBoundarySample((int64_t)k - radius, (int64_t)width, boundary);
+		int64_t after = Effects::GetBoundarySample((int64_t)width + k, (int64_t)width, boundary);
 
-	// Calculate Gaussian values for the kernel matrix.
-	std::vector<float> kernel(kernelWidth);
-	float sum = 0.0f;
-	for (int32_t i = -radius; i <= radius; i++)
+		scanline[k] = before < 0 ? Vec4() : source[before];
+		scanlineStart[width + k] = after < 0 ? Vec4() : source[after];
+	}
+
+	taps.resize((2 * (size_t)radius) + 1);
+	for (size_t k = 0; k < taps.size(); k++)
 	{
-		float exponentNumerator = (float)(i * i);
-		float exponentDenominator = 2.0f * (sigma * sigma);
+		taps[k] = scanline.data() + k;
+	}
+
+	convolve(taps.data(), destination, width);
+}
+
+void Effects::BlurColumnsVertical(const Vec4* source, Vec4* destination, const size_t width, const size_t height, const int32_t radius, const EffectOptions::EBoundaryMode boundary, const SpanConvolver& convolve, const size_t firstColumn, const size_t lastColumn)
+{
+	// Samples outside the image in Zero mode all read from one row of zeros.
+	std::vector<Vec4> zeroRow(boundary == EffectOptions::EBoundaryMode::Zero ? lastColumn - firstColumn : 0);
 
-		float eExpression = exp(-exponentNumerator / exponentDenominator);
-		float kernelValue = eExpression / sqrt(2.0f * (float)M_PI * sigma);
+	auto getRow = [&](int64_t i) -> const Vec4*
+	{
+		int64_t sample = Effects::GetBoundarySample(i, (int64_t)height, boundary);
+		return sample < 0 ? zeroRow.data() : source + (sample * (int64_t)width) + firstColumn;
+	};
 
-		kernel[i + radius] = kernelValue;
-		sum += kernelValue;
+	// The taps are a window of row pointers that slides down one row per output row.
+	std::vector<const Vec4*> taps((2 * radius) + 1);
+	for (int32_t k = 0; k < (int32_t)taps.size(); k++)
+	{
+		taps[k] = getRow((int64_t)k - radius);
 	}
 
-	// Normalize kernel values so they sum to 1.0.
-	for (auto& value : kernel)
+	for (int64_t i = 0; i < (int64_t)height; i++)
 	{
-		value /= sum;
+		convolve(taps.data(), destination + (i * (int64_t)width) + firstColumn, lastColumn - firstColumn);
+
+		std::copy(taps.begin() + 1, taps.end(), taps.begin());
+		taps.back() = getRow(i + radius + 1);
 	}
+}
+
+std::shared_ptr<const std::vector<float>> Effects::Get1DMatrix(const int32_t radius, const float sigma)
+{
+	return floatKernels.Get(radius, sigma, [&]()
+	{
+		int32_t row = GetTableRow(radius, sigma);
+		if (row >= 0)
+		{
+			return std::vector<float>(KERNEL_TABLE.Weights[row].begin(), KERNEL_TABLE.Weights[row].begin() + (2 * row) + 1);
+		}
+
+		// Kernel width is a function of the radius passed in.
+		// But we always want a width of at least 3, and width should be odd so there is always a center pixel.
+		std::vector<float> kernel(std::max(((2 * radius) + 1), 3));
+		ComputeGaussianKernel(radius, sigma, kernel.data());
+		return kernel;
+	});
+}
+
+std::shared_ptr<const std::vector<uint16_t>> Effects::Get1DMatrixFixed(const int32_t radius, const float sigma)
+{
+	return fixedKernels.Get(radius, sigma, [&]()
+	{
+		int32_t row = GetTableRow(radius, sigma);
+		if (row >= 0)
+		{
+			return std::vector<uint16_t>(KERNEL_TABLE.FixedWeights[row].begin(), KERNEL_TABLE.FixedWeights[row].begin() + (2 * row) + 1);
+		}
 
-	return kernel;
+		std::shared_ptr<const std::vector<float>> kernel = Effects::Get1DMatrix(radius, sigma);
+		std::vector<uint16_t> fixedKernel(kernel->size());
+		QuantizeGaussianKernel(kernel->data(), kernel->size(), fixedKernel.data());
+		return fixedKernel;
+	});
 }
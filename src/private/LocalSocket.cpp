@@ -0,0 +1,283 @@
+#include <LocalSocket.h>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <utility>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(_WIN32)
+	using SocketHandle = SOCKET;
+
+	void CloseSocket(const intptr_t handle)
+	{
+		closesocket((SOCKET)handle);
+	}
+
+	/**
+	 * Start Winsock the first time a socket is opened. It is left running until the process exits.
+	 */
+	bool StartSockets()
+	{
+		static const bool started = []()
+		{
+			WSADATA data = {};
+			return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		}();
+
+		return started;
+	}
+#else
+	using SocketHandle = int;
+
+	void CloseSocket(const intptr_t handle)
+	{
+		close((int)handle);
+	}
+
+	bool StartSockets()
+	{
+		return true;
+	}
+#endif
+
+	/**
+	 * Open an unbound local stream socket and fill in the address of a path.
+	 * @return The handle, or -1 if the socket could not be opened or the path is too long for the address.
+	 */
+	intptr_t OpenSocket(const std::string& path, sockaddr_un& address)
+	{
+		address = {};
+		address.sun_family = AF_UNIX;
+
+		if (!StartSockets() || path.empty() || path.size() >= sizeof(address.sun_path))
+		{
+			return -1;
+		}
+
+		std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+		SocketHandle handle = socket(AF_UNIX, SOCK_STREAM, 0);
+		return (intptr_t)handle;
+	}
+}
+
+LocalSocket::~LocalSocket()
+{
+	this->Close();
+}
+
+LocalSocket::LocalSocket(LocalSocket&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+LocalSocket& LocalSocket::operator=(LocalSocket&& other) noexcept
+{
+	if (this != &other)
+	{
+		this->Close();
+
+		this->handle = other.handle;
+		this->listenPath = std::move(other.listenPath);
+		this->received = std::move(other.received);
+
+		other.handle = -1;
+		other.listenPath.clear();
+		other.received.clear();
+	}
+
+	return *this;
+}
+
+bool LocalSocket::Listen(const std::string& path)
+{
+	this->Close();
+
+	sockaddr_un address;
+	intptr_t socketHandle = OpenSocket(path, address);
+	if (socketHandle == -1)
+	{
+		return false;
+	}
+
+	// Binding fails if the file exists, even when nothing is listening on it any more. Only a socket that no server answers
+	// on is removed, so a running server keeps its path and an unrelated file is never deleted.
+	std::error_code error;
+	std::filesystem::file_status status = std::filesystem::symlink_status(path, error);
+
+	if (std::filesystem::exists(status))
+	{
+#if defined(_WIN32)
+		// Windows reports a socket file as a reparse point of unknown type rather than as a socket.
+		bool isSocket = status.type() == std::filesystem::file_type::unknown || status.type() == std::filesystem::file_type::other;
+#else
+		bool isSocket = status.type() == std::filesystem::file_type::socket;
+#endif
+
+		LocalSocket probe;
+		if (!isSocket || probe.Connect(path))
+		{
+			CloseSocket(socketHandle);
+			return false;
+		}
+
+		std::filesystem::remove(path, error);
+	}
+
+#if defined(_WIN32)
+	bool bound = bind((SocketHandle)socketHandle, (const sockaddr*)&address, sizeof(address)) == 0;
+#else
+	// Whoever can connect can have the server read and write any file it can, so the socket file is created with
+	// access for its owner only. The mask is set around the bind, as changing the mode afterwards leaves a window open.
+	mode_t previousMask = umask(0077);
+	bool bound = bind((SocketHandle)socketHandle, (const sockaddr*)&address, sizeof(address)) == 0;
+	umask(previousMask);
+#endif
+
+	if (!bound || listen((SocketHandle)socketHandle, SOMAXCONN) != 0)
+	{
+		CloseSocket(socketHandle);
+		return false;
+	}
+
+	this->handle = socketHandle;
+	this->listenPath = path;
+	return true;
+}
+
+LocalSocket LocalSocket::Accept()
+{
+	LocalSocket client;
+
+	if (this->handle != -1)
+	{
+		SocketHandle clientHandle = accept((SocketHandle)this->handle, nullptr, nullptr);
+		client.handle = (intptr_t)clientHandle;
+	}
+
+	return client;
+}
+
+bool LocalSocket::Connect(const std::string& path)
+{
+	this->Close();
+
+	sockaddr_un address;
+	intptr_t socketHandle = OpenSocket(path, address);
+	if (socketHandle == -1)
+	{
+		return false;
+	}
+
+	if (connect((SocketHandle)socketHandle, (const sockaddr*)&address, sizeof(address)) != 0)
+	{
+		CloseSocket(socketHandle);
+		return false;
+	}
+
+	this->handle = socketHandle;
+	return true;
+}
+
+void LocalSocket::Close()
+{
+	if (this->handle == -1)
+	{
+		return;
+	}
+
+	CloseSocket(this->handle);
+
+	if (!this->listenPath.empty())
+	{
+		std::remove(this->listenPath.c_str());
+	}
+
+	this->handle = -1;
+	this->listenPath.clear();
+	this->received.clear();
+}
+
+bool LocalSocket::IsOpen() const
+{
+	return this->handle != -1;
+}
+
+bool LocalSocket::ReadLine(std::string& line)
+{
+	// Lines are short, so bytes are received a block at a time and anything past the newline is kept for the next call.
+	size_t end = this->received.find('\n');
+	while (end == std::string::npos)
+	{
+		if (this->handle == -1)
+		{
+			return false;
+		}
+
+		char buffer[4096];
+		int count = (int)recv((SocketHandle)this->handle, buffer, (int)sizeof(buffer), 0);
+		if (count <= 0)
+		{
+			return false;
+		}
+
+		size_t searchStart = this->received.size();
+		this->received.append(buffer, (size_t)count);
+		end = this->received.find('\n', searchStart);
+	}
+
+	line.assign(this->received, 0, end);
+	this->received.erase(0, end + 1);
+
+	if (!line.empty() && line.back() == '\r')
+	{
+		line.pop_back();
+	}
+
+	return true;
+}
+
+bool LocalSocket::WriteLine(const std::string& line)
+{
+	if (this->handle == -1)
+	{
+		return false;
+	}
+
+	std::string data = line + '\n';
+
+	// A client that hangs up must not end the whole process with SIGPIPE, so ask for an error instead where possible.
+#if defined(MSG_NOSIGNAL)
+	const int flags = MSG_NOSIGNAL;
+#else
+	const int flags = 0;
+#endif
+
+	size_t sent = 0;
+	while (sent < data.size())
+	{
+		int count = (int)send((SocketHandle)this->handle, data.data() + sent, (int)(data.size() - sent), flags);
+		if (count <= 0)
+		{
+			return false;
+		}
+
+		sent += (size_t)count;
+	}
+
+	return true;
+}
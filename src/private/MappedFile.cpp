@@ -0,0 +1,108 @@
+#include <MappedFile.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	this->Close();
+}
+
+bool MappedFile::Open(const std::string& filename)
+{
+	this->Close();
+
+	// Once the view exists it keeps the file open itself, so the handles are released straight away on both platforms.
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize = {};
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+
+	if (mapping == nullptr)
+	{
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+
+	if (view == nullptr)
+	{
+		return false;
+	}
+
+	this->data = (const uint8_t*)view;
+	this->size = (size_t)fileSize.QuadPart;
+#else
+	int file = open(filename.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStatus = {};
+	if (fstat(file, &fileStatus) != 0 || fileStatus.st_size <= 0)
+	{
+		close(file);
+		return false;
+	}
+
+	void* view = mmap(nullptr, (size_t)fileStatus.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+
+	if (view == MAP_FAILED)
+	{
+		return false;
+	}
+
+	// Images are read front to back, so ask for aggressive read-ahead.
+	madvise(view, (size_t)fileStatus.st_size, MADV_SEQUENTIAL);
+
+	this->data = (const uint8_t*)view;
+	this->size = (size_t)fileStatus.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (this->data == nullptr)
+	{
+		return;
+	}
+
+#if defined(_WIN32)
+	UnmapViewOfFile(this->data);
+#else
+	munmap((void*)this->data, this->size);
+#endif
+
+	this->data = nullptr;
+	this->size = 0;
+}
+
+std::span<const uint8_t> MappedFile::GetData() const
+{
+	return std::span<const uint8_t>(this->data, this->size);
+}
@@ -0,0 +1,104 @@
+#include <PixelPool.h>
+#include <algorithm>
+#include <bit>
+#include <new>
+
+void PixelPool::Deleter::operator()(Vec4* pixels) const
+{
+	this->Pool->Release(pixels, this->Capacity);
+}
+
+PixelPool::PixelPool(const uintmax_t retainLimit) : retainLimit(retainLimit)
+{
+}
+
+PixelPool::~PixelPool()
+{
+	this->Trim();
+}
+
+PixelPool& PixelPool::GetShared()
+{
+	// Never destroyed, as detached threads may still release buffers while the process exits.
+	static PixelPool* pool = new PixelPool();
+	return *pool;
+}
+
+PixelPool::Buffer PixelPool::Allocate(const size_t count)
+{
+	size_t capacity = PixelPool::GetCapacity(std::max(count, (size_t)1) * sizeof(Vec4));
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->statistics.Requests++;
+
+		// The smallest kept buffer that fits is reused, unless it is more than twice the size needed.
+		auto buffer = this->retained.lower_bound(capacity);
+		if (buffer != this->retained.end() && buffer->first / 2 <= capacity)
+		{
+			Deleter deleter = { this, buffer->first };
+			Vec4* pixels = buffer->second;
+			this->retained.erase(buffer);
+
+			this->statistics.Reuses++;
+			this->statistics.RetainedBytes -= deleter.Capacity;
+			this->statistics.InUseBytes += deleter.Capacity;
+			return Buffer(pixels, deleter);
+		}
+	}
+
+	Vec4* pixels = (Vec4*)::operator new(capacity, std::align_val_t(ALIGNMENT));
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->statistics.AllocatedBytes += capacity;
+	this->statistics.InUseBytes += capacity;
+	this->statistics.PeakBytes = std::max(this->statistics.PeakBytes, this->statistics.InUseBytes + this->statistics.RetainedBytes);
+	return Buffer(pixels, { this, capacity });
+}
+
+void PixelPool::Trim()
+{
+	std::multimap<size_t, Vec4*> freed;
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		freed.swap(this->retained);
+		this->statistics.RetainedBytes = 0;
+	}
+
+	for (const auto& [capacity, pixels] : freed)
+	{
+		::operator delete(pixels, std::align_val_t(ALIGNMENT));
+	}
+}
+
+PixelPool::Statistics PixelPool::GetStatistics() const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->statistics;
+}
+
+size_t PixelPool::GetCapacity(const size_t bytes)
+{
+	// Small buffers are rounded up to whole aligned blocks. Larger ones are rounded up to an eighth of the power of two
+	// below them, so at most an eighth is wasted and images of nearly the same size share buffers.
+	size_t step = std::max(std::bit_floor(bytes) / 8, ALIGNMENT);
+	return ((bytes + step - 1) / step) * step;
+}
+
+void PixelPool::Release(Vec4* pixels, const size_t capacity)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->statistics.InUseBytes -= capacity;
+
+		if (this->statistics.RetainedBytes + capacity <= this->retainLimit)
+		{
+			this->retained.emplace(capacity, pixels);
+			this->statistics.RetainedBytes += capacity;
+			return;
+		}
+	}
+
+	::operator delete(pixels, std::align_val_t(ALIGNMENT));
+}
@@ -0,0 +1,497 @@
+#include <PixelSwizzle.h>
+#include <BlurKernels.h>
+#include <SimdTarget.h>
+#include <bit>
+#include <cstring>
+
+void PixelSwizzle::BgrToVec4(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	if (PixelSwizzle::UseVectorSwizzle())
+	{
+		PixelSwizzle::BgrToVec4SSE41(source, destination, count);
+		return;
+	}
+
+	PixelSwizzle::BgrToVec4Scalar(source, destination, count);
+}
+
+void PixelSwizzle::BgraToVec4(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	if (PixelSwizzle::UseVectorSwizzle())
+	{
+		PixelSwizzle::BgraToVec4SSE41(source, destination, count);
+		return;
+	}
+
+	PixelSwizzle::BgraToVec4Scalar(source, destination, count);
+}
+
+void PixelSwizzle::GrayToVec4(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	if (PixelSwizzle::UseVectorSwizzle())
+	{
+		PixelSwizzle::GrayToVec4SSE41(source, destination, count);
+		return;
+	}
+
+	PixelSwizzle::GrayToVec4Scalar(source, destination, count);
+}
+
+void PixelSwizzle::GrayAlphaToVec4(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	if (PixelSwizzle::UseVectorSwizzle())
+	{
+		PixelSwizzle::GrayAlphaToVec4SSE41(source, destination, count);
+		return;
+	}
+
+	PixelSwizzle::GrayAlphaToVec4Scalar(source, destination, count);
+}
+
+void PixelSwizzle::Vec4ToBgr(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	if (PixelSwizzle::UseVectorSwizzle())
+	{
+		PixelSwizzle::Vec4ToBgrSSE41(source, destination, count);
+		return;
+	}
+
+	PixelSwizzle::Vec4ToBgrScalar(source, destination, count);
+}
+
+void PixelSwizzle::Vec4ToBgra(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	// Swapping x and z is its own inverse.
+	PixelSwizzle::BgraToVec4((const uint8_t*)source, (Vec4*)destination, count);
+}
+
+void PixelSwizzle::Vec4ToGray(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	if (PixelSwizzle::UseVectorSwizzle())
+	{
+		PixelSwizzle::Vec4ToGraySSE41(source, destination, count);
+		return;
+	}
+
+	PixelSwizzle::Vec4ToGrayScalar(source, destination, count);
+}
+
+void PixelSwizzle::Vec4ToGrayAlpha(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	if (PixelSwizzle::UseVectorSwizzle())
+	{
+		PixelSwizzle::Vec4ToGrayAlphaSSE41(source, destination, count);
+		return;
+	}
+
+	PixelSwizzle::Vec4ToGrayAlphaScalar(source, destination, count);
+}
+
+void PixelSwizzle::Fill(Vec4* destination, const Vec4 value, const size_t count)
+{
+	// Most runs are short, where a call to the vector fill would cost more than it saves.
+	if (count < 8 || !PixelSwizzle::UseVectorSwizzle())
+	{
+		PixelSwizzle::FillScalar(destination, value, count);
+		return;
+	}
+
+	PixelSwizzle::FillSSE41(destination, value, count);
+}
+
+size_t PixelSwizzle::CountRepeats(const Vec4* pixels, const size_t count, const Vec4 channelMask)
+{
+	if (PixelSwizzle::UseVectorSwizzle())
+	{
+		return PixelSwizzle::CountRepeatsSSE41(pixels, count, channelMask);
+	}
+
+	return PixelSwizzle::CountRepeatsScalar(pixels, count, channelMask);
+}
+
+size_t PixelSwizzle::CountUntilRepeat(const Vec4* pixels, const size_t count, const Vec4 channelMask)
+{
+	if (PixelSwizzle::UseVectorSwizzle())
+	{
+		return PixelSwizzle::CountUntilRepeatSSE41(pixels, count, channelMask);
+	}
+
+	return PixelSwizzle::CountUntilRepeatScalar(pixels, count, channelMask);
+}
+
+bool PixelSwizzle::UseVectorSwizzle()
+{
+	// The byte shuffle is SSSE3, which every SSE4.1 CPU has.
+	static const bool useVector = SIMD_X86 && BlurKernels::GetSupportedInstructionSet() >= BlurKernels::EInstructionSet::SSE41;
+	return useVector;
+}
+
+void PixelSwizzle::BgrToVec4Scalar(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		destination[i].x = source[(i * 3) + 2];
+		destination[i].y = source[(i * 3) + 1];
+		destination[i].z = source[i * 3];
+		destination[i].w = 0;
+	}
+}
+
+void PixelSwizzle::BgraToVec4Scalar(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	// Read the whole pixel before writing it, so the conversion also works in place.
+	for (size_t i = 0; i < count; i++)
+	{
+		Vec4 pixel = { source[(i * 4) + 2], source[(i * 4) + 1], source[i * 4], source[(i * 4) + 3] };
+		destination[i] = pixel;
+	}
+}
+
+void PixelSwizzle::GrayToVec4Scalar(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		destination[i] = { source[i], 0, 0, 0 };
+	}
+}
+
+void PixelSwizzle::GrayAlphaToVec4Scalar(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		destination[i] = { source[i * 2], 0, 0, source[(i * 2) + 1] };
+	}
+}
+
+void PixelSwizzle::Vec4ToBgrScalar(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		destination[i * 3] = source[i].z;
+		destination[(i * 3) + 1] = source[i].y;
+		destination[(i * 3) + 2] = source[i].x;
+	}
+}
+
+void PixelSwizzle::Vec4ToGrayScalar(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		destination[i] = source[i].x;
+	}
+}
+
+void PixelSwizzle::Vec4ToGrayAlphaScalar(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		destination[i * 2] = source[i].x;
+		destination[(i * 2) + 1] = source[i].w;
+	}
+}
+
+void PixelSwizzle::FillScalar(Vec4* destination, const Vec4 value, const size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		destination[i] = value;
+	}
+}
+
+size_t PixelSwizzle::CountRepeatsScalar(const Vec4* pixels, const size_t count, const Vec4 channelMask)
+{
+	uint32_t mask = 0;
+	std::memcpy(&mask, &channelMask, sizeof(mask));
+
+	uint32_t first = 0;
+	std::memcpy(&first, &pixels[0], sizeof(first));
+
+	size_t i = 1;
+	for (; i < count; i++)
+	{
+		uint32_t pixel = 0;
+		std::memcpy(&pixel, &pixels[i], sizeof(pixel));
+
+		if (((pixel ^ first) & mask) != 0)
+		{
+			break;
+		}
+	}
+
+	return i;
+}
+
+size_t PixelSwizzle::CountUntilRepeatScalar(const Vec4* pixels, const size_t count, const Vec4 channelMask)
+{
+	uint32_t mask = 0;
+	std::memcpy(&mask, &channelMask, sizeof(mask));
+
+	size_t i = 1;
+	for (; i + 1 < count; i++)
+	{
+		uint32_t pixel = 0;
+		uint32_t next = 0;
+		std::memcpy(&pixel, &pixels[i], sizeof(pixel));
+		std::memcpy(&next, &pixels[i + 1], sizeof(next));
+
+		if (((pixel ^ next) & mask) == 0)
+		{
+			return i;
+		}
+	}
+
+	return count;
+}
+
+#if SIMD_X86
+
+SIMD_TARGET_SSE41 void PixelSwizzle::BgrToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	// Four 3 byte pixels per shuffle, a mask byte with the top bit set writes zero.
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+
+	// Each 16 byte load covers 12 bytes of pixels, so stop while at least 16 bytes remain to read.
+	size_t i = 0;
+	for (; i + 6 <= count; i += 4)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(source + (i * 3)));
+		_mm_storeu_si128((__m128i*)(destination + i), _mm_shuffle_epi8(pixels, shuffle));
+	}
+
+	PixelSwizzle::BgrToVec4Scalar(source + (i * 3), destination + i, count - i);
+}
+
+SIMD_TARGET_SSE41 void PixelSwizzle::BgraToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(source + (i * 4)));
+		_mm_storeu_si128((__m128i*)(destination + i), _mm_shuffle_epi8(pixels, shuffle));
+	}
+
+	PixelSwizzle::BgraToVec4Scalar(source + (i * 4), destination + i, count - i);
+}
+
+SIMD_TARGET_SSE41 void PixelSwizzle::GrayToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	// Sixteen pixels per load, widened to four vectors of Vec4.
+	const __m128i shuffle0 = _mm_setr_epi8(0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3, -1, -1, -1);
+	const __m128i shuffle1 = _mm_setr_epi8(4, -1, -1, -1, 5, -1, -1, -1, 6, -1, -1, -1, 7, -1, -1, -1);
+	const __m128i shuffle2 = _mm_setr_epi8(8, -1, -1, -1, 9, -1, -1, -1, 10, -1, -1, -1, 11, -1, -1, -1);
+	const __m128i shuffle3 = _mm_setr_epi8(12, -1, -1, -1, 13, -1, -1, -1, 14, -1, -1, -1, 15, -1, -1, -1);
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(source + i));
+		_mm_storeu_si128((__m128i*)(destination + i), _mm_shuffle_epi8(pixels, shuffle0));
+		_mm_storeu_si128((__m128i*)(destination + i + 4), _mm_shuffle_epi8(pixels, shuffle1));
+		_mm_storeu_si128((__m128i*)(destination + i + 8), _mm_shuffle_epi8(pixels, shuffle2));
+		_mm_storeu_si128((__m128i*)(destination + i + 12), _mm_shuffle_epi8(pixels, shuffle3));
+	}
+
+	PixelSwizzle::GrayToVec4Scalar(source + i, destination + i, count - i);
+}
+
+SIMD_TARGET_SSE41 void PixelSwizzle::GrayAlphaToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	// Eight pixels per load, widened to two vectors of Vec4.
+	const __m128i shuffle0 = _mm_setr_epi8(0, -1, -1, 1, 2, -1, -1, 3, 4, -1, -1, 5, 6, -1, -1, 7);
+	const __m128i shuffle1 = _mm_setr_epi8(8, -1, -1, 9, 10, -1, -1, 11, 12, -1, -1, 13, 14, -1, -1, 15);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(source + (i * 2)));
+		_mm_storeu_si128((__m128i*)(destination + i), _mm_shuffle_epi8(pixels, shuffle0));
+		_mm_storeu_si128((__m128i*)(destination + i + 4), _mm_shuffle_epi8(pixels, shuffle1));
+	}
+
+	PixelSwizzle::GrayAlphaToVec4Scalar(source + (i * 2), destination + i, count - i);
+}
+
+SIMD_TARGET_SSE41 void PixelSwizzle::Vec4ToBgrSSE41(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	// Four pixels pack into the low 12 bytes, which are stored as 8 bytes and then 4.
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i pixels = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + i)), shuffle);
+		_mm_storel_epi64((__m128i*)(destination + (i * 3)), pixels);
+		int32_t last = _mm_extract_epi32(pixels, 2);
+		std::memcpy(destination + (i * 3) + 8, &last, sizeof(last));
+	}
+
+	PixelSwizzle::Vec4ToBgrScalar(source + i, destination + (i * 3), count - i);
+}
+
+SIMD_TARGET_SSE41 void PixelSwizzle::Vec4ToGraySSE41(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	// Sixteen pixels per store, each shuffle moves the x bytes of four pixels into its own quarter of the result.
+	const __m128i shuffle0 = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i shuffle1 = _mm_setr_epi8(-1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i shuffle2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1);
+	const __m128i shuffle3 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12);
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i gray = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + i)), shuffle0);
+		gray = _mm_or_si128(gray, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + i + 4)), shuffle1));
+		gray = _mm_or_si128(gray, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + i + 8)), shuffle2));
+		gray = _mm_or_si128(gray, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + i + 12)), shuffle3));
+		_mm_storeu_si128((__m128i*)(destination + i), gray);
+	}
+
+	PixelSwizzle::Vec4ToGrayScalar(source + i, destination + i, count - i);
+}
+
+SIMD_TARGET_SSE41 void PixelSwizzle::Vec4ToGrayAlphaSSE41(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	// Eight pixels per store, each shuffle moves the x and w bytes of four pixels into its own half of the result.
+	const __m128i shuffle0 = _mm_setr_epi8(0, 3, 4, 7, 8, 11, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i shuffle1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 4, 7, 8, 11, 12, 15);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i grayAlpha = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + i)), shuffle0);
+		grayAlpha = _mm_or_si128(grayAlpha, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + i + 4)), shuffle1));
+		_mm_storeu_si128((__m128i*)(destination + (i * 2)), grayAlpha);
+	}
+
+	PixelSwizzle::Vec4ToGrayAlphaScalar(source + i, destination + (i * 2), count - i);
+}
+
+SIMD_TARGET_SSE41 void PixelSwizzle::FillSSE41(Vec4* destination, const Vec4 value, const size_t count)
+{
+	int32_t packedValue = 0;
+	std::memcpy(&packedValue, &value, sizeof(packedValue));
+	const __m128i pixels = _mm_set1_epi32(packedValue);
+
+	// Sixteen pixels per iteration, then four, then one at a time.
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		_mm_storeu_si128((__m128i*)(destination + i), pixels);
+		_mm_storeu_si128((__m128i*)(destination + i + 4), pixels);
+		_mm_storeu_si128((__m128i*)(destination + i + 8), pixels);
+		_mm_storeu_si128((__m128i*)(destination + i + 12), pixels);
+	}
+
+	for (; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_si128((__m128i*)(destination + i), pixels);
+	}
+
+	PixelSwizzle::FillScalar(destination + i, value, count - i);
+}
+
+SIMD_TARGET_SSE41 size_t PixelSwizzle::CountRepeatsSSE41(const Vec4* pixels, const size_t count, const Vec4 channelMask)
+{
+	int32_t packedMask = 0;
+	int32_t packedFirst = 0;
+	std::memcpy(&packedMask, &channelMask, sizeof(packedMask));
+	std::memcpy(&packedFirst, &pixels[0], sizeof(packedFirst));
+
+	const __m128i mask = _mm_set1_epi32(packedMask);
+	const __m128i first = _mm_and_si128(_mm_set1_epi32(packedFirst), mask);
+
+	// Compare four pixels at a time against the first, the first mismatch ends the run.
+	size_t i = 1;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i block = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pixels + i)), mask);
+		int matches = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, first)));
+
+		if (matches != 0xF)
+		{
+			// The lowest clear bit is the first pixel that differs.
+			return i + std::countr_one((unsigned int)matches);
+		}
+	}
+
+	return i + PixelSwizzle::CountRepeatsScalar(pixels + i - 1, count - i + 1, channelMask) - 1;
+}
+
+SIMD_TARGET_SSE41 size_t PixelSwizzle::CountUntilRepeatSSE41(const Vec4* pixels, const size_t count, const Vec4 channelMask)
+{
+	int32_t packedMask = 0;
+	std::memcpy(&packedMask, &channelMask, sizeof(packedMask));
+	const __m128i mask = _mm_set1_epi32(packedMask);
+
+	// Compare four pixels at a time against the pixel after each, the first match starts the next run.
+	size_t i = 1;
+	for (; i + 5 <= count; i += 4)
+	{
+		__m128i block = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pixels + i)), mask);
+		__m128i next = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pixels + i + 1)), mask);
+		int matches = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, next)));
+
+		if (matches != 0)
+		{
+			return i + std::countr_zero((unsigned int)matches);
+		}
+	}
+
+	return i + PixelSwizzle::CountUntilRepeatScalar(pixels + i - 1, count - i + 1, channelMask) - 1;
+}
+
+#else
+
+void PixelSwizzle::BgrToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	PixelSwizzle::BgrToVec4Scalar(source, destination, count);
+}
+
+void PixelSwizzle::BgraToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	PixelSwizzle::BgraToVec4Scalar(source, destination, count);
+}
+
+void PixelSwizzle::GrayToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	PixelSwizzle::GrayToVec4Scalar(source, destination, count);
+}
+
+void PixelSwizzle::GrayAlphaToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count)
+{
+	PixelSwizzle::GrayAlphaToVec4Scalar(source, destination, count);
+}
+
+void PixelSwizzle::Vec4ToBgrSSE41(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	PixelSwizzle::Vec4ToBgrScalar(source, destination, count);
+}
+
+void PixelSwizzle::Vec4ToGraySSE41(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	PixelSwizzle::Vec4ToGrayScalar(source, destination, count);
+}
+
+void PixelSwizzle::Vec4ToGrayAlphaSSE41(const Vec4* source, uint8_t* destination, const size_t count)
+{
+	PixelSwizzle::Vec4ToGrayAlphaScalar(source, destination, count);
+}
+
+void PixelSwizzle::FillSSE41(Vec4* destination, const Vec4 value, const size_t count)
+{
+	PixelSwizzle::FillScalar(destination, value, count);
+}
+
+size_t PixelSwizzle::CountRepeatsSSE41(const Vec4* pixels, const size_t count, const Vec4 channelMask)
+{
+	return PixelSwizzle::CountRepeatsScalar(pixels, count, channelMask);
+}
+
+size_t PixelSwizzle::CountUntilRepeatSSE41(const Vec4* pixels, const size_t count, const Vec4 channelMask)
+{
+	return PixelSwizzle::CountUntilRepeatScalar(pixels, count, channelMask);
+}
+
+#endif
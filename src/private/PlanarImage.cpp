@@ -0,0 +1,123 @@
+#include <PlanarImage.h>
+#include <algorithm>
+
+PlanarImage::PlanarImage(const size_t width, const size_t height, const size_t channelCount)
+{
+	this->width = width;
+	this->height = height;
+	this->channelCount = std::clamp(channelCount, (size_t)1, MAX_CHANNELS);
+
+	// Round each row up to a whole number of aligned blocks, which keeps every row and every plane aligned.
+	this->stride = std::max(((width + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT, ALIGNMENT);
+
+	// The stride is a whole number of pixels, and the pool aligns every buffer to ALIGNMENT.
+	size_t pixelCount = (this->stride * height * this->channelCount) / sizeof(Vec4);
+	this->data = PixelPool::GetShared().Allocate(pixelCount);
+	std::fill(this->data.get(), this->data.get() + pixelCount, Vec4{});
+}
+
+PlanarImage PlanarImage::FromInterleaved(const Vec4* pixels, const size_t width, const size_t height, const size_t channelCount)
+{
+	PlanarImage image(width, height, channelCount);
+
+	for (size_t c = 0; c < image.channelCount; c++)
+	{
+		uint8_t Vec4::* member = PlanarImage::GetInterleavedChannel(image.channelCount, c);
+
+		for (size_t i = 0; i < height; i++)
+		{
+			const Vec4* source = pixels + (i * width);
+			uint8_t* destination = image.GetRow(c, i);
+
+			for (size_t j = 0; j < width; j++)
+			{
+				destination[j] = source[j].*member;
+			}
+		}
+	}
+
+	return image;
+}
+
+PixelPool::Buffer PlanarImage::ToInterleaved() const
+{
+	PixelPool::Buffer pixels = PixelPool::GetShared().Allocate(this->width * this->height);
+
+	// The buffer is uninitialized, so the channels the image does not have are cleared first.
+	if (this->channelCount < MAX_CHANNELS)
+	{
+		std::fill(pixels.get(), pixels.get() + (this->width * this->height), Vec4{});
+	}
+
+	for (size_t c = 0; c < this->channelCount; c++)
+	{
+		uint8_t Vec4::* member = PlanarImage::GetInterleavedChannel(this->channelCount, c);
+
+		for (size_t i = 0; i < this->height; i++)
+		{
+			const uint8_t* source = this->GetRow(c, i);
+			Vec4* destination = pixels.get() + (i * this->width);
+
+			for (size_t j = 0; j < this->width; j++)
+			{
+				destination[j].*member = source[j];
+			}
+		}
+	}
+
+	return pixels;
+}
+
+size_t PlanarImage::GetWidth() const
+{
+	return this->width;
+}
+
+size_t PlanarImage::GetHeight() const
+{
+	return this->height;
+}
+
+size_t PlanarImage::GetChannelCount() const
+{
+	return this->channelCount;
+}
+
+size_t PlanarImage::GetStride() const
+{
+	return this->stride;
+}
+
+uint8_t* PlanarImage::GetRow(const size_t channel, const size_t row)
+{
+	return (uint8_t*)this->data.get() + (((channel * this->height) + row) * this->stride);
+}
+
+const uint8_t* PlanarImage::GetRow(const size_t channel, const size_t row) const
+{
+	return (const uint8_t*)this->data.get() + (((channel * this->height) + row) * this->stride);
+}
+
+uint8_t Vec4::* PlanarImage::GetInterleavedChannel(const size_t channelCount, const size_t channel)
+{
+	// Gray with alpha keeps its alpha in w, the same as every other image with alpha.
+	if (channelCount == 2 && channel == 1)
+	{
+		return &Vec4::w;
+	}
+
+	switch (channel)
+	{
+	case 0:
+		return &Vec4::x;
+
+	case 1:
+		return &Vec4::y;
+
+	case 2:
+		return &Vec4::z;
+
+	default:
+		return &Vec4::w;
+	}
+}
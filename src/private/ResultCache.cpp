@@ -0,0 +1,296 @@
+#include <ResultCache.h>
+#include <MappedFile.h>
+#include <TemporaryPath.h>
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+	/** The primes of XXH64. */
+	constexpr uint64_t PRIME_1 = 0x9E3779B185EBCA87ull;
+	constexpr uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4Full;
+	constexpr uint64_t PRIME_3 = 0x165667B19E3779F9ull;
+	constexpr uint64_t PRIME_4 = 0x85EBCA77C2B2AE63ull;
+	constexpr uint64_t PRIME_5 = 0x27D4EB2F165667C5ull;
+
+	/** The extension of stored files, which are kept as TGA files so they can be opened directly. */
+	constexpr const char* ENTRY_EXTENSION = ".tga";
+
+	uint64_t Read64(const uint8_t* bytes)
+	{
+		uint64_t value;
+		std::memcpy(&value, bytes, sizeof(value));
+		return value;
+	}
+
+	uint32_t Read32(const uint8_t* bytes)
+	{
+		uint32_t value;
+		std::memcpy(&value, bytes, sizeof(value));
+		return value;
+	}
+
+	uint64_t Round(uint64_t accumulator, const uint64_t input)
+	{
+		accumulator += input * PRIME_2;
+		accumulator = std::rotl(accumulator, 31);
+		return accumulator * PRIME_1;
+	}
+
+	uint64_t MergeRound(uint64_t accumulator, const uint64_t value)
+	{
+		accumulator ^= Round(0, value);
+		return (accumulator * PRIME_1) + PRIME_4;
+	}
+}
+
+ResultCache::ResultCache(const std::filesystem::path& directory, const uintmax_t capacity) : directory(directory), capacity(capacity)
+{
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+
+	// Copies left half stored by a process that was killed are never renamed into place, so they are cleared out here.
+	TemporaryPath::RemoveStale(directory);
+
+	// Files touched most recently by any process sharing the directory are kept the longest.
+	std::vector<std::tuple<std::filesystem::file_time_type, std::string, uintmax_t>> files;
+	for (const auto& file : std::filesystem::directory_iterator(directory, error))
+	{
+		std::string key = file.path().stem().string();
+		if (!file.is_regular_file(error) || file.path().extension() != ENTRY_EXTENSION || key.size() != 16)
+		{
+			continue;
+		}
+
+		files.emplace_back(file.last_write_time(error), key, file.file_size(error));
+	}
+
+	std::sort(files.begin(), files.end());
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	for (const auto& [time, key, size] : files)
+	{
+		this->useOrder.push_back(key);
+		this->entries[key] = { size, std::prev(this->useOrder.end()) };
+		this->statistics.Bytes += size;
+		this->statistics.EntryCount++;
+	}
+
+	this->Evict();
+}
+
+bool ResultCache::MakeKey(const std::string& inputPath, const std::string& parameters, std::string& key)
+{
+	MappedFile file;
+	if (!file.Open(inputPath))
+	{
+		return false;
+	}
+
+	uint64_t fileHash = ResultCache::Hash(file.GetData());
+	uint64_t hash = ResultCache::Hash(std::span<const uint8_t>((const uint8_t*)parameters.data(), parameters.size()), fileHash);
+
+	char digits[17];
+	std::snprintf(digits, sizeof(digits), "%016llx", (unsigned long long)hash);
+	key = digits;
+	return true;
+}
+
+uint64_t ResultCache::Hash(std::span<const uint8_t> data, const uint64_t seed)
+{
+	const uint8_t* bytes = data.data();
+	const uint8_t* end = bytes + data.size();
+	uint64_t hash = 0;
+
+	// Four independent lanes of 8 bytes each, so the multiplies of one step do not wait on each other.
+	if (data.size() >= 32)
+	{
+		uint64_t lanes[4] = { seed + PRIME_1 + PRIME_2, seed + PRIME_2, seed, seed - PRIME_1 };
+
+		for (; bytes + 32 <= end; bytes += 32)
+		{
+			for (size_t i = 0; i < 4; i++)
+			{
+				lanes[i] = Round(lanes[i], Read64(bytes + (i * 8)));
+			}
+		}
+
+		hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+
+		for (uint64_t lane : lanes)
+		{
+			hash = MergeRound(hash, lane);
+		}
+	}
+	else
+	{
+		hash = seed + PRIME_5;
+	}
+
+	hash += (uint64_t)data.size();
+
+	for (; bytes + 8 <= end; bytes += 8)
+	{
+		hash ^= Round(0, Read64(bytes));
+		hash = (std::rotl(hash, 27) * PRIME_1) + PRIME_4;
+	}
+
+	if (bytes + 4 <= end)
+	{
+		hash ^= Read32(bytes) * PRIME_1;
+		hash = (std::rotl(hash, 23) * PRIME_2) + PRIME_3;
+		bytes += 4;
+	}
+
+	for (; bytes < end; bytes++)
+	{
+		hash ^= *bytes * PRIME_5;
+		hash = std::rotl(hash, 11) * PRIME_1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME_2;
+	hash ^= hash >> 29;
+	hash *= PRIME_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+bool ResultCache::Fetch(const std::string& key, const std::string& outputPath, const bool replaceAtomically)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->entries.find(key) == this->entries.end())
+		{
+			this->statistics.Misses++;
+			return false;
+		}
+	}
+
+	// The file may have been evicted by another process since it was indexed, which counts as a miss.
+	std::filesystem::path entryPath = this->GetEntryPath(key);
+	// An atomic copy is made under a name of its own beside the output, so two fetches to one output never share it.
+	std::string copyPath = replaceAtomically ? TemporaryPath::Make(outputPath).string() : outputPath;
+	std::error_code error;
+
+	bool copied = std::filesystem::copy_file(entryPath, copyPath, std::filesystem::copy_options::overwrite_existing, error);
+	if (copied && replaceAtomically)
+	{
+		std::filesystem::rename(copyPath, outputPath, error);
+		copied = !error;
+	}
+
+	if (copied)
+	{
+		std::filesystem::last_write_time(entryPath, std::filesystem::file_time_type::clock::now(), error);
+	}
+	else
+	{
+		std::filesystem::remove(copyPath, error);
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto entry = this->entries.find(key);
+
+	if (!copied)
+	{
+		if (entry != this->entries.end())
+		{
+			this->statistics.Bytes -= entry->second.Size;
+			this->statistics.EntryCount--;
+			this->useOrder.erase(entry->second.Use);
+			this->entries.erase(entry);
+		}
+
+		this->statistics.Misses++;
+		return false;
+	}
+
+	if (entry != this->entries.end())
+	{
+		this->useOrder.splice(this->useOrder.end(), this->useOrder, entry->second.Use);
+	}
+
+	this->statistics.Hits++;
+	return true;
+}
+
+void ResultCache::Store(const std::string& key, const std::string& outputPath)
+{
+	std::error_code error;
+	uintmax_t size = std::filesystem::file_size(outputPath, error);
+	if (error || size > this->capacity)
+	{
+		return;
+	}
+
+	// Copy under a name of its own, then rename into place, so no process ever reads a partly stored file.
+	std::filesystem::path entryPath = this->GetEntryPath(key);
+	std::filesystem::path copyPath = TemporaryPath::Make(entryPath);
+
+	if (!std::filesystem::copy_file(outputPath, copyPath, std::filesystem::copy_options::overwrite_existing, error))
+	{
+		std::filesystem::remove(copyPath, error);
+		return;
+	}
+
+	std::filesystem::rename(copyPath, entryPath, error);
+	if (error)
+	{
+		std::filesystem::remove(copyPath, error);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto entry = this->entries.find(key);
+
+	if (entry != this->entries.end())
+	{
+		this->statistics.Bytes -= entry->second.Size;
+		entry->second.Size = size;
+		this->useOrder.splice(this->useOrder.end(), this->useOrder, entry->second.Use);
+	}
+	else
+	{
+		this->useOrder.push_back(key);
+		this->entries[key] = { size, std::prev(this->useOrder.end()) };
+		this->statistics.EntryCount++;
+	}
+
+	this->statistics.Bytes += size;
+	this->statistics.Stores++;
+	this->Evict();
+}
+
+ResultCache::Statistics ResultCache::GetStatistics() const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->statistics;
+}
+
+std::filesystem::path ResultCache::GetEntryPath(const std::string& key) const
+{
+	return this->directory / (key + ENTRY_EXTENSION);
+}
+
+void ResultCache::Evict()
+{
+	while (this->statistics.Bytes > this->capacity && !this->useOrder.empty())
+	{
+		const std::string& key = this->useOrder.front();
+		auto entry = this->entries.find(key);
+
+		std::error_code error;
+		std::filesystem::remove(this->GetEntryPath(key), error);
+
+		this->statistics.Bytes -= entry->second.Size;
+		this->statistics.EntryCount--;
+		this->statistics.Evictions++;
+		this->entries.erase(entry);
+		this->useOrder.pop_front();
+	}
+}
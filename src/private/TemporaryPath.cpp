@@ -0,0 +1,62 @@
+#include <TemporaryPath.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+	/**
+	 * Get the id of this process, which no other running process shares.
+	 */
+	uint64_t GetProcessId()
+	{
+#if defined(_WIN32)
+		return (uint64_t)_getpid();
+#else
+		return (uint64_t)getpid();
+#endif
+	}
+}
+
+std::filesystem::path TemporaryPath::Make(const std::filesystem::path& destination)
+{
+	// The process id tells processes apart and the count tells the writers in one process apart, so together they are unique.
+	static std::atomic<uint64_t> nameCount = 0;
+
+	std::filesystem::path path = destination;
+	path += MARKER + std::to_string(GetProcessId()) + "-" + std::to_string(nameCount++);
+	return path;
+}
+
+bool TemporaryPath::IsTemporary(const std::filesystem::path& path)
+{
+	return path.filename().string().find(MARKER) != std::string::npos;
+}
+
+size_t TemporaryPath::RemoveStale(const std::filesystem::path& directory, const std::chrono::seconds age)
+{
+	size_t removed = 0;
+	std::error_code error;
+	std::filesystem::file_time_type cutoff = std::filesystem::file_time_type::clock::now() - age;
+
+	for (const auto& file : std::filesystem::directory_iterator(directory, error))
+	{
+		if (!file.is_regular_file(error) || !TemporaryPath::IsTemporary(file.path()) || file.last_write_time(error) > cutoff || error)
+		{
+			continue;
+		}
+
+		if (std::filesystem::remove(file.path(), error))
+		{
+			removed++;
+		}
+	}
+
+	return removed;
+}
@@ -0,0 +1,143 @@
+#include <ThreadPool.h>
+#include <algorithm>
+#include <exception>
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = ThreadPool::GetHardwareThreadCount();
+	}
+
+	// The calling thread always takes part in ParallelFor, so it counts as one of the threads.
+	this->workers.reserve(threadCount - 1);
+	for (size_t i = 1; i < threadCount; i++)
+	{
+		this->workers.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->queueMutex);
+		this->stopping = true;
+	}
+
+	this->queueCondition.notify_all();
+
+	for (auto& worker : this->workers)
+	{
+		worker.join();
+	}
+}
+
+size_t ThreadPool::GetThreadCount() const
+{
+	return this->workers.size() + 1;
+}
+
+std::future<void> ThreadPool::Submit(std::function<void()> task)
+{
+	std::packaged_task<void()> packagedTask(std::move(task));
+	std::future<void> future = packagedTask.get_future();
+
+	if (this->workers.empty())
+	{
+		packagedTask();
+		return future;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->queueMutex);
+		this->tasks.push(std::move(packagedTask));
+	}
+
+	this->queueCondition.notify_one();
+	return future;
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t begin, size_t end)>& task)
+{
+	size_t chunkCount = std::min(count, this->GetThreadCount());
+	if (chunkCount <= 1)
+	{
+		task(0, count);
+		return;
+	}
+
+	// Spread the remainder over the first chunks so no chunk is more than one item larger than another.
+	size_t chunkSize = count / chunkCount;
+	size_t remainder = count % chunkCount;
+
+	std::vector<std::future<void>> futures;
+	futures.reserve(chunkCount - 1);
+
+	size_t firstEnd = chunkSize + (remainder > 0 ? 1 : 0);
+	size_t begin = firstEnd;
+	for (size_t i = 1; i < chunkCount; i++)
+	{
+		size_t end = begin + chunkSize + (i < remainder ? 1 : 0);
+		futures.push_back(this->Submit([&task, begin, end]() { task(begin, end); }));
+		begin = end;
+	}
+
+	// Every chunk must finish before returning, even if one throws, since the queued chunks reference task.
+	std::exception_ptr exception = nullptr;
+	try
+	{
+		task(0, firstEnd);
+	}
+	catch (...)
+	{
+		exception = std::current_exception();
+	}
+
+	for (auto& future : futures)
+	{
+		try
+		{
+			future.get();
+		}
+		catch (...)
+		{
+			if (exception == nullptr)
+			{
+				exception = std::current_exception();
+			}
+		}
+	}
+
+	if (exception != nullptr)
+	{
+		std::rethrow_exception(exception);
+	}
+}
+
+size_t ThreadPool::GetHardwareThreadCount()
+{
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void ThreadPool::WorkerLoop()
+{
+	while (true)
+	{
+		std::packaged_task<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(this->queueMutex);
+			this->queueCondition.wait(lock, [this]() { return this->stopping || !this->tasks.empty(); });
+
+			if (this->stopping && this->tasks.empty())
+			{
+				return;
+			}
+
+			task = std::move(this->tasks.front());
+			this->tasks.pop();
+		}
+
+		task();
+	}
+}
@@ -1,50 +1,1713 @@
 import TexFile;
 
 #include <iostream>
+#include <fstream>
+#include <iomanip>
 #include <string>
 #include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <condition_variable>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <BoundedQueue.h>
+#include <EffectGraph.h>
 #include <Effects.h>
+#include <LocalSocket.h>
+#include <PixelPool.h>
+#include <ResultCache.h>
+#include <ThreadPool.h>
+
+namespace
+{
+	/** How every image is blurred and saved, as set on the command line. */
+	struct BlurSettings
+	{
+		/** The 0-1 blur strength. */
+		float BlurValue = 0.0f;
+
+		/** An explicit standard deviation in pixels, which takes precedence over BlurValue when above zero. */
+		float Sigma = 0.0f;
+
+		/** A chain of effects given in place of the blur strength, which takes precedence over BlurValue when not empty. */
+		EffectGraph Chain;
+
+		/** The chain as it was given on the command line, or empty if a blur strength was given. */
+		std::string ChainSpec;
+
+		/** The pixel layout to blur in: auto, interleaved or planar. */
+		std::string Layout = "auto";
+
+		/** Indicates images are read, blurred and written a few scanlines at a time. */
+		bool Streaming = false;
+
+		/** Indicates the output is written to a temporary file and renamed into place. */
+		bool Atomic = false;
+
+		/** Indicates color-mapped output is dithered when it has to be quantized. */
+		bool Dither = false;
+
+		/** Indicates the worker count was given, rather than left to the default of the mode. */
+		bool WorkersSet = false;
+
+		/** The directory finished outputs are cached in, or empty for no cache. */
+		std::string CacheDirectory;
+
+		/** The most megabytes the cache may hold. */
+		uintmax_t CacheMegabytes = 1024;
+
+		/** The cache opened from CacheDirectory and shared by every image, or null if there is none. */
+		ResultCache* Cache = nullptr;
+
+		/** The options passed to the blur. */
+		EffectOptions Options;
+	};
+
+	/** The outcome of blurring one image. */
+	struct BlurResult
+	{
+		/** Indicates the blurred image was saved. */
+		bool Success = false;
+
+		/** What went wrong, if the image was not saved. */
+		std::string Error;
+
+		/** The time taken to load the image. Zero when streaming, as loading is part of the blur. */
+		double LoadSeconds = 0.0;
+
+		/** The time taken to blur the image, which includes loading and saving when streaming. */
+		double BlurSeconds = 0.0;
+
+		/** The time taken to save the image. Zero when streaming, as saving is part of the blur. */
+		double SaveSeconds = 0.0;
+
+		/** The size of the input file. */
+		uintmax_t InputBytes = 0;
+
+		/** Indicates the output was copied from the result cache, in which case only SaveSeconds is set. */
+		bool CacheHit = false;
+	};
+
+	/** The options that only apply to batch mode, as set on the command line. */
+	struct BatchSettings
+	{
+		/** The number of images blurred at once. 0 uses one per hardware thread. */
+		size_t JobCount = 0;
+
+		/** The number of images loaded at once, and the number saved at once. */
+		size_t IoJobCount = 1;
+
+		/** The most estimated memory the images in the pipeline may hold at once, or 0 for no limit. */
+		uintmax_t MemoryLimit = 0;
+	};
+
+	/**
+	 * Limits the estimated memory held by the images being processed at once. An image larger than the whole budget
+	 * is still processed, once nothing else is.
+	 */
+	class MemoryBudget
+	{
+	public:
+
+		/**
+		 * Constructor.
+		 * @param limit The most bytes to hold at once, or 0 for no limit.
+		 */
+		explicit MemoryBudget(const uintmax_t limit) : limit(limit) {}
+
+		/**
+		 * Wait until there is room for an image, then count it as held.
+		 * @param bytes The estimated memory the image needs.
+		 */
+		void Reserve(const uintmax_t bytes)
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->condition.wait(lock, [&]() { return this->limit == 0 || this->used == 0 || this->used + bytes <= this->limit; });
+			this->used += bytes;
+		}
+
+		/**
+		 * Release memory counted by Reserve.
+		 * @param bytes The bytes given to Reserve.
+		 */
+		void Release(const uintmax_t bytes)
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->used -= bytes;
+			}
+
+			this->condition.notify_all();
+		}
+
+	private:
+
+		/** The most bytes to hold at once, or 0 for no limit. */
+		const uintmax_t limit;
+
+		/** The bytes currently reserved. */
+		uintmax_t used = 0;
+
+		/** Guards used. */
+		std::mutex mutex;
+
+		/** Signalled when memory is released. */
+		std::condition_variable condition;
+	};
+
+	/** An image on its way through the batch pipeline. */
+	struct BatchImage
+	{
+		/** The path the image is loaded from. */
+		std::string InputPath;
+
+		/** The path the blurred image is saved to. */
+		std::string OutputPath;
+
+		/** The loaded image, blurred in place. Null when streaming, and after the image is saved. */
+		std::unique_ptr<Tga::TgaImage> Image = nullptr;
+
+		/** The memory reserved for the image from the budget. */
+		uintmax_t Memory = 0;
+
+		/** The key of the image in the result cache, or empty if there is no cache. */
+		std::string CacheKey;
+
+		/** How the image has fared so far. */
+		BlurResult Result;
+	};
+
+	/**
+	 * How the threads of one pipeline stage spent their time: working, waiting for an image from the stage before,
+	 * or waiting for the stage after to take one (or for memory to load one into).
+	 */
+	struct StageMetrics
+	{
+		/**
+		 * Constructor.
+		 * @param name The name of the stage.
+		 * @param threadCount The number of threads the stage runs on.
+		 */
+		StageMetrics(const char* name, const size_t threadCount) : Name(name), ThreadCount(threadCount) {}
+
+		/** The name of the stage. */
+		const char* Name;
+
+		/** The number of threads the stage runs on. */
+		const size_t ThreadCount;
+
+		/** Nanoseconds spent working, summed over the threads. */
+		std::atomic<uint64_t> Busy = 0;
+
+		/** Nanoseconds spent waiting for an image from the stage before. */
+		std::atomic<uint64_t> Starved = 0;
+
+		/** Nanoseconds spent waiting for the stage after, or for memory. */
+		std::atomic<uint64_t> Blocked = 0;
+
+		/**
+		 * Run a function and add the time it took to one of the counters.
+		 * @return What the function returned.
+		 */
+		template <typename Function>
+		auto Measure(std::atomic<uint64_t>& counter, Function function)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			auto addTime = [&]()
+			{
+				counter += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+			};
+
+			if constexpr (std::is_void_v<decltype(function())>)
+			{
+				function();
+				addTime();
+			}
+			else
+			{
+				auto value = function();
+				addTime();
+				return value;
+			}
+		}
+
+		/**
+		 * Get the share of the stage's thread time spent working, from 0 to 1.
+		 * @param seconds The time the pipeline ran for.
+		 */
+		double GetOccupancy(const double seconds) const
+		{
+			return this->Busy / (seconds * 1e9 * this->ThreadCount);
+		}
+
+		/**
+		 * Print the share of the stage's thread time spent working and waiting.
+		 * @param seconds The time the pipeline ran for.
+		 */
+		void Print(const double seconds) const
+		{
+			double threadNanoseconds = seconds * 1e9 * this->ThreadCount;
+
+			std::cout << this->Name << ": " << this->ThreadCount << (this->ThreadCount == 1 ? " thread, " : " threads, ")
+				<< (size_t)(100.0 * this->Busy / threadNanoseconds) << "% busy, "
+				<< (size_t)(100.0 * this->Starved / threadNanoseconds) << "% waiting for input, "
+				<< (size_t)(100.0 * this->Blocked / threadNanoseconds) << "% waiting for output" << std::endl;
+		}
+	};
+
+	/**
+	 * Read the blur strength or effect chain and the "--option value" pairs after it into settings.
+	 * @param arguments The arguments, with the blur strength or effect chain at first and the options after it.
+	 * @param batch Set from the options that only apply to batch mode, or null if they are not accepted.
+	 * @return An empty string if every argument was understood, otherwise what was wrong.
+	 */
+	std::string ParseSettings(const std::vector<std::string>& arguments, const size_t first, BlurSettings& settings, BatchSettings* batch)
+	{
+		if (first >= arguments.size() || (arguments.size() - first) % 2 != 1)
+		{
+			return "Incorrect parameters. Expected a blur strength or effect chain followed by any number of \"--option value\" pairs.";
+		}
+
+		try
+		{
+			settings.BlurValue = std::stof(arguments[first]);
+		}
+		catch (const std::exception&)
+		{
+			// Anything that is not a number is read as a chain of effects.
+			if (!EffectGraph::Parse(arguments[first], settings.Chain))
+			{
+				return "Incorrect argument for blur strength. Please enter a number [0-1]. e.g. 0.5, or a chain of effects. e.g. blur:0.5,brightness:1.2,gamma:2.2,sharpen:0.8";
+			}
+
+			settings.ChainSpec = arguments[first];
+		}
+
+		EffectOptions& options = settings.Options;
+
+		for (size_t i = first + 1; i + 1 < arguments.size(); i += 2)
+		{
+			const std::string& option = arguments[i];
+			const std::string& value = arguments[i + 1];
+
+			if (option == "--workers")
+			{
+				try
+				{
+					options.WorkerCount = std::stoul(value);
+					settings.WorkersSet = true;
+				}
+				catch (const std::exception&)
+				{
+					return "Incorrect argument for worker count. Please enter a whole number, or 0 to use all hardware threads. e.g. 8";
+				}
+			}
+			else if (option == "--simd")
+			{
+				if (value == "scalar")
+				{
+					options.MaxInstructionSet = BlurKernels::EInstructionSet::Scalar;
+				}
+				else if (value == "sse4.1")
+				{
+					options.MaxInstructionSet = BlurKernels::EInstructionSet::SSE41;
+				}
+				else if (value == "avx2")
+				{
+					options.MaxInstructionSet = BlurKernels::EInstructionSet::AVX2;
+				}
+				else
+				{
+					return "Incorrect argument for SIMD instruction set. Please enter one of scalar, sse4.1 or avx2.";
+				}
+			}
+			else if (option == "--precision")
+			{
+				if (value == "float")
+				{
+					options.Precision = EffectOptions::EPrecision::Float;
+				}
+				else if (value == "fixed")
+				{
+					options.Precision = EffectOptions::EPrecision::FixedPoint;
+				}
+				else
+				{
+					return "Incorrect argument for precision. Please enter one of float or fixed.";
+				}
+			}
+			else if (option == "--mode")
+			{
+				if (value == "exact")
+				{
+					options.Mode = EffectOptions::EBlurMode::Exact;
+				}
+				else if (value == "box")
+				{
+					options.Mode = EffectOptions::EBlurMode::Box;
+				}
+				else if (value == "recursive")
+				{
+					options.Mode = EffectOptions::EBlurMode::Recursive;
+				}
+				else
+				{
+					return "Incorrect argument for blur mode. Please enter one of exact, box or recursive.";
+				}
+			}
+			else if (option == "--box-passes")
+			{
+				try
+				{
+					options.BoxPassCount = std::stoul(value);
+				}
+				catch (const std::exception&)
+				{
+					options.BoxPassCount = 0;
+				}
+
+				if (options.BoxPassCount < 3 || options.BoxPassCount > 5)
+				{
+					return "Incorrect argument for box pass count. Please enter a whole number [3-5]. e.g. 3";
+				}
+			}
+			else if (option == "--boundary")
+			{
+				if (value == "clamp")
+				{
+					options.Boundary = EffectOptions::EBoundaryMode::Clamp;
+				}
+				else if (value == "mirror")
+				{
+					options.Boundary = EffectOptions::EBoundaryMode::Mirror;
+				}
+				else if (value == "wrap")
+				{
+					options.Boundary = EffectOptions::EBoundaryMode::Wrap;
+				}
+				else if (value == "zero")
+				{
+					options.Boundary = EffectOptions::EBoundaryMode::Zero;
+				}
+				else
+				{
+					return "Incorrect argument for boundary mode. Please enter one of clamp, mirror, wrap or zero.";
+				}
+			}
+			else if (option == "--sigma")
+			{
+				try
+				{
+					settings.Sigma = std::stof(value);
+				}
+				catch (const std::exception&)
+				{
+					settings.Sigma = 0.0f;
+				}
+
+				// Zero means no sigma was given, so anything that is not a positive number is refused rather than ignored.
+				if (!std::isfinite(settings.Sigma) || settings.Sigma <= 0.0f || settings.Sigma > Effects::MAX_SIGMA)
+				{
+					return "Incorrect argument for sigma. Please enter a number of pixels greater than 0, up to " + std::to_string((int32_t)Effects::MAX_SIGMA) + ". e.g. 25";
+				}
+			}
+			else if (option == "--layout")
+			{
+				if (value == "auto" || value == "interleaved" || value == "planar")
+				{
+					settings.Layout = value;
+				}
+				else
+				{
+					return "Incorrect argument for pixel layout. Please enter one of auto, interleaved or planar.";
+				}
+			}
+			else if (option == "--streaming")
+			{
+				if (value == "off" || value == "on")
+				{
+					settings.Streaming = value == "on";
+				}
+				else
+				{
+					return "Incorrect argument for streaming. Please enter one of off or on.";
+				}
+			}
+			else if (option == "--atomic")
+			{
+				if (value == "off" || value == "on")
+				{
+					settings.Atomic = value == "on";
+				}
+				else
+				{
+					return "Incorrect argument for atomic. Please enter one of off or on.";
+				}
+			}
+			else if (option == "--dither")
+			{
+				if (value == "off" || value == "on")
+				{
+					settings.Dither = value == "on";
+				}
+				else
+				{
+					return "Incorrect argument for dither. Please enter one of off or on.";
+				}
+			}
+			else if (option == "--cache")
+			{
+				settings.CacheDirectory = value;
+			}
+			else if (option == "--cache-size")
+			{
+				try
+				{
+					settings.CacheMegabytes = std::stoull(value);
+				}
+				catch (const std::exception&)
+				{
+					return "Incorrect argument for cache size. Please enter a whole number of megabytes. e.g. 1024";
+				}
+			}
+			else if (batch != nullptr && option == "--jobs")
+			{
+				try
+				{
+					batch->JobCount = std::stoul(value);
+				}
+				catch (const std::exception&)
+				{
+					return "Incorrect argument for job count. Please enter a whole number, or 0 to use all hardware threads. e.g. 8";
+				}
+			}
+			else if (batch != nullptr && option == "--io-jobs")
+			{
+				try
+				{
+					batch->IoJobCount = std::max((size_t)std::stoul(value), (size_t)1);
+				}
+				catch (const std::exception&)
+				{
+					return "Incorrect argument for I/O job count. Please enter a whole number of at least 1. e.g. 2";
+				}
+			}
+			else if (batch != nullptr && option == "--memory")
+			{
+				try
+				{
+					batch->MemoryLimit = (uintmax_t)std::stoull(value) * 1024 * 1024;
+				}
+				catch (const std::exception&)
+				{
+					return "Incorrect argument for memory. Please enter a whole number of megabytes, or 0 for no limit. e.g. 4096";
+				}
+			}
+			else
+			{
+				return "Unknown option " + option;
+			}
+		}
+
+		// Streaming never holds the whole image, so images larger than memory can be blurred a few rows at a time.
+		if (settings.Streaming)
+		{
+			if (options.Mode != EffectOptions::EBlurMode::Exact)
+			{
+				return "Streaming only supports the exact blur mode.";
+			}
+
+			if (options.Boundary == EffectOptions::EBoundaryMode::Wrap)
+			{
+				return "Streaming does not support the wrap boundary mode, as it needs the last rows before the first.";
+			}
+
+			if (settings.Atomic)
+			{
+				return "Streaming cannot be combined with atomic saves, as the output is written while the input is still being read.";
+			}
+		}
+
+		// A chain passes rows from one effect to the next itself, so it is never streamed and only has the exact blur.
+		if (!settings.ChainSpec.empty())
+		{
+			if (settings.Streaming)
+			{
+				return "Effect chains cannot be streamed.";
+			}
+
+			if (settings.Sigma > 0.0f)
+			{
+				return "Effect chains give the sigma of each blur in the chain instead. e.g. sigma:25";
+			}
+
+			if (options.Mode != EffectOptions::EBlurMode::Exact)
+			{
+				return "Effect chains only support the exact blur mode.";
+			}
+
+			if (options.Boundary == EffectOptions::EBoundaryMode::Wrap)
+			{
+				return "Effect chains do not support the wrap boundary mode, as they never hold a whole blurred image.";
+			}
+		}
+
+		return "";
+	}
+
+	/**
+	 * Blur an image a few scanlines at a time, so it never has to fit in memory.
+	 */
+	BlurResult BlurStreaming(const std::string& inputPath, const std::string& outputPath, const BlurSettings& settings)
+	{
+		BlurResult result;
+
+		Tga::TgaScanlineReader reader;
+		if (reader.Open(inputPath) != Tga::EErrorCode::NoError)
+		{
+			result.Error = "An error occurred while parsing image or image format not supported for streaming " + inputPath + "\nVerify correct image path or try a different image.";
+			return result;
+		}
+
+		// The writer truncates the output before the first scanline is read, so streaming an image over itself would destroy it.
+		std::error_code error;
+		if (std::filesystem::equivalent(inputPath, outputPath, error))
+		{
+			result.Error = "Cannot stream " + inputPath + " over itself, as the output is written while the input is read.\nChoose a different output path or turn streaming off.";
+			return result;
+		}
+
+		Tga::TgaScanlineWriter writer;
+		if (writer.Open(outputPath, reader) != Tga::EErrorCode::NoError)
+		{
+			result.Error = "Could not create " + outputPath;
+			return result;
+		}
+
+		auto readRow = [&](Vec4* row) { reader.ReadScanline(row); };
+		auto writeRow = [&](const Vec4* row) { writer.WriteScanline(row); };
+
+		auto start = std::chrono::high_resolution_clock::now();
+		if (settings.Sigma > 0.0f)
+		{
+			Effects::GaussianBlurRowsSigma(reader.GetWidth(), reader.GetHeight(), readRow, writeRow, settings.Sigma, settings.Options);
+		}
+		else
+		{
+			Effects::GaussianBlurRows(reader.GetWidth(), reader.GetHeight(), readRow, writeRow, settings.BlurValue, settings.Options);
+		}
+		bool saved = writer.Close();
+		auto stop = std::chrono::high_resolution_clock::now();
+
+		if (!saved)
+		{
+			result.Error = "An error occurred while writing " + outputPath;
+			return result;
+		}
+
+		result.InputBytes = std::filesystem::file_size(inputPath, error);
+		result.BlurSeconds = std::chrono::duration<double>(stop - start).count();
+		result.Success = true;
+		return result;
+	}
+
+	/**
+	 * Get the threads an image is decoded and encoded on, which are the ones it is blurred on.
+	 * @param ownedPool Holds the pool started for the call when the settings have none, with the blur's worker count.
+	 */
+	ThreadPool& GetImageThreadPool(const BlurSettings& settings, std::optional<ThreadPool>& ownedPool)
+	{
+		if (settings.Options.Pool != nullptr)
+		{
+			return *settings.Options.Pool;
+		}
+
+		return ownedPool.emplace(settings.Options.WorkerCount);
+	}
+
+	/**
+	 * Load a whole image, the first stage of BlurImage.
+	 * @return False if the image could not be loaded, with the reason in result.
+	 */
+	bool LoadImage(const std::string& inputPath, Tga::TgaImage& tgaImage, const BlurSettings& settings, BlurResult& result)
+	{
+		std::optional<ThreadPool> ownedPool;
+		ThreadPool& threadPool = GetImageThreadPool(settings, ownedPool);
+
+		auto loadStart = std::chrono::high_resolution_clock::now();
+		if (tgaImage.LoadFromFile(inputPath, true, &threadPool) != Tga::EErrorCode::NoError)
+		{
+			result.Error = "An error occurred while parsing image or image format not supported " + inputPath + "\nVerify correct image path or try a different image.";
+			return false;
+		}
+		auto loadStop = std::chrono::high_resolution_clock::now();
+
+		std::error_code error;
+		result.InputBytes = std::filesystem::file_size(inputPath, error);
+		result.LoadSeconds = std::chrono::duration<double>(loadStop - loadStart).count();
+		return true;
+	}
+
+	/**
+	 * Blur a loaded image in place, the second stage of BlurImage.
+	 */
+	void BlurLoadedImage(Tga::TgaImage& tgaImage, const BlurSettings& settings, BlurResult& result)
+	{
+		// Images with fewer than four channels are blurred one plane per channel, so the missing channels cost nothing.
+		bool planar = settings.Layout == "planar" || (settings.Layout == "auto" && tgaImage.GetChannelCount() < 4);
+
+		// Uncompressed 32 bit images are blurred straight from the mapped file. The blur treats every channel alike,
+		// so their file channel order is kept through the blur and only fixed when the result is handed back.
+		const Vec4* mappedPixels = tgaImage.GetMappedPixels();
+		const Vec4* sourcePixels = mappedPixels != nullptr ? mappedPixels : tgaImage.GetPixelBuffer().get();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		auto blurredPixels = [&]() -> PixelPool::Buffer
+		{
+			if (!settings.ChainSpec.empty())
+			{
+				return settings.Chain.Apply(sourcePixels, tgaImage.GetWidth(), tgaImage.GetHeight(), settings.Options);
+			}
+
+			// An explicit sigma takes precedence over the 0-1 blur strength.
+			if (planar)
+			{
+				PlanarImage image = PlanarImage::FromInterleaved(sourcePixels, tgaImage.GetWidth(), tgaImage.GetHeight(), tgaImage.GetChannelCount());
+				PlanarImage blurredImage = settings.Sigma > 0.0f
+					? Effects::GaussianBlurSigma(image, settings.Sigma, settings.Options)
+					: Effects::GaussianBlur(image, settings.BlurValue, settings.Options);
+
+				return blurredImage.ToInterleaved();
+			}
+
+			return settings.Sigma > 0.0f
+				? Effects::GaussianBlurSigma(sourcePixels, tgaImage.GetWidth(), tgaImage.GetHeight(), settings.Sigma, settings.Options)
+				: Effects::GaussianBlur(sourcePixels, tgaImage.GetWidth(), tgaImage.GetHeight(), settings.BlurValue, settings.Options);
+		}();
+		auto stop = std::chrono::high_resolution_clock::now();
+
+		if (mappedPixels != nullptr)
+		{
+			tgaImage.SetMappedPixelData(std::move(blurredPixels));
+		}
+		else
+		{
+			tgaImage.SetPixelData(std::move(blurredPixels));
+		}
+
+		result.BlurSeconds = std::chrono::duration<double>(stop - start).count();
+	}
+
+	/**
+	 * Save a blurred image, the last stage of BlurImage.
+	 * @return False if the image could not be saved, with the reason in result.
+	 */
+	bool SaveImage(Tga::TgaImage& tgaImage, const std::string& outputPath, const BlurSettings& settings, BlurResult& result)
+	{
+		tgaImage.SetColorMapDithering(settings.Dither);
+
+		std::optional<ThreadPool> ownedPool;
+		ThreadPool& threadPool = GetImageThreadPool(settings, ownedPool);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		if (tgaImage.SaveToFile(outputPath, tgaImage.GetImageType(), settings.Atomic, &threadPool) != Tga::EErrorCode::NoError)
+		{
+			result.Error = "An error occurred while writing " + outputPath;
+			return false;
+		}
+		auto stop = std::chrono::high_resolution_clock::now();
+
+		result.SaveSeconds = std::chrono::duration<double>(stop - start).count();
+		result.Success = true;
+		return true;
+	}
+
+	/**
+	 * Load a whole image, blur it and save it.
+	 */
+	BlurResult BlurImage(const std::string& inputPath, const std::string& outputPath, const BlurSettings& settings)
+	{
+		BlurResult result;
+		Tga::TgaImage tgaImage;
+
+		if (LoadImage(inputPath, tgaImage, settings, result))
+		{
+			BlurLoadedImage(tgaImage, settings, result);
+			SaveImage(tgaImage, outputPath, settings, result);
+		}
+
+		return result;
+	}
+
+	/** Bump when a change to the effects or the TGA writer alters the output for the same input and settings, so cached outputs from before it are not served. */
+	constexpr uint32_t OUTPUT_VERSION = 2;
+
+	/**
+	 * Describe every setting that affects the output, to key the result cache along with the input file.
+	 * The thread count, pixel layout and streaming are left out, as they never change the output.
+	 */
+	std::string DescribeOutput(const BlurSettings& settings)
+	{
+		const EffectOptions& options = settings.Options;
+		BlurKernels::EInstructionSet instructionSet = std::min(options.MaxInstructionSet, BlurKernels::GetSupportedInstructionSet());
+
+		return "version " + std::to_string(OUTPUT_VERSION)
+			+ " strength " + std::to_string(std::bit_cast<uint32_t>(settings.BlurValue))
+			+ " sigma " + std::to_string(std::bit_cast<uint32_t>(settings.Sigma))
+			+ " simd " + std::to_string(instructionSet)
+			+ " precision " + std::to_string(options.Precision)
+			+ " mode " + std::to_string(options.Mode)
+			+ " passes " + std::to_string(options.BoxPassCount)
+			+ " boundary " + std::to_string(options.Boundary)
+			+ " dither " + std::to_string(settings.Dither)
+			+ " chain " + settings.ChainSpec;
+	}
+
+	/**
+	 * Look an image up in the result cache, and copy its output into place if it is there.
+	 * @param key Set to the key of the image, or left empty if there is no cache or the input could not be read.
+	 * @return True if the output was copied from the cache, in which case result is filled in.
+	 */
+	bool FetchCachedResult(const std::string& inputPath, const std::string& outputPath, const BlurSettings& settings, std::string& key, BlurResult& result)
+	{
+		if (settings.Cache == nullptr || !ResultCache::MakeKey(inputPath, DescribeOutput(settings), key))
+		{
+			return false;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		if (!settings.Cache->Fetch(key, outputPath, settings.Atomic))
+		{
+			return false;
+		}
+		auto stop = std::chrono::high_resolution_clock::now();
+
+		std::error_code error;
+		result.InputBytes = std::filesystem::file_size(inputPath, error);
+		result.SaveSeconds = std::chrono::duration<double>(stop - start).count();
+		result.CacheHit = true;
+		result.Success = true;
+		return true;
+	}
+
+	/**
+	 * Store a saved output in the result cache under the key from FetchCachedResult.
+	 */
+	void StoreCachedResult(const std::string& key, const std::string& outputPath, const BlurSettings& settings, const BlurResult& result)
+	{
+		if (settings.Cache != nullptr && !key.empty() && result.Success)
+		{
+			settings.Cache->Store(key, outputPath);
+		}
+	}
+
+	/**
+	 * Blur an image, whole or streamed as the settings say, unless its output is found in the result cache.
+	 */
+	BlurResult BlurFile(const std::string& inputPath, const std::string& outputPath, const BlurSettings& settings)
+	{
+		BlurResult result;
+		std::string key;
+
+		if (FetchCachedResult(inputPath, outputPath, settings, key, result))
+		{
+			return result;
+		}
+
+		result = settings.Streaming ? BlurStreaming(inputPath, outputPath, settings) : BlurImage(inputPath, outputPath, settings);
+		StoreCachedResult(key, outputPath, settings, result);
+		return result;
+	}
+
+	/**
+	 * Print how often the result cache was hit and how much it holds.
+	 */
+	void PrintCacheStatistics(const ResultCache& cache)
+	{
+		ResultCache::Statistics statistics = cache.GetStatistics();
+		size_t lookupCount = statistics.Hits + statistics.Misses;
+
+		std::cout << "Cache: " << statistics.Hits << (statistics.Hits == 1 ? " hit, " : " hits, ")
+			<< statistics.Misses << (statistics.Misses == 1 ? " miss (" : " misses (")
+			<< (lookupCount > 0 ? (size_t)(100.0 * statistics.Hits / lookupCount) : 0) << "% hit rate), "
+			<< (size_t)(statistics.Bytes / (1024.0 * 1024.0)) << " MB in " << statistics.EntryCount << (statistics.EntryCount == 1 ? " entry, " : " entries, ")
+			<< statistics.Evictions << " evicted";
+	}
+
+	/**
+	 * Print how often image buffers were recycled rather than allocated, and how much memory they took.
+	 */
+	void PrintBufferStatistics()
+	{
+		PixelPool::Statistics statistics = PixelPool::GetShared().GetStatistics();
+
+		std::cout << "Buffers: " << statistics.Requests << (statistics.Requests == 1 ? " request, " : " requests, ")
+			<< statistics.Reuses << " reused (" << (statistics.Requests > 0 ? (size_t)(100.0 * statistics.Reuses / statistics.Requests) : 0) << "%), "
+			<< (size_t)(statistics.AllocatedBytes / (1024.0 * 1024.0)) << " MB allocated, "
+			<< (size_t)(statistics.PeakBytes / (1024.0 * 1024.0)) << " MB peak";
+	}
+
+	/**
+	 * Estimate the memory needed to blur an image: the decoded pixels, the blurred pixels and the blur's working copy.
+	 * Streaming only holds a few scanlines, so it is not counted.
+	 */
+	uintmax_t EstimateImageMemory(const std::string& inputPath, const BlurSettings& settings)
+	{
+		if (settings.Streaming)
+		{
+			return 0;
+		}
+
+		// The reader only parses the header, and reads every type but color-mapped, whose indices are a byte per pixel.
+		uintmax_t pixelCount = 0;
+		Tga::TgaScanlineReader reader;
+		if (reader.Open(inputPath) == Tga::EErrorCode::NoError)
+		{
+			pixelCount = (uintmax_t)reader.GetWidth() * reader.GetHeight();
+		}
+		else
+		{
+			std::error_code error;
+			pixelCount = std::filesystem::file_size(inputPath, error);
+			pixelCount = error ? 0 : pixelCount;
+		}
+
+		return pixelCount * sizeof(Vec4) * 3;
+	}
+
+	/**
+	 * Find the images a batch processes. A directory is searched recursively for .tga files, whose outputs keep their path
+	 * relative to it. Any other file is a manifest listing one input path per line, relative to the manifest, whose outputs
+	 * are named after the input file. Blank lines and lines starting with # are skipped.
+	 * @return Pairs of input and output paths, or an empty list if the source could not be read.
+	 */
+	std::vector<std::pair<std::filesystem::path, std::filesystem::path>> CollectBatch(const std::filesystem::path& source, const std::filesystem::path& outputDirectory)
+	{
+		std::vector<std::pair<std::filesystem::path, std::filesystem::path>> images;
+		std::error_code error;
+
+		if (std::filesystem::is_directory(source, error))
+		{
+			for (const auto& entry : std::filesystem::recursive_directory_iterator(source, error))
+			{
+				std::string extension = entry.path().extension().string();
+				std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+				if (entry.is_regular_file(error) && extension == ".tga")
+				{
+					images.emplace_back(entry.path(), outputDirectory / entry.path().lexically_relative(source));
+				}
+			}
+
+			// Directory order varies between file systems, so sort to process and report in the same order everywhere.
+			std::sort(images.begin(), images.end());
+			return images;
+		}
+
+		std::ifstream manifest(source);
+		std::string line;
+		while (std::getline(manifest, line))
+		{
+			line.erase(line.find_last_not_of(" \t\r\n") + 1);
+			line.erase(0, line.find_first_not_of(" \t"));
+
+			if (line.empty() || line[0] == '#')
+			{
+				continue;
+			}
+
+			std::filesystem::path input = line;
+			if (input.is_relative())
+			{
+				input = source.parent_path() / input;
+			}
+
+			images.emplace_back(input, outputDirectory / input.filename());
+		}
+
+		return images;
+	}
+
+	/**
+	 * Blur every image in a directory or manifest through a pipeline of three stages: loading, blurring and saving,
+	 * each with its own threads and joined by bounded queues, so the disk and the CPU are kept busy at the same time.
+	 * Prints a summary of the throughput and how busy each stage was.
+	 * @param jobCount The number of images blurred at once. 0 uses one per hardware thread.
+	 * @param ioJobCount The number of images loaded at once, and the number saved at once.
+	 * @param memoryLimit The most estimated memory the images in the pipeline may hold at once, or 0 for no limit.
+	 * @return 0 if every image was saved.
+	 */
+	int RunBatch(const std::filesystem::path& source, const std::filesystem::path& outputDirectory, const BlurSettings& settings, size_t jobCount, const size_t ioJobCount, const uintmax_t memoryLimit)
+	{
+		auto images = CollectBatch(source, outputDirectory);
+		if (images.empty())
+		{
+			std::cout << "No images found in " << source.string() << std::endl;
+			return -1;
+		}
+
+		jobCount = jobCount > 0 ? jobCount : ThreadPool::GetHardwareThreadCount();
+
+		// Each queue holds as many images as the stage after it can work on at once, which is enough to keep that stage
+		// busy through a slow image upstream without letting the loaders run far ahead of the blur.
+		BoundedQueue<std::unique_ptr<BatchImage>> loadedImages(jobCount);
+		BoundedQueue<std::unique_ptr<BatchImage>> blurredImages(ioJobCount);
+
+		StageMetrics loadMetrics("Load", ioJobCount);
+		StageMetrics blurMetrics("Blur", jobCount);
+		StageMetrics saveMetrics("Save", ioJobCount);
+
+		MemoryBudget budget(memoryLimit);
+		std::mutex outputMutex;
+		std::atomic<size_t> nextImage = 0;
+		std::atomic<size_t> failedCount = 0;
+		std::atomic<uintmax_t> inputBytes = 0;
+
+		// Every image leaves the pipeline through here, whether it was saved or failed at any stage.
+		auto finish = [&](std::unique_ptr<BatchImage> image)
+		{
+			budget.Release(image->Memory);
+			inputBytes += image->Result.InputBytes;
+
+			if (!image->Result.Success)
+			{
+				failedCount++;
+
+				std::lock_guard<std::mutex> lock(outputMutex);
+				std::cout << image->Result.Error << std::endl;
+			}
+		};
+
+		// Streaming reads, blurs and writes an image in one go, so the blur stage does all of its work.
+		auto load = [&]()
+		{
+			for (size_t i = nextImage++; i < images.size(); i = nextImage++)
+			{
+				auto image = std::make_unique<BatchImage>();
+				image->InputPath = images[i].first.string();
+				image->OutputPath = images[i].second.string();
+				image->Memory = EstimateImageMemory(image->InputPath, settings);
+
+				loadMetrics.Measure(loadMetrics.Blocked, [&]() { budget.Reserve(image->Memory); });
+
+				// Images that fail to load, or whose output is copied from the cache, leave the pipeline here.
+				bool loaded = loadMetrics.Measure(loadMetrics.Busy, [&]()
+				{
+					std::error_code error;
+					std::filesystem::create_directories(images[i].second.parent_path(), error);
+
+					if (FetchCachedResult(image->InputPath, image->OutputPath, settings, image->CacheKey, image->Result))
+					{
+						return false;
+					}
+
+					if (settings.Streaming)
+					{
+						return true;
+					}
+
+					image->Image = std::make_unique<Tga::TgaImage>();
+					return LoadImage(image->InputPath, *image->Image, settings, image->Result);
+				});
+
+				if (!loaded)
+				{
+					finish(std::move(image));
+					continue;
+				}
+
+				loadMetrics.Measure(loadMetrics.Blocked, [&]() { loadedImages.Push(std::move(image)); });
+			}
+		};
+
+		auto blur = [&]()
+		{
+			while (auto image = blurMetrics.Measure(blurMetrics.Starved, [&]() { return loadedImages.Pop(); }))
+			{
+				bool blurred = blurMetrics.Measure(blurMetrics.Busy, [&]()
+				{
+					BatchImage& batchImage = **image;
+
+					try
+					{
+						if (settings.Streaming)
+						{
+							batchImage.Result = BlurStreaming(batchImage.InputPath, batchImage.OutputPath, settings);
+							StoreCachedResult(batchImage.CacheKey, batchImage.OutputPath, settings, batchImage.Result);
+							return batchImage.Result.Success;
+						}
+
+						BlurLoadedImage(*batchImage.Image, settings, batchImage.Result);
+						return true;
+					}
+					catch (const std::exception& exception)
+					{
+						batchImage.Result.Error = "An error occurred while processing " + batchImage.InputPath + ": " + exception.what();
+						return false;
+					}
+				});
+
+				if (!blurred || settings.Streaming)
+				{
+					finish(std::move(*image));
+					continue;
+				}
+
+				blurMetrics.Measure(blurMetrics.Blocked, [&]() { blurredImages.Push(std::move(*image)); });
+			}
+		};
+
+		auto save = [&]()
+		{
+			while (auto image = saveMetrics.Measure(saveMetrics.Starved, [&]() { return blurredImages.Pop(); }))
+			{
+				saveMetrics.Measure(saveMetrics.Busy, [&]()
+				{
+					BatchImage& batchImage = **image;
+					SaveImage(*batchImage.Image, batchImage.OutputPath, settings, batchImage.Result);
+					StoreCachedResult(batchImage.CacheKey, batchImage.OutputPath, settings, batchImage.Result);
+					batchImage.Image.reset();
+				});
+
+				finish(std::move(*image));
+			}
+		};
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		std::vector<std::thread> loadThreads;
+		std::vector<std::thread> blurThreads;
+		std::vector<std::thread> saveThreads;
+
+		for (size_t i = 0; i < ioJobCount; i++)
+		{
+			loadThreads.emplace_back(load);
+			saveThreads.emplace_back(save);
+		}
+
+		for (size_t i = 0; i < jobCount; i++)
+		{
+			blurThreads.emplace_back(blur);
+		}
+
+		// Each stage closes the queue after it once all of its threads are done, which lets the next stage drain and finish.
+		for (auto& thread : loadThreads)
+		{
+			thread.join();
+		}
+		loadedImages.Close();
+
+		for (auto& thread : blurThreads)
+		{
+			thread.join();
+		}
+		blurredImages.Close();
+
+		for (auto& thread : saveThreads)
+		{
+			thread.join();
+		}
+
+		auto stop = std::chrono::high_resolution_clock::now();
+		double seconds = std::max(std::chrono::duration<double>(stop - start).count(), 1e-9);
+		size_t savedCount = images.size() - failedCount;
+
+		std::cout << "Processed " << savedCount << " of " << images.size() << " images in " << (size_t)(seconds * 1000.0) << "ms" << std::endl;
+		std::cout << "Throughput: " << (size_t)(savedCount / seconds) << " images/s, " << (size_t)(inputBytes / (1024.0 * 1024.0) / seconds) << " MB/s" << std::endl;
+
+		// The stage that is busy for the largest share of its time is the one holding the others back.
+		const StageMetrics* bottleneck = &loadMetrics;
+		for (const StageMetrics* stage : { &loadMetrics, &blurMetrics, &saveMetrics })
+		{
+			stage->Print(seconds);
+			bottleneck = stage->GetOccupancy(seconds) > bottleneck->GetOccupancy(seconds) ? stage : bottleneck;
+		}
+
+		std::cout << "Bottleneck: " << bottleneck->Name << std::endl;
+		PrintBufferStatistics();
+
+		if (settings.Cache != nullptr)
+		{
+			std::cout << std::endl;
+			PrintCacheStatistics(*settings.Cache);
+		}
+
+		return failedCount == 0 ? 0 : -1;
+	}
+
+	/**
+	 * Split a line of a job into its tab separated fields.
+	 */
+	std::vector<std::string> SplitFields(const std::string& line)
+	{
+		std::vector<std::string> fields;
+		size_t start = 0;
+
+		for (size_t end = line.find('\t'); end != std::string::npos; end = line.find('\t', start))
+		{
+			fields.push_back(line.substr(start, end - start));
+			start = end + 1;
+		}
+
+		fields.push_back(line.substr(start));
+		return fields;
+	}
+
+	/**
+	 * Run one job line received by the server and format the reply.
+	 * A job is "blur", the input path, the output path and the blur strength, followed by any "--option value" pairs, all
+	 * separated by tabs. The reply is "ok" followed by the load, blur and save times in milliseconds and "hit" if the output
+	 * was copied from the result cache or "miss" if not, or "error" followed by what went wrong, separated by tabs.
+	 * @param threadPool The pool every blur runs on.
+	 * @param cache The result cache every job uses, or null for none.
+	 */
+	std::string RunJob(const std::string& line, ThreadPool& threadPool, ResultCache* cache)
+	{
+		std::vector<std::string> fields = SplitFields(line);
+		if (fields.size() < 4 || fields[0] != "blur")
+		{
+			return "error\tUnknown job. Expected blur, the input path, the output path and the blur strength, separated by tabs.";
+		}
+
+		BlurSettings settings;
+		std::string error = ParseSettings(fields, 3, settings, nullptr);
+
+		if (error.empty() && !settings.CacheDirectory.empty())
+		{
+			error = "The result cache is chosen when the server starts.";
+		}
+
+		// The pool is started with the server, so a job's --workers has no effect.
+		settings.Options.Pool = &threadPool;
+		settings.Cache = cache;
+
+		BlurResult result;
+		if (error.empty())
+		{
+			try
+			{
+				result = BlurFile(fields[1], fields[2], settings);
+				error = result.Error;
+			}
+			catch (const std::exception& exception)
+			{
+				error = "An error occurred while processing " + fields[1] + ": " + exception.what();
+			}
+		}
+
+		if (!error.empty() || !result.Success)
+		{
+			std::replace(error.begin(), error.end(), '\n', ' ');
+			return "error\t" + error;
+		}
+
+		auto milliseconds = [](const double seconds) { return std::to_string(seconds * 1000.0); };
+		return "ok\t" + milliseconds(result.LoadSeconds) + "\t" + milliseconds(result.BlurSeconds) + "\t" + milliseconds(result.SaveSeconds) + (result.CacheHit ? "\thit" : "\tmiss");
+	}
+
+	/**
+	 * Serve jobs sent to a local socket until a client sends "shutdown". The thread pool is started once and kept warm
+	 * for every job. Each client is served on a thread of its own, one job line at a time, so jobs from separate clients
+	 * run at the same time and share the pool. On shutdown no more clients are accepted, and the server waits for the
+	 * ones already connected to disconnect.
+	 * @param socketPath The path to listen on.
+	 * @param workerCount The number of threads in the pool, or 0 for one per hardware thread.
+	 * @param cache The result cache every job uses, or null for none.
+	 * @return 0 once shut down, or -1 if the socket could not be opened.
+	 */
+	int RunServer(const std::string& socketPath, const size_t workerCount, ResultCache* cache)
+	{
+		LocalSocket listener;
+		if (!listener.Listen(socketPath))
+		{
+			std::cout << "Could not listen on " << socketPath << "\nAnother server may be running on it, or a file that is not a socket is in the way." << std::endl;
+			return -1;
+		}
+
+		ThreadPool threadPool(workerCount);
+		std::atomic<bool> stopping = false;
+		std::atomic<size_t> jobCount = 0;
+
+		// The client threads are detached, so they share the count of open connections to keep it alive until the last
+		// of them has signalled it, even if the server has already returned.
+		struct Connections
+		{
+			std::mutex Mutex;
+			std::condition_variable Closed;
+			size_t Count = 0;
+		};
+		auto connections = std::make_shared<Connections>();
+
+		std::cout << "Listening on " << socketPath << " with " << threadPool.GetThreadCount() << (threadPool.GetThreadCount() == 1 ? " thread" : " threads") << std::endl;
+
+		auto serve = [&, connections](LocalSocket client)
+		{
+			std::string line;
+			while (client.ReadLine(line))
+			{
+				if (line == "shutdown")
+				{
+					stopping = true;
+					client.WriteLine("ok");
+
+					// Wake the accept loop so it sees the flag.
+					LocalSocket().Connect(socketPath);
+					break;
+				}
+
+				// Only jobs that saved their image are counted as served.
+				std::string reply = RunJob(line, threadPool, cache);
+				if (reply.starts_with("ok"))
+				{
+					jobCount++;
+				}
+
+				if (!client.WriteLine(reply))
+				{
+					break;
+				}
+			}
+
+			client.Close();
+
+			{
+				std::lock_guard<std::mutex> lock(connections->Mutex);
+				connections->Count--;
+			}
+
+			connections->Closed.notify_all();
+		};
+
+		while (!stopping)
+		{
+			LocalSocket client = listener.Accept();
+			if (!client.IsOpen())
+			{
+				std::cout << "Could not accept a connection on " << socketPath << std::endl;
+				break;
+			}
+
+			if (stopping)
+			{
+				break;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(connections->Mutex);
+				connections->Count++;
+			}
+
+			std::thread(serve, std::move(client)).detach();
+		}
+
+		listener.Close();
+
+		std::unique_lock<std::mutex> lock(connections->Mutex);
+		connections->Closed.wait(lock, [&]() { return connections->Count == 0; });
+
+		std::cout << "Served " << jobCount << (jobCount == 1 ? " job" : " jobs") << std::endl;
+		PrintBufferStatistics();
+		std::cout << std::endl;
+
+		if (cache != nullptr)
+		{
+			PrintCacheStatistics(*cache);
+		}
+
+		return 0;
+	}
+
+	/**
+	 * Send one job to a server and print its reply, as a stand-in for a real client.
+	 * @param socketPath The path the server is listening on.
+	 * @param fields The fields of the job line. Relative image paths are made absolute, as the server may run elsewhere.
+	 * @return 0 if the server saved the image.
+	 */
+	int RunClient(const std::string& socketPath, std::vector<std::string> fields)
+	{
+		for (size_t i = 1; i < 3 && i < fields.size(); i++)
+		{
+			std::error_code error;
+			std::filesystem::path path = std::filesystem::absolute(fields[i], error);
+			fields[i] = error ? fields[i] : path.string();
+		}
+
+		std::string job;
+		for (const std::string& field : fields)
+		{
+			job += (job.empty() ? "" : "\t") + field;
+		}
+
+		LocalSocket server;
+		std::string reply;
+		if (!server.Connect(socketPath) || !server.WriteLine(job) || !server.ReadLine(reply))
+		{
+			std::cout << "Could not reach a server on " << socketPath << std::endl;
+			return -1;
+		}
+
+		std::vector<std::string> replyFields = SplitFields(reply);
+		if (replyFields[0] != "ok")
+		{
+			std::cout << (replyFields.size() > 1 ? replyFields[1] : reply) << std::endl;
+			return -1;
+		}
+
+		if (replyFields.size() == 5 && replyFields[4] == "hit")
+		{
+			std::cout << "New image saved to " << fields[2] << std::endl;
+			std::cout << "Copied from cache in " << (size_t)std::stod(replyFields[3]) << "ms";
+		}
+		else if (replyFields.size() == 5)
+		{
+			std::cout << "New image saved to " << fields[2] << std::endl;
+			std::cout << "Load runtime: " << (size_t)std::stod(replyFields[1]) << "ms" << std::endl;
+			std::cout << "Gaussian Blur runtime: " << (size_t)std::stod(replyFields[2]) << "ms" << std::endl;
+			std::cout << "Save runtime: " << (size_t)std::stod(replyFields[3]) << "ms";
+		}
+
+		return 0;
+	}
+
+	/**
+	 * Blur an image with the approximate mode in the settings and with the exact kernel, and print how far apart they are,
+	 * over the whole image and away from its edges, where each approximation's accuracy is stated.
+	 * @param inputPath The image to blur.
+	 * @param settings The blur strength or sigma and the options, with Mode set to Box or Recursive.
+	 * @return 0, or -1 if the image could not be loaded.
+	 */
+	int RunCompare(const std::string& inputPath, const BlurSettings& settings)
+	{
+		Tga::TgaImage tgaImage;
+		BlurResult result;
+		if (!LoadImage(inputPath, tgaImage, settings, result))
+		{
+			std::cout << result.Error << std::endl;
+			return -1;
+		}
+
+		const Vec4* mappedPixels = tgaImage.GetMappedPixels();
+		const Vec4* pixels = mappedPixels != nullptr ? mappedPixels : tgaImage.GetPixelBuffer().get();
+		const size_t width = tgaImage.GetWidth();
+		const size_t height = tgaImage.GetHeight();
+
+		int32_t radius = 0;
+		float sigma = settings.Sigma;
+		if (sigma > 0.0f)
+		{
+			radius = Effects::GetSigmaRadius(sigma);
+		}
+		else
+		{
+			Effects::GetBlurParameters(settings.BlurValue, radius, sigma);
+		}
+
+		auto blur = [&](const EffectOptions& options)
+		{
+			return settings.Sigma > 0.0f
+				? Effects::GaussianBlurSigma(pixels, width, height, settings.Sigma, options)
+				: Effects::GaussianBlur(pixels, width, height, settings.BlurValue, options);
+		};
+
+		EffectOptions exactOptions = settings.Options;
+		exactOptions.Mode = EffectOptions::EBlurMode::Exact;
+
+		PixelPool::Buffer approximate = blur(settings.Options);
+		PixelPool::Buffer exact = blur(exactOptions);
+
+		/** How far apart the two blurs are over part of the image, in 8 bit levels. */
+		struct Difference
+		{
+			uint32_t MaxError = 0;
+			uint64_t TotalError = 0;
+			uint64_t SampleCount = 0;
+		};
+
+		Difference whole;
+		Difference inner;
+
+		// Channels the file does not store are zero in both blurs, so only the stored ones are counted.
+		uint8_t channelCount = tgaImage.GetChannelCount();
+		bool hasAlpha = channelCount == 2 || channelCount == 4;
+
+		for (size_t y = 0; y < height; y++)
+		{
+			bool innerRow = y >= (size_t)radius && y + radius < height;
+
+			for (size_t x = 0; x < width; x++)
+			{
+				const Vec4& a = approximate[(y * width) + x];
+				const Vec4& b = exact[(y * width) + x];
+				bool isInner = innerRow && x >= (size_t)radius && x + radius < width;
+
+				auto add = [&](const uint8_t approximateValue, const uint8_t exactValue)
+				{
+					uint32_t error = (uint32_t)std::abs((int32_t)approximateValue - (int32_t)exactValue);
+
+					for (Difference* difference : { &whole, isInner ? &inner : nullptr })
+					{
+						if (difference != nullptr)
+						{
+							difference->MaxError = std::max(difference->MaxError, error);
+							difference->TotalError += error;
+							difference->SampleCount++;
+						}
+					}
+				};
+
+				add(a.x, b.x);
+				add(a.y, b.y);
+				add(a.z, b.z);
+
+				if (hasAlpha)
+				{
+					add(a.w, b.w);
+				}
+			}
+		}
+
+		auto print = [](const std::string& name, const Difference& difference)
+		{
+			if (difference.SampleCount == 0)
+			{
+				std::cout << name << ": no pixels" << std::endl;
+				return;
+			}
+
+			double meanError = (double)difference.TotalError / difference.SampleCount;
+			std::cout << name << ": max error " << difference.MaxError << " levels, mean error " << std::fixed << std::setprecision(3) << meanError << " levels" << std::endl;
+		};
+
+		bool box = settings.Options.Mode == EffectOptions::EBlurMode::Box;
+		std::cout << (box ? "Box blur, " + std::to_string(settings.Options.BoxPassCount) + " passes," : std::string("Recursive blur,"))
+			<< " against the exact kernel at sigma " << std::fixed << std::setprecision(2) << sigma << ", radius " << radius << std::endl;
+
+		print("Whole image", whole);
+		print("Away from the edges", inner);
+		return 0;
+	}
+}
 
 int main(int argc, char** argv)
 {
-	if (argc != 4)
+	std::vector<std::string> arguments(argv + 1, argv + argc);
+	std::string mode = arguments.empty() ? "" : arguments[0];
+
+	auto printUsage = []()
 	{
 		std::cout << "Incorrect parameters. Correct usage is:" << std::endl;
-		std::cout << ".>ImageProcessing.exe <Input Image Path> <Output Image Path> <Blur Strength 0-1>" << std::endl;
-		return -1;
+		std::cout << ".>ImageProcessing.exe <Input Image Path> <Output Image Path> <Blur Strength 0-1 or Effect Chain> [--workers <Thread Count>] [--simd <scalar|sse4.1|avx2>] [--precision <float|fixed>] [--mode <exact|box|recursive>] [--box-passes <3-5>] [--boundary <clamp|mirror|wrap|zero>] [--sigma <Standard Deviation>] [--layout <auto|interleaved|planar>] [--streaming <off|on>] [--atomic <off|on>] [--dither <off|on>] [--cache <Cache Directory>] [--cache-size <Megabytes>]" << std::endl;
+		std::cout << ".>ImageProcessing.exe --batch <Input Directory or Manifest Path> <Output Directory> <Blur Strength 0-1 or Effect Chain> [--jobs <Image Count>] [--io-jobs <Image Count>] [--memory <Megabytes>] [any option above]" << std::endl;
+		std::cout << ".>ImageProcessing.exe --serve <Socket Path> [--workers <Thread Count>] [--cache <Cache Directory>] [--cache-size <Megabytes>]" << std::endl;
+		std::cout << ".>ImageProcessing.exe --submit <Socket Path> <Input Image Path> <Output Image Path> <Blur Strength 0-1 or Effect Chain> [any option above but --workers and --cache]" << std::endl;
+		std::cout << ".>ImageProcessing.exe --stop <Socket Path>" << std::endl;
+		std::cout << ".>ImageProcessing.exe --compare <Input Image Path> <Blur Strength 0-1> [--mode <box|recursive>] [--box-passes <3-5>] [--sigma <Standard Deviation>] [--workers <Thread Count>]" << std::endl;
+	};
+
+	// A server keeps one thread pool and result cache for every job it runs, so they are the only options it takes.
+	if (mode == "--serve")
+	{
+		if (arguments.size() < 2 || arguments.size() % 2 != 0)
+		{
+			printUsage();
+			return -1;
+		}
+
+		size_t workerCount = 0;
+		std::string cacheDirectory;
+		uintmax_t cacheMegabytes = 1024;
+
+		for (size_t i = 2; i < arguments.size(); i += 2)
+		{
+			try
+			{
+				if (arguments[i] == "--workers")
+				{
+					workerCount = std::stoul(arguments[i + 1]);
+				}
+				else if (arguments[i] == "--cache")
+				{
+					cacheDirectory = arguments[i + 1];
+				}
+				else if (arguments[i] == "--cache-size")
+				{
+					cacheMegabytes = std::stoull(arguments[i + 1]);
+				}
+				else
+				{
+					std::cout << "Unknown option " << arguments[i] << std::endl;
+					return -1;
+				}
+			}
+			catch (const std::exception&)
+			{
+				std::cout << "Incorrect argument for " << arguments[i] << ". Please enter a whole number." << std::endl;
+				return -1;
+			}
+		}
+
+		std::optional<ResultCache> cache;
+		if (!cacheDirectory.empty())
+		{
+			cache.emplace(cacheDirectory, cacheMegabytes * 1024 * 1024);
+		}
+
+		return RunServer(arguments[1], workerCount, cache ? &*cache : nullptr);
 	}
 
-	std::string inputPath = argv[1];
-	std::string outputPath = argv[2];
-	float blurValue = 0.0f;
+	if (mode == "--submit")
+	{
+		// The server checks the options, so they are only counted here.
+		if (arguments.size() < 5 || (arguments.size() - 5) % 2 != 0)
+		{
+			printUsage();
+			return -1;
+		}
+
+		std::vector<std::string> fields = { "blur" };
+		fields.insert(fields.end(), arguments.begin() + 2, arguments.end());
+		return RunClient(arguments[1], fields);
+	}
 
-	try
+	if (mode == "--stop")
 	{
-		blurValue = std::stof(argv[3]);
+		if (arguments.size() != 2)
+		{
+			printUsage();
+			return -1;
+		}
+
+		if (RunClient(arguments[1], { "shutdown" }) == 0)
+		{
+			std::cout << "Server on " << arguments[1] << " stopped";
+			return 0;
+		}
+
+		return -1;
 	}
-	catch (const std::exception&)
+
+	// Compare mode measures an approximate blur against the exact one, so the accuracy stated for each can be checked.
+	if (mode == "--compare")
 	{
-		std::cout << "Incorrect argument for blur strength. Please enter a number [0-1]. e.g. 0.5" << std::endl;
+		if (arguments.size() < 3 || arguments.size() % 2 != 1)
+		{
+			printUsage();
+			return -1;
+		}
+
+		BlurSettings settings;
+		settings.Options.WorkerCount = 0;
+
+		std::string error = ParseSettings(arguments, 2, settings, nullptr);
+		if (error.empty() && !settings.ChainSpec.empty())
+		{
+			error = "Compare mode takes a blur strength, not an effect chain.";
+		}
+
+		if (!error.empty())
+		{
+			std::cout << error << std::endl;
+			return -1;
+		}
+
+		// Box mode is the one compared unless another approximation is chosen.
+		if (settings.Options.Mode == EffectOptions::EBlurMode::Exact)
+		{
+			settings.Options.Mode = EffectOptions::EBlurMode::Box;
+		}
+
+		ThreadPool threadPool(settings.Options.WorkerCount);
+		settings.Options.Pool = &threadPool;
+
+		return RunCompare(arguments[1], settings);
+	}
+
+	// In batch mode the input and output are a directory or manifest and an output directory, after a leading --batch.
+	bool batch = mode == "--batch";
+	size_t first = batch ? 1 : 0;
+
+	// Three positional arguments, followed by any number of "--option value" pairs.
+	if (arguments.size() - first < 3 || (arguments.size() - first) % 2 != 1)
+	{
+		printUsage();
 		return -1;
 	}
 
-	Tga::TgaImage tgaImage;
-	if (tgaImage.LoadFromFile(inputPath) != Tga::EErrorCode::NoError)
+	std::string inputPath = arguments[first];
+	std::string outputPath = arguments[first + 1];
+	BlurSettings settings;
+	BatchSettings batchSettings;
+
+	// Use every hardware thread unless told otherwise.
+	settings.Options.WorkerCount = 0;
+
+	std::string error = ParseSettings(arguments, first + 2, settings, batch ? &batchSettings : nullptr);
+	if (!error.empty())
 	{
-		std::cout << "An error occurred while parsing image or image format not supported" << inputPath << std::endl;
-		std::cout << "Verify correct image path or try a different image." << std::endl;
+		std::cout << error << std::endl;
 		return -1;
 	}
-	
-	auto start = std::chrono::high_resolution_clock::now();
-	auto blurredPixels = Effects::GaussianBlur(tgaImage.GetPixelBuffer(), tgaImage.GetWidth(), tgaImage.GetHeight(), blurValue);
-	auto stop = std::chrono::high_resolution_clock::now();
 
-	auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+	std::optional<ResultCache> cache;
+	if (!settings.CacheDirectory.empty())
+	{
+		cache.emplace(settings.CacheDirectory, settings.CacheMegabytes * 1024 * 1024);
+		settings.Cache = &*cache;
+	}
+
+	// A batch keeps every core busy with separate images, so each image is blurred on one thread unless told otherwise.
+	if (batch)
+	{
+		if (!settings.WorkersSet)
+		{
+			settings.Options.WorkerCount = 1;
+		}
+
+		return RunBatch(inputPath, outputPath, settings, batchSettings.JobCount, batchSettings.IoJobCount, batchSettings.MemoryLimit);
+	}
+
+	// One pool serves the load, the blur and the save, rather than each starting threads of its own.
+	ThreadPool threadPool(settings.Options.WorkerCount);
+	settings.Options.Pool = &threadPool;
+
+	BlurResult result = BlurFile(inputPath, outputPath, settings);
 
-	tgaImage.SetPixelData(std::move(blurredPixels));
-	tgaImage.SaveToFile(outputPath, tgaImage.GetImageType());
+	if (!result.Success)
+	{
+		std::cout << result.Error << std::endl;
+		return -1;
+	}
 
 	std::cout << "New image saved to " << outputPath << std::endl;
-	std::cout << "Gaussian Blur runtime: " << duration.count() << "ms";
+
+	if (cache)
+	{
+		PrintCacheStatistics(*cache);
+		std::cout << std::endl;
+	}
+
+	if (result.CacheHit)
+	{
+		std::cout << "Copied from cache in " << (size_t)(result.SaveSeconds * 1000.0) << "ms";
+		return 0;
+	}
+
+	if (settings.Streaming)
+	{
+		std::cout << "Gaussian Blur runtime, including load and save: " << (size_t)(result.BlurSeconds * 1000.0) << "ms";
+		return 0;
+	}
+
+	// Report the load throughput against the size of the file on disk, so compressed and uncompressed files compare fairly.
+	double fileMegabytes = result.InputBytes / (1024.0 * 1024.0);
+
+	std::cout << "Load runtime: " << (size_t)(result.LoadSeconds * 1000.0) << "ms (" << (size_t)(fileMegabytes / std::max(result.LoadSeconds, 1e-9)) << " MB/s)" << std::endl;
+	std::cout << "Gaussian Blur runtime: " << (size_t)(result.BlurSeconds * 1000.0) << "ms";
 }
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <Vector.h>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * This class contains the inner loops used by the separable blur passes.
+ * Each kernel convolves a contiguous span of pixels against a set of tap pointers, so the same kernel
+ * serves both the horizontal pass (taps are neighbouring pixels) and the vertical pass (taps are neighbouring rows).
+ */
+class BlurKernels
+{
+public:
+
+	/** Enumeration of instruction sets a kernel can be built for, in order of preference. */
+	enum EInstructionSet : uint8_t
+	{
+		Scalar = 0,
+		SSE41 = 1,
+		AVX2 = 2
+	};
+
+	/**
+	 * Signature of a span convolution kernel. For every channel of every pixel x in [0, count):
+	 * destination[x] = saturate(round(sum over k of weights[k] * taps[k][x])).
+	 * @param taps One pointer per kernel tap, each pointing at the sample for destination[0].
+	 * @param weights The kernel weights, one per tap.
+	 * @param tapCount The number of taps in the kernel.
+	 * @param destination The pixels to write to. Must not overlap any tap.
+	 * @param count The number of pixels to write.
+	 */
+	using ConvolveFunction = void(*)(const Vec4* const* taps, const float* weights, const size_t tapCount, Vec4* destination, const size_t count);
+
+	/**
+	 * Signature of a fixed-point span convolution kernel. Weights are in 0.16 fixed point and must sum to exactly 1 << 16,
+	 * so the 32 bit accumulator can never overflow and the result never needs saturating. For every channel of every pixel:
+	 * destination[x] = (sum over k of weights[k] * taps[k][x] + (1 << 15)) >> 16.
+	 * Every instruction set gives bit identical results.
+	 * @param taps One pointer per kernel tap, each pointing at the sample for destination[0].
+	 * @param weights The kernel weights, one per tap.
+	 * @param tapCount The number of taps in the kernel.
+	 * @param destination The pixels to write to. Must not overlap any tap.
+	 * @param count The number of pixels to write.
+	 */
+	using ConvolveFixedFunction = void(*)(const Vec4* const* taps, const uint16_t* weights, const size_t tapCount, Vec4* destination, const size_t count);
+
+	/** The number of fractional bits in a fixed-point kernel weight. */
+	static const uint32_t FIXED_POINT_SHIFT = 16;
+
+	/**
+	 * The largest kernel radius that has kernels compiled for its exact tap count, with the tap loop unrolled.
+	 * Covers every radius GaussianBlur derives from its blur amount. Larger kernels use the general kernels.
+	 */
+	static const size_t MAX_SPECIALIZED_RADIUS = 20;
+
+	/**
+	 * Get the best instruction set supported by the CPU and operating system. Detected once and cached.
+	 */
+	static EInstructionSet GetSupportedInstructionSet();
+
+	/**
+	 * Get the convolution kernel for the best instruction set that is both supported and no higher than maxInstructionSet.
+	 * The chosen kernel gives the same result regardless of how a span is split into smaller spans.
+	 * @param maxInstructionSet The highest instruction set the caller allows.
+	 * @param tapCount The number of taps the kernel will be called with. Every call to the returned kernel must pass this count.
+	 */
+	static ConvolveFunction GetConvolveFunction(const EInstructionSet maxInstructionSet, const size_t tapCount);
+
+	/**
+	 * Get the fixed-point convolution kernel for the best instruction set that is both supported and no higher than maxInstructionSet.
+	 * @param maxInstructionSet The highest instruction set the caller allows.
+	 * @param tapCount The number of taps the kernel will be called with. Every call to the returned kernel must pass this count.
+	 * @param maxWeight The largest weight in the kernel. The vector kernels multiply in signed 16 bit lanes,
+	 * so weights of 1 << 15 or more always use the scalar kernel.
+	 */
+	static ConvolveFixedFunction GetConvolveFixedFunction(const EInstructionSet maxInstructionSet, const size_t tapCount, const uint16_t maxWeight);
+
+private:
+
+	/**
+	 * Constructor not allowed for static class.
+	 */
+	BlurKernels() = delete;
+
+	/**
+	 * Destructor not allowed for static class.
+	 */
+	~BlurKernels() = delete;
+
+	/**
+	 * Query the CPU for the instruction sets it supports.
+	 */
+	static EInstructionSet DetectInstructionSet();
+
+	/*
+	 * Each kernel is a template on the number of taps. A TapCount of 0 reads the tap count from the tapCount argument,
+	 * any other value fixes it at compile time so the tap loop can be unrolled, and tapCount is ignored.
+	 */
+
+	/**
+	 * Portable kernel, one pixel at a time.
+	 */
+	template<size_t TapCount>
+	static void ConvolveScalar(const Vec4* const* taps, const float* weights, size_t tapCount, Vec4* destination, const size_t count);
+
+	/**
+	 * SSE4.1 kernel, four pixels per iteration.
+	 */
+	template<size_t TapCount>
+	static void ConvolveSSE41(const Vec4* const* taps, const float* weights, size_t tapCount, Vec4* destination, const size_t count);
+
+	/**
+	 * AVX2 + FMA kernel, eight pixels per iteration.
+	 */
+	template<size_t TapCount>
+	static void ConvolveAVX2(const Vec4* const* taps, const float* weights, size_t tapCount, Vec4* destination, const size_t count);
+
+	/**
+	 * Portable fixed-point kernel, one pixel at a time.
+	 */
+	template<size_t TapCount>
+	static void ConvolveFixedScalar(const Vec4* const* taps, const uint16_t* weights, size_t tapCount, Vec4* destination, const size_t count);
+
+	/**
+	 * SSE4.1 fixed-point kernel, four pixels and two taps per multiply-add.
+	 */
+	template<size_t TapCount>
+	static void ConvolveFixedSSE41(const Vec4* const* taps, const uint16_t* weights, size_t tapCount, Vec4* destination, const size_t count);
+
+	/**
+	 * AVX2 fixed-point kernel, eight pixels and two taps per multiply-add.
+	 */
+	template<size_t TapCount>
+	static void ConvolveFixedAVX2(const Vec4* const* taps, const uint16_t* weights, size_t tapCount, Vec4* destination, const size_t count);
+};
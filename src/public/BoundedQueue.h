@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+/**
+ * A first in, first out queue between threads that holds at most a fixed number of items.
+ * Push waits while the queue is full and Pop waits while it is empty, so a fast producer is held back to the pace of
+ * its consumer instead of piling up items. Once the producers are done the queue is closed, which lets Pop drain
+ * what is left and then return nothing.
+ * @tparam T The type of item. Items are moved in and out.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+
+	/**
+	 * Constructor.
+	 * @param capacity The most items the queue holds at once, at least 1.
+	 */
+	explicit BoundedQueue(const size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	/**
+	 * Add an item to the back of the queue, waiting until there is room.
+	 * @param item The item to add.
+	 * @return False if the queue was closed, in which case the item is dropped.
+	 */
+	bool Push(T item)
+	{
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->notFull.wait(lock, [this]() { return this->closed || this->items.size() < this->capacity; });
+
+			if (this->closed)
+			{
+				return false;
+			}
+
+			this->items.push_back(std::move(item));
+		}
+
+		this->notEmpty.notify_one();
+		return true;
+	}
+
+	/**
+	 * Take the item from the front of the queue, waiting until there is one.
+	 * @return The item, or nothing once the queue is closed and empty.
+	 */
+	std::optional<T> Pop()
+	{
+		std::optional<T> item;
+
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->notEmpty.wait(lock, [this]() { return this->closed || !this->items.empty(); });
+
+			if (this->items.empty())
+			{
+				return std::nullopt;
+			}
+
+			item.emplace(std::move(this->items.front()));
+			this->items.pop_front();
+		}
+
+		this->notFull.notify_one();
+		return item;
+	}
+
+	/**
+	 * Close the queue. Waiting and later calls to Push fail, and Pop returns the remaining items and then nothing.
+	 */
+	void Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->closed = true;
+		}
+
+		this->notFull.notify_all();
+		this->notEmpty.notify_all();
+	}
+
+private:
+
+	/** The most items held at once. */
+	const size_t capacity;
+
+	/** The items waiting to be taken, oldest first. */
+	std::deque<T> items = {};
+
+	/** Set once no more items will be pushed. */
+	bool closed = false;
+
+	/** Guards the items and the closed flag. */
+	std::mutex mutex;
+
+	/** Signalled when an item is taken or the queue is closed. */
+	std::condition_variable notFull;
+
+	/** Signalled when an item is added or the queue is closed. */
+	std::condition_variable notEmpty;
+};
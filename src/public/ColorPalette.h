@@ -0,0 +1,87 @@
+#pragma once
+
+#include <Vector.h>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * This class builds the color map of a color-mapped image from its pixels, with an 8 bit index per pixel.
+ * Images with more distinct colors than an index can address are quantized to a palette chosen for them instead.
+ */
+class ColorPalette
+{
+public:
+
+	/** The most entries a palette can hold, as each pixel is stored as an 8 bit index. */
+	static constexpr size_t MAX_COLORS = 256;
+
+	/**
+	 * Collect the distinct colors of a block of pixels, in the order they first appear, and the index of each pixel's color.
+	 * Each pixel is looked up once in an open-addressing table keyed on its packed 32 bit value.
+	 * @param pixels The pixels to map.
+	 * @param count The number of pixels.
+	 * @param channelMask 0xFF for each channel to keep, zero for channels to ignore. Ignored channels are zero in the palette.
+	 * @param palette The colors to write to. Must hold MAX_COLORS entries.
+	 * @param indices The index into palette of each pixel, count bytes.
+	 * @param colorCount Set to the number of colors written to palette.
+	 * @return False if there are more than MAX_COLORS distinct colors. palette and indices are then only partly written.
+	 */
+	static bool Build(const Vec4* pixels, const size_t count, const Vec4 channelMask, Vec4* palette, uint8_t* indices, size_t& colorCount);
+
+	/**
+	 * Choose at most MAX_COLORS colors for an image by median cut and map every pixel to the nearest of them.
+	 * Used when an image has too many colors for Build. The pixels are counted into a histogram of 5 bits per channel,
+	 * or 4 with alpha, whose occupied cells are split into boxes, and each box becomes the mean of the pixels in it.
+	 * The nearest entry to every cell is stored in a lookup cube, so mapping a pixel costs a single load.
+	 * @param pixels The pixels to map, row by row.
+	 * @param width The number of pixels in a row.
+	 * @param height The number of rows.
+	 * @param channelMask 0xFF for each channel to keep, zero for channels to ignore. Alpha is only kept if w is 0xFF.
+	 * @param dither If true a 4 x 4 ordered dither is added before mapping, which trades banding in smooth gradients for fine noise.
+	 * @param palette The colors to write to. Must hold MAX_COLORS entries.
+	 * @param indices The index into palette of each pixel, width * height bytes.
+	 * @return The number of colors written to palette.
+	 */
+	static size_t Quantize(const Vec4* pixels, const size_t width, const size_t height, const Vec4 channelMask, const bool dither, Vec4* palette, uint8_t* indices);
+
+private:
+
+	/**
+	 * Constructor not allowed for static class.
+	 */
+	ColorPalette() = delete;
+
+	/**
+	 * Destructor not allowed for static class.
+	 */
+	~ColorPalette() = delete;
+
+	/**
+	 * Pack a pixel into one 32 bit value, keeping only the channels in channelMask.
+	 */
+	static uint32_t Pack(const Vec4 pixel, const uint32_t channelMask);
+
+	/**
+	 * Indicates whether the CPU supports the vector nearest color search. Detected once and cached.
+	 */
+	static bool UseVectorSearch();
+
+	/**
+	 * Find the nearest palette entry to the center of every histogram cell, measured as the squared distance over the
+	 * channels in channelMask. The first entry wins a tie.
+	 * @param palette The palette to search.
+	 * @param colorCount The number of entries in palette, from 1 to MAX_COLORS.
+	 * @param channelMask The channels the cells and palette hold.
+	 * @param cellBits The bits of each channel that select a cell.
+	 * @param channelCount The number of channels that select a cell, 3 or 4.
+	 * @param cube The palette index for each cell, 1 << (cellBits * channelCount) bytes.
+	 */
+	static void FillLookupCube(const Vec4* palette, const size_t colorCount, const Vec4 channelMask, const size_t cellBits, const size_t channelCount, uint8_t* cube);
+
+	/*
+	 * Portable search, one palette entry at a time, and SSE4.1 search, four entries at a time.
+	 */
+
+	static void FillLookupCubeScalar(const Vec4* palette, const size_t colorCount, const Vec4 channelMask, const size_t cellBits, const size_t channelCount, uint8_t* cube);
+	static void FillLookupCubeSSE41(const Vec4* palette, const size_t colorCount, const Vec4 channelMask, const size_t cellBits, const size_t channelCount, uint8_t* cube);
+};
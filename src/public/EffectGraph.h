@@ -0,0 +1,216 @@
+#pragma once
+
+#include <Vector.h>
+#include <Effects.h>
+#include <PixelPool.h>
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * A chain of effects applied to an image in one go, such as a blur, then a brightness change, then a gamma curve, then a sharpen.
+ * The chain is compiled into stages, one per convolution. Point operations are folded into a lookup table that is applied
+ * to each row as the stage before them finishes it, or to each source row as it is read, so they never cost a pass of their own.
+ * Each stage keeps only the window of rows its kernel spans and pulls rows from the stage before it as it needs them, so no
+ * intermediate image is ever held whole. The image is split into bands of rows, one per thread, each of which runs the whole chain.
+ * Blurs use the exact kernel whatever the Mode option, and the Wrap boundary is treated as Clamp since it would need the
+ * far edge of an intermediate image. A blur on its own gives the same result as the exact Effects::GaussianBlur.
+ */
+class EffectGraph
+{
+public:
+
+	/** The largest brightness factor or sharpen amount a chain accepts. Anything larger already clips every channel. */
+	static constexpr float MAX_FACTOR = 16.0f;
+
+	/** The smallest gamma a chain accepts. */
+	static constexpr float MIN_GAMMA = 0.05f;
+
+	/** The largest gamma a chain accepts. */
+	static constexpr float MAX_GAMMA = 20.0f;
+
+	/** Enumeration of the effects a chain can hold. */
+	enum EEffect : uint8_t
+	{
+		/** A Gaussian blur, with a 0-1 strength as for Effects::GaussianBlur. */
+		Blur = 0,
+
+		/** A Gaussian blur with a standard deviation in pixels, as for Effects::GaussianBlurSigma. */
+		BlurSigma = 1,
+
+		/** Multiplies the color channels by a factor. */
+		Brightness = 2,
+
+		/** Raises the color channels, scaled to 0-1, to the power of 1 / gamma. Values above 1 brighten the midtones. */
+		Gamma = 3,
+
+		/** An unsharp mask, which pushes the color channels away from a blur with a sigma of one pixel by the given amount. */
+		Sharpen = 4
+	};
+
+	/** One effect in a chain. */
+	struct Node
+	{
+		/** The effect. */
+		EEffect Effect = EEffect::Blur;
+
+		/** The strength, standard deviation, factor, gamma or amount of the effect. */
+		float Amount = 0.0f;
+	};
+
+	/**
+	 * Add a Gaussian blur to the end of the chain.
+	 * @param blurAmount Value of 0-1 inclusive. Higher value gives stronger blur effect.
+	 */
+	EffectGraph& AddGaussianBlur(const float blurAmount);
+
+	/**
+	 * Add a Gaussian blur with a given standard deviation to the end of the chain.
+	 * @param sigma The standard deviation of the Gaussian, in pixels. Clamped to Effects::MAX_SIGMA.
+	 */
+	EffectGraph& AddGaussianBlurSigma(const float sigma);
+
+	/**
+	 * Add a brightness change to the end of the chain.
+	 * @param factor The factor the color channels are multiplied by, up to MAX_FACTOR. 1 leaves them unchanged.
+	 */
+	EffectGraph& AddBrightness(const float factor);
+
+	/**
+	 * Add a gamma curve to the end of the chain.
+	 * @param gamma The gamma, from MIN_GAMMA to MAX_GAMMA. 1 leaves the image unchanged.
+	 */
+	EffectGraph& AddGamma(const float gamma);
+
+	/**
+	 * Add an unsharp mask to the end of the chain.
+	 * @param amount How far each color channel is pushed away from its blurred value, up to MAX_FACTOR. 0 leaves the image unchanged.
+	 */
+	EffectGraph& AddSharpen(const float amount);
+
+	/**
+	 * Parse a chain from a comma separated list of effects, each a name and an amount joined by a colon, such as
+	 * "blur:0.5,brightness:1.2,gamma:2.2,sharpen:0.8". The names are blur, sigma, brightness, gamma and sharpen.
+	 * @param spec The list of effects.
+	 * @param graph The chain to add the effects to.
+	 * @return False if an effect is unknown or has an amount out of range. graph is then only partly filled in.
+	 */
+	static bool Parse(const std::string& spec, EffectGraph& graph);
+
+	/**
+	 * Get the effects in the chain, in the order they are applied.
+	 */
+	const std::vector<Node>& GetNodes() const;
+
+	/**
+	 * Apply the chain to a read-only view of pixels. Every color channel is treated alike and w is taken as alpha,
+	 * so the color channels may be in either RGB or BGR order and the result keeps that order.
+	 * @param pixels The pixel data to read. It is not modified.
+	 * @param width The width of the pixel data.
+	 * @param height The height of the pixel data.
+	 * @param options Options controlling how the blurs are executed. The result is identical for any WorkerCount.
+	 * @return The pixels with every effect applied, in a new buffer.
+	 */
+	PixelPool::Buffer Apply(const Vec4* pixels, const size_t width, const size_t height, const EffectOptions& options = {}) const;
+
+private:
+
+	/** A table mapping each value of a color channel to its new value. */
+	using ChannelTable = std::array<uint8_t, 256>;
+
+	/** A convolution in the compiled chain, with the point operations after it folded into a lookup table. */
+	struct Stage
+	{
+		/** The radius of the kernel. */
+		int32_t Radius = 0;
+
+		/** Convolves a span of pixels against one row pointer per kernel tap, with the weights already bound. */
+		std::function<void(const Vec4* const* taps, Vec4* destination, const size_t count)> Convolve = nullptr;
+
+		/** Indicates the stage is an unsharp mask rather than a blur. */
+		bool IsSharpen = false;
+
+		/** The amount of an unsharp mask in 8.8 fixed point. */
+		int32_t SharpenWeight = 0;
+
+		/** The table applied to the color channels of each finished row. */
+		ChannelTable Table = {};
+
+		/** Indicates Table is not the identity. */
+		bool HasTable = false;
+	};
+
+	/** The chain compiled into stages. */
+	struct Plan
+	{
+		/** The convolutions, in order. */
+		std::vector<Stage> Stages = {};
+
+		/** The table applied to the color channels of each source row, for point operations before the first convolution. */
+		ChannelTable SourceTable = {};
+
+		/** Indicates SourceTable is not the identity. */
+		bool HasSourceTable = false;
+
+		/** How the convolutions sample beyond the edges of the image. */
+		EffectOptions::EBoundaryMode Boundary = EffectOptions::EBoundaryMode::Clamp;
+	};
+
+	/** The working rows of one stage for one band of the image. */
+	struct StageRows
+	{
+		/** A ring of horizontally filtered input rows, one slot for each row the kernel spans. */
+		std::vector<Vec4> Filtered = {};
+
+		/** A ring of unfiltered input rows, only kept by an unsharp mask, which needs the row it sharpens. */
+		std::vector<Vec4> Input = {};
+
+		/** The row last produced, when it is not written straight to the output. */
+		std::vector<Vec4> Output = {};
+
+		/** The row pointers handed to the vertical convolution. */
+		std::vector<const Vec4*> Taps = {};
+
+		/** Scratch space for the horizontal convolution. */
+		std::vector<Vec4> Scanline = {};
+
+		/** Row pointers for the horizontal convolution. */
+		std::vector<const Vec4*> ScanlineTaps = {};
+
+		/** A row of transparent black, read for samples outside the image by the Zero boundary. */
+		std::vector<Vec4> ZeroRow = {};
+
+		/** The next input row to filter into the ring, or -1 before the first row is asked for. */
+		int64_t NextInputRow = -1;
+	};
+
+	/** The effects in the chain, in order. */
+	std::vector<Node> nodes = {};
+
+	/**
+	 * Compile the chain into stages, binding each kernel for the precision and instruction set in the options.
+	 */
+	Plan Compile(const EffectOptions& options) const;
+
+	/**
+	 * Produce a row of one stage of the chain for a band, pulling the rows it needs from the stages before it.
+	 * Rows of a stage must be asked for in order, one after another, from the first row the band needs.
+	 * @param plan The compiled chain.
+	 * @param rows The working rows of every stage for the band. Index 0 is the source.
+	 * @param stage The stage, where 0 is the source and n is the n-th convolution.
+	 * @param pixels The source pixels.
+	 * @param width The width of the image.
+	 * @param height The height of the image.
+	 * @param row The row to produce.
+	 * @param destination Where to write the row, or null to write it to the stage's own row.
+	 * @return The row, valid until the stage is asked for the next one.
+	 */
+	static const Vec4* GetStageRow(const Plan& plan, std::vector<StageRows>& rows, const size_t stage, const Vec4* pixels, const size_t width, const size_t height, const int64_t row, Vec4* destination);
+
+	/**
+	 * Apply a table to the color channels of a row, leaving alpha as it is.
+	 */
+	static void ApplyTable(const ChannelTable& table, Vec4* row, const size_t width);
+};
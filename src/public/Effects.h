@@ -1,25 +1,214 @@
 #pragma once
 
 #include <Vector.h>
+#include <BlurKernels.h>
+#include <PixelPool.h>
+#include <PlanarImage.h>
 #include <vector>
 #include <memory>
+#include <functional>
+#include <optional>
+
+class ThreadPool;
+
+/** Options controlling how an effect is executed. */
+struct EffectOptions
+{
+	/** Enumeration of the arithmetic used by convolution effects. */
+	enum EPrecision : uint8_t
+	{
+		Float = 0,
+		FixedPoint = 1
+	};
+
+	/** Enumeration of the algorithms GaussianBlur can use. */
+	enum EBlurMode : uint8_t
+	{
+		/** Separable convolution with the exact Gaussian kernel. Cost grows linearly with the radius. */
+		Exact = 0,
+
+		/** Approximation by repeated running-sum box blurs. Cost per pixel does not depend on the radius. */
+		Box = 1,
+
+		/** Young-van Vliet recursive filter. Cost per pixel does not depend on sigma, best suited to very large sigma. */
+		Recursive = 2
+	};
+
+	/** Enumeration of how convolution effects sample pixels that lie outside the image. */
+	enum EBoundaryMode : uint8_t
+	{
+		/** Repeat the edge pixel of the row or column. */
+		Clamp = 0,
+
+		/** Reflect about the edge pixel without repeating it, so sample -1 reads sample 1. */
+		Mirror = 1,
+
+		/** Continue from the opposite edge of the row or column. */
+		Wrap = 2,
+
+		/** Treat samples outside the image as transparent black. */
+		Zero = 3
+	};
+
+	/** The number of threads to split the work across. A value of 0 uses one thread per hardware thread. */
+	size_t WorkerCount = 1;
+
+	/** The highest instruction set the inner loops may use. The best one supported by the CPU up to this is picked at runtime. */
+	BlurKernels::EInstructionSet MaxInstructionSet = BlurKernels::EInstructionSet::AVX2;
+
+	/**
+	 * The arithmetic used by convolution effects. FixedPoint uses 16 bit integer weights and 32 bit accumulators,
+	 * which is faster and gives bit identical output on every compiler and instruction set.
+	 */
+	EPrecision Precision = EPrecision::Float;
+
+	/** The algorithm used by GaussianBlur. */
+	EBlurMode Mode = EBlurMode::Exact;
+
+	/** How the Exact blur samples outside the image. Box and Recursive modes always clamp. */
+	EBoundaryMode Boundary = EBoundaryMode::Clamp;
+
+	/** The number of box blurs used to approximate the Gaussian in Box mode, 3-5. More passes give a closer approximation. */
+	uint32_t BoxPassCount = 3;
+
+	/**
+	 * A thread pool to run on, which is kept between calls so its threads are only started once. WorkerCount is ignored
+	 * when this is set. When null, each call starts WorkerCount threads of its own and stops them before returning.
+	 */
+	ThreadPool* Pool = nullptr;
+};
 
 /** This class contains any effects that can be applied to an image. */
 class Effects
 {
 public:
 
+	/**
+	* The largest standard deviation a blur accepts, in pixels. Larger values are clamped to it, so the kernels, box widths
+	* and row buffers stay bounded whatever sigma is asked for.
+	*/
+	static constexpr float MAX_SIGMA = 1000.0f;
+
+	/**
+	* Supplies the next row of an image to an effect that streams rows.
+	* @param row The row to fill, one pixel per column.
+	*/
+	using RowReader = std::function<void(Vec4* row)>;
+
+	/**
+	* Receives the next finished row from an effect that streams rows.
+	* @param row The finished row. Only valid for the duration of the call.
+	*/
+	using RowWriter = std::function<void(const Vec4* row)>;
+
 	/**
 	* Applies a Gaussian Blur effect to the given pixels.
 	* @param pixels The pixel data to modify.
 	* @param width The width of the pixel data.
 	* @param height The height of the pixel data.
 	* @param blurAmount Value of 0-1 inclusive. Higher value gives stronger blur effect.
+	* @param options Options controlling how the effect is executed. The result is identical for any WorkerCount.
 	*/
-	static std::unique_ptr<Vec4[]> const GaussianBlur(const std::shared_ptr<Vec4[]>& pixels, const size_t width, const size_t height, float blurAmount);
+	static PixelPool::Buffer const GaussianBlur(const std::shared_ptr<Vec4[]>& pixels, const size_t width, const size_t height, float blurAmount, const EffectOptions& options = {});
+
+	/**
+	* Applies a Gaussian Blur effect with a given standard deviation to the given pixels.
+	* Unlike GaussianBlur the radius is not capped, it is chosen to cover three standard deviations.
+	* @param pixels The pixel data to modify.
+	* @param width The width of the pixel data.
+	* @param height The height of the pixel data.
+	* @param sigma The standard deviation of the Gaussian, in pixels. Higher value gives stronger blur effect.
+	* @param options Options controlling how the effect is executed. The result is identical for any WorkerCount.
+	*/
+	static PixelPool::Buffer const GaussianBlurSigma(const std::shared_ptr<Vec4[]>& pixels, const size_t width, const size_t height, float sigma, const EffectOptions& options = {});
+
+	/**
+	* Applies a Gaussian Blur effect to a read-only view of pixels, such as pixels mapped straight from a file.
+	* Every channel is blurred alike, so the channels may be in any order and the result keeps that order.
+	* @param pixels The pixel data to read. It is not modified.
+	* @param width The width of the pixel data.
+	* @param height The height of the pixel data.
+	* @param blurAmount Value of 0-1 inclusive. Higher value gives stronger blur effect.
+	* @param options Options controlling how the effect is executed. The result is identical for any WorkerCount.
+	* @return The blurred pixels, in a new buffer.
+	*/
+	static PixelPool::Buffer GaussianBlur(const Vec4* pixels, const size_t width, const size_t height, float blurAmount, const EffectOptions& options = {});
+
+	/**
+	* Applies a Gaussian Blur effect with a given standard deviation to a read-only view of pixels.
+	* @param pixels The pixel data to read. It is not modified.
+	* @param width The width of the pixel data.
+	* @param height The height of the pixel data.
+	* @param sigma The standard deviation of the Gaussian, in pixels. Higher value gives stronger blur effect.
+	* @param options Options controlling how the effect is executed. The result is identical for any WorkerCount.
+	* @return The blurred pixels, in a new buffer.
+	*/
+	static PixelPool::Buffer GaussianBlurSigma(const Vec4* pixels, const size_t width, const size_t height, float sigma, const EffectOptions& options = {});
+
+	/**
+	* Applies a Gaussian Blur effect to each plane of a planar image. Gives the same result as blurring the
+	* interleaved pixels, but only the channels the image has are read, blurred and written.
+	* @param image The image to blur.
+	* @param blurAmount Value of 0-1 inclusive. Higher value gives stronger blur effect.
+	* @param options Options controlling how the effect is executed. The result is identical for any WorkerCount.
+	* @return The blurred image.
+	*/
+	static PlanarImage GaussianBlur(const PlanarImage& image, float blurAmount, const EffectOptions& options = {});
+
+	/**
+	* Applies a Gaussian Blur effect with a given standard deviation to each plane of a planar image.
+	* @param image The image to blur.
+	* @param sigma The standard deviation of the Gaussian, in pixels. Higher value gives stronger blur effect.
+	* @param options Options controlling how the effect is executed. The result is identical for any WorkerCount.
+	* @return The blurred image.
+	*/
+	static PlanarImage GaussianBlurSigma(const PlanarImage& image, float sigma, const EffectOptions& options = {});
+
+	/**
+	* Applies a Gaussian Blur effect to an image streamed one row at a time, for images too large to hold in memory.
+	* Only a window of rows around the ones being blurred is kept, so memory grows with width * radius rather than width * height.
+	* Always uses the exact kernel whatever the Mode option, and the Wrap boundary is treated as Clamp since it
+	* would need the far edge of the image. The result is identical to the exact GaussianBlur of the whole image.
+	* @param width The width of the image.
+	* @param height The height of the image.
+	* @param readRow Called once for each row, in order, on the calling thread.
+	* @param writeRow Called once for each blurred row, in order, on the calling thread.
+	* @param blurAmount Value of 0-1 inclusive. Higher value gives stronger blur effect.
+	* @param options Options controlling how the effect is executed. The result is identical for any WorkerCount.
+	*/
+	static void GaussianBlurRows(const size_t width, const size_t height, const RowReader& readRow, const RowWriter& writeRow, float blurAmount, const EffectOptions& options = {});
+
+	/**
+	* Applies a Gaussian Blur effect with a given standard deviation to an image streamed one row at a time.
+	* @param width The width of the image.
+	* @param height The height of the image.
+	* @param readRow Called once for each row, in order, on the calling thread.
+	* @param writeRow Called once for each blurred row, in order, on the calling thread.
+	* @param sigma The standard deviation of the Gaussian, in pixels. Higher value gives stronger blur effect.
+	* @param options Options controlling how the effect is executed. The result is identical for any WorkerCount.
+	*/
+	static void GaussianBlurRowsSigma(const size_t width, const size_t height, const RowReader& readRow, const RowWriter& writeRow, float sigma, const EffectOptions& options = {});
+
+	/**
+	* Get the radius and sigma GaussianBlur uses for a blur amount.
+	* @param blurAmount Value of 0-1 inclusive.
+	* @param radius Set to the radius of the exact kernel.
+	* @param sigma Set to the standard deviation of the Gaussian.
+	*/
+	static void GetBlurParameters(float blurAmount, int32_t& radius, float& sigma);
+
+	/**
+	* Get the radius GaussianBlurSigma uses for a standard deviation.
+	* @param sigma The standard deviation.
+	* @return The radius of the exact kernel.
+	*/
+	static int32_t GetSigmaRadius(const float sigma);
 
 private:
 
+	/** Effect chains are built from the same kernels and row filters. */
+	friend class EffectGraph;
+
 	/**
 	 * Constructor not allowed for static class.
 	 */
@@ -31,10 +220,260 @@ private:
 	~Effects() = delete;
 
 	/**
-	* Creates a normalized 1D Gaussian matrix of values.
+	* Blurs one row of pixels into a separate destination. Holds its own scratch space, so every thread creates its own.
+	* @param source The row to read from.
+	* @param destination The row to write to. Must not overlap source.
+	* @param width The number of pixels in the row.
+	*/
+	using RowBlur = std::function<void(const Vec4* source, Vec4* destination, const size_t width)>;
+
+	/**
+	* Blurs a block of columns into a separate destination. Holds its own scratch space, so every thread creates its own.
+	* @param source The pixel data to read from. The block may be overwritten, it is only used as scratch space afterwards.
+	* @param destination The pixel data to write to. Must not overlap source.
+	* @param pitch The number of pixels from the start of one row to the start of the next.
+	* @param height The number of rows.
+	* @param firstColumn The first column of the block.
+	* @param lastColumn One past the last column of the block.
+	*/
+	using ColumnBlur = std::function<void(Vec4* source, Vec4* destination, const size_t pitch, const size_t height, const size_t firstColumn, const size_t lastColumn)>;
+
+	/** Convolves a span of pixels against one pointer per kernel tap, with the kernel weights already bound. */
+	using SpanConvolver = std::function<void(const Vec4* const* taps, Vec4* destination, const size_t count)>;
+
+	/** The horizontal and vertical halves of a separable blur, with the blur's parameters already bound. */
+	struct SeparableBlur
+	{
+		/** Creates the horizontal half for one thread. */
+		std::function<RowBlur()> CreateRowBlur = nullptr;
+
+		/** Creates the vertical half for one thread. */
+		std::function<ColumnBlur()> CreateColumnBlur = nullptr;
+
+		/** The number of columns the vertical half should be given at a time. */
+		size_t ColumnBlockWidth = 0;
+	};
+
+	/**
+	* Applies a separable Gaussian Blur using the algorithm selected in the options.
+	* @param pixels The pixel data to read from.
+	* @param width The width of the pixel data.
+	* @param height The height of the pixel data.
+	* @param radius The radius of the exact kernel.
+	* @param sigma The standard deviation of the Gaussian.
+	* @param options Options controlling how the effect is executed.
+	* @return The blurred pixel data.
+	*/
+	static PixelPool::Buffer ApplyGaussianBlur(const Vec4* pixels, const size_t width, const size_t height, const int32_t radius, const float sigma, const EffectOptions& options);
+
+	/**
+	* Applies a separable Gaussian Blur to every plane of a planar image using the algorithm selected in the options.
+	* Rows are blurred four at a time, packed into the four channels of a line of Vec4, so every algorithm's
+	* row and column halves are shared with the interleaved path.
+	* @param image The image to read from.
+	* @param radius The radius of the exact kernel.
+	* @param sigma The standard deviation of the Gaussian.
+	* @param options Options controlling how the effect is executed.
+	* @return The blurred image.
+	*/
+	static PlanarImage ApplyGaussianBlur(const PlanarImage& image, const int32_t radius, const float sigma, const EffectOptions& options);
+
+	/**
+	* Applies a separable Gaussian Blur with the exact kernel to an image streamed one row at a time.
+	* Rows are read in batches, blurred horizontally into a ring of rows, and each batch of output rows
+	* is blurred vertically from the ring as soon as every row it depends on has arrived.
+	* @param width The width of the image.
+	* @param height The height of the image.
+	* @param readRow Supplies the rows of the image in order.
+	* @param writeRow Receives the blurred rows in order.
+	* @param radius The radius of the exact kernel.
+	* @param sigma The standard deviation of the Gaussian.
+	* @param options Options controlling how the effect is executed.
+	*/
+	static void ApplyGaussianBlurRows(const size_t width, const size_t height, const RowReader& readRow, const RowWriter& writeRow, const int32_t radius, const float sigma, const EffectOptions& options);
+
+	/**
+	* Set up the algorithm selected in the options.
+	* @param radius The radius of the exact kernel.
+	* @param sigma The standard deviation of the Gaussian.
+	* @param options Options controlling how the effect is executed.
+	*/
+	static SeparableBlur CreateSeparableBlur(const int32_t radius, const float sigma, const EffectOptions& options);
+
+	/**
+	* Set up a separable convolution with the exact Gaussian kernel.
+	*/
+	static SeparableBlur CreateExactBlur(const int32_t radius, const float sigma, const EffectOptions& options);
+
+	/**
+	* Bind the exact Gaussian kernel to the span kernel for the precision and instruction set selected in the options.
+	*/
+	static SpanConvolver CreateSpanConvolver(const int32_t radius, const float sigma, const EffectOptions& options);
+
+	/**
+	* Set up an approximation of a Gaussian by repeated box blurs, each done with running sums so the cost per pixel
+	* does not depend on sigma. Edges are clamped per row and per column.
+	*/
+	static SeparableBlur CreateBoxBlur(const float sigma, const EffectOptions& options);
+
+	/**
+	* Set up an approximation of a Gaussian by a recursive filter run forwards then backwards over every row,
+	* then every column. The cost per pixel does not depend on sigma. Edges are clamped per row and per column.
+	*/
+	static SeparableBlur CreateRecursiveBlur(const float sigma);
+
+	/**
+	* Get the thread pool set in the options, or start one with WorkerCount threads if there is none.
+	* @param options Options controlling how the effect is executed.
+	* @param ownedPool Holds the pool started for the call, so it lives as long as the caller's copy of this.
+	*/
+	static ThreadPool& GetThreadPool(const EffectOptions& options, std::optional<ThreadPool>& ownedPool);
+
+	/**
+	* Runs the vertical half of a blur over a range of columns, one strip per thread, each strip walked in blocks.
+	* @param threadPool The threads to split the strips across.
+	* @param blur The blur.
+	* @param source The pixel data to read from. May be overwritten.
+	* @param destination The pixel data to write to.
+	* @param pitch The number of pixels from the start of one row to the start of the next.
+	* @param columnCount The number of columns to blur, starting from the first.
+	* @param height The number of rows.
+	*/
+	static void BlurColumnBlocks(ThreadPool& threadPool, const SeparableBlur& blur, Vec4* source, Vec4* destination, const size_t pitch, const size_t columnCount, const size_t height);
+
+	/** Coefficients of a third order recursive Gaussian filter. */
+	struct RecursiveFilter
+	{
+		/** Gain applied to each input sample. */
+		double B = 0.0;
+
+		/** Feedback weights for the previous three outputs. */
+		double A[3] = {};
+
+		/**
+		* Maps the causal filter state at the end of a line, relative to the edge value, to the initial state
+		* of the anti-causal filter. Extends the line with its last value, as clamp-to-edge does.
+		*/
+		double EndMatrix[3][3] = {};
+	};
+
+	/**
+	* Get the coefficients of the Young-van Vliet recursive Gaussian filter.
+	* @param sigma The standard deviation of the Gaussian to approximate. Values below 0.5 are treated as 0.5.
+	* @return The filter coefficients.
+	*/
+	static RecursiveFilter GetRecursiveFilter(const float sigma);
+
+	/**
+	* Runs the recursive filter forwards then backwards over a group of lines that are next to each other in memory.
+	* Line l starts at source[l], and consecutive samples along a line are sampleStride pixels apart.
+	* @param source The pixel data to read from.
+	* @param destination The pixel data to write to. May be the same as source.
+	* @param lineLength The number of samples in each line.
+	* @param lineCount The number of lines.
+	* @param sampleStride The distance in pixels between consecutive samples along a line.
+	* @param filter The filter coefficients.
+	* @param causal Scratch space for the output of the forwards pass. Resized as needed.
+	*/
+	static void RecursiveBlurLines(const Vec4* source, Vec4* destination, const size_t lineLength, const size_t lineCount, const size_t sampleStride, const RecursiveFilter& filter, std::vector<double>& causal);
+
+	/**
+	* Get the radii of the box blurs whose repeated application best matches a Gaussian.
+	* @param sigma The standard deviation of the Gaussian to approximate.
+	* @param passCount The number of box blurs.
+	* @return One radius per box blur.
+	*/
+	static std::vector<int32_t> GetBoxRadii(const float sigma, const uint32_t passCount);
+
+	/**
+	* Applies a box blur to a line of pixels with a running sum, clamping samples outside the line to the edge.
+	* @param source The pixels to read from.
+	* @param destination The pixels to write to. Must not overlap source.
+	* @param length The number of pixels in the line.
+	* @param radius The radius of the box.
+	*/
+	static void BoxBlurRow(const Vec4* source, Vec4* destination, const size_t length, const int32_t radius);
+
+	/**
+	* The number of bytes a vertical pass may keep in use while it moves down a block of columns.
+	* Sized to fit in a typical L2 cache alongside the rows being written.
+	*/
+	static const size_t VERTICAL_PASS_CACHE_BYTES = 512 * 1024;
+
+	/**
+	* Get how many columns a vertical pass should process at a time, so that its working set
+	* stays within VERTICAL_PASS_CACHE_BYTES however wide the image is.
+	* @param bytesPerColumn The number of bytes the pass keeps in use for each column of the block.
+	* @return The number of columns in a block. Always a multiple of 8 so vector kernels never split a block into tails.
+	*/
+	static size_t GetColumnBlockWidth(const size_t bytesPerColumn);
+
+	/**
+	* Applies a vertical box blur to a strip of columns with running sums, one row at a time so that memory is read contiguously.
+	* Samples outside the image are clamped to the top and bottom rows.
+	* @param source The pixel data to read from.
+	* @param destination The pixel data to write to. Must not overlap source.
+	* @param width The width of the pixel data.
+	* @param height The height of the pixel data.
+	* @param radius The radius of the box.
+	* @param firstColumn The first column of the strip.
+	* @param lastColumn One past the last column of the strip.
+	*/
+	static void BoxBlurColumns(const Vec4* source, Vec4* destination, const size_t width, const size_t height, const int32_t radius, const size_t firstColumn, const size_t lastColumn);
+
+	/**
+	* Gets a normalized 1D Gaussian matrix of values. The matrices for every step of 0.05 in blur strength are computed
+	* at compile time, and any other matrix is computed once and then shared by every later call.
 	* @param radius The radius of the kernel. Higher value gives stronger blurring effect.
 	* @param sigma The standard deviation to use for the kernel. Higher value gives stronger blurring effect.
 	* @return The normalized Gaussian matrix.
 	*/
-	static std::vector<float> Get1DMatrix(const int32_t radius, const float sigma);
+	static std::shared_ptr<const std::vector<float>> Get1DMatrix(const int32_t radius, const float sigma);
+
+	/**
+	* Gets a normalized 1D Gaussian matrix of values in 0.16 fixed point, from the table or cache like Get1DMatrix.
+	* @param radius The radius of the kernel. Higher value gives stronger blurring effect.
+	* @param sigma The standard deviation to use for the kernel. Higher value gives stronger blurring effect.
+	* @return The Gaussian matrix, quantized so that the values sum to exactly 1 << 16.
+	*/
+	static std::shared_ptr<const std::vector<uint16_t>> Get1DMatrixFixed(const int32_t radius, const float sigma);
+
+	/**
+	* Map a sample index along a row or column onto the sample that should be read in its place.
+	* @param index The index of the sample, which may lie outside [0, length).
+	* @param length The number of samples in the row or column.
+	* @param boundary How samples outside the row or column are read.
+	* @return The index of the sample to read, or -1 if the sample should read as zero.
+	*/
+	static int64_t GetBoundarySample(const int64_t index, const int64_t length, const EffectOptions::EBoundaryMode boundary);
+
+	/**
+	* Applies a 1D kernel in the horizontal orientation to a row.
+	* The row is copied into a scanline padded by radius pixels either side, so the whole row is one span with no bounds checks.
+	* @param source The row to read from.
+	* @param destination The row to write to. Must not overlap source.
+	* @param width The number of pixels in the row.
+	* @param radius The radius of the kernel.
+	* @param boundary How samples beyond the ends of the row are read.
+	* @param convolve Convolves a span of pixels against the kernel.
+	* @param scanline Scratch space for the padded row. Resized as needed.
+	* @param taps Scratch space for the tap pointers. Resized as needed.
+	*/
+	static void BlurRowHorizontal(const Vec4* source, Vec4* destination, const size_t width, const int32_t radius, const EffectOptions::EBoundaryMode boundary, const SpanConvolver& convolve, std::vector<Vec4>& scanline, std::vector<const Vec4*>& taps);
+
+	/**
+	* Applies a 1D kernel in the vertical orientation to a strip of columns.
+	* The taps for each output row are pointers to whole source rows, resolved against the boundary once per row,
+	* so every row of the strip is one span with no bounds checks.
+	* @param source The pixel data to read from.
+	* @param destination The pixel data to write to. Must not overlap source.
+	* @param width The width of the pixel data.
+	* @param height The height of the pixel data.
+	* @param radius The radius of the kernel.
+	* @param boundary How samples beyond the top and bottom of each column are read.
+	* @param convolve Convolves a span of pixels against the kernel.
+	* @param firstColumn The first column of the strip.
+	* @param lastColumn One past the last column of the strip.
+	*/
+	static void BlurColumnsVertical(const Vec4* source, Vec4* destination, const size_t width, const size_t height, const int32_t radius, const EffectOptions::EBoundaryMode boundary, const SpanConvolver& convolve, const size_t firstColumn, const size_t lastColumn);
 };
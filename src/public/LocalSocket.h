@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * A stream socket bound to a path on the local machine (AF_UNIX), carrying text one line at a time.
+ * A listening socket hands out a connected socket for each client that connects to its path.
+ * The socket is closed when the LocalSocket is closed or destroyed.
+ */
+class LocalSocket
+{
+public:
+
+	LocalSocket() = default;
+
+	/**
+	 * The destructor. Closes the socket.
+	 */
+	~LocalSocket();
+
+	LocalSocket(const LocalSocket&) = delete;
+	LocalSocket& operator=(const LocalSocket&) = delete;
+
+	LocalSocket(LocalSocket&& other) noexcept;
+	LocalSocket& operator=(LocalSocket&& other) noexcept;
+
+	/**
+	 * Bind to a path and listen for clients, replacing any socket already open.
+	 * A socket left at the path by a server that did not shut down cleanly is removed first. Any other file at the path, or a
+	 * socket a server still answers on, is left alone and the listen fails. On POSIX systems only the owner of the process
+	 * may connect. On Windows the socket file takes the permissions of its directory.
+	 * @param path The path of the socket file. Must be shorter than about 100 characters.
+	 * @return True if the socket is listening.
+	 */
+	bool Listen(const std::string& path);
+
+	/**
+	 * Wait for a client to connect to a listening socket.
+	 * @return The socket connected to the client, which is not open if the wait failed.
+	 */
+	LocalSocket Accept();
+
+	/**
+	 * Connect to a listening socket, replacing any socket already open.
+	 * @param path The path the server is listening on.
+	 * @return True if the socket is connected.
+	 */
+	bool Connect(const std::string& path);
+
+	/**
+	 * Close the socket. A listening socket also removes its file.
+	 */
+	void Close();
+
+	/**
+	 * Indicates the socket is listening or connected.
+	 */
+	bool IsOpen() const;
+
+	/**
+	 * Read the next line from a connected socket, waiting until it has arrived.
+	 * @param line Set to the line, without the trailing newline.
+	 * @return False if the connection was closed or failed before a whole line arrived.
+	 */
+	bool ReadLine(std::string& line);
+
+	/**
+	 * Write a line to a connected socket.
+	 * @param line The line to write. A newline is added after it.
+	 * @return False if the connection was closed or failed.
+	 */
+	bool WriteLine(const std::string& line);
+
+private:
+
+	/** The operating system's handle for the socket, or -1 if none is open. */
+	intptr_t handle = -1;
+
+	/** The path a listening socket is bound to, removed when it closes. Empty for connected sockets. */
+	std::string listenPath = {};
+
+	/** Bytes received after the end of the last line returned by ReadLine. */
+	std::string received = {};
+};
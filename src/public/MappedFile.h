@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+/**
+ * A read-only view of a whole file, mapped into memory by the operating system.
+ * Pages are read from disk as they are first touched, and nothing is copied into the process.
+ * The view stays valid until the MappedFile is closed or destroyed.
+ */
+class MappedFile
+{
+public:
+
+	MappedFile() = default;
+
+	/**
+	 * The destructor. Unmaps the file.
+	 */
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/**
+	 * Map a file into memory, replacing any file already mapped.
+	 * @param filename The path of the file to map.
+	 * @return True if the file was mapped. Empty files cannot be mapped.
+	 */
+	bool Open(const std::string& filename);
+
+	/**
+	 * Unmap the file. Any view of it becomes invalid.
+	 */
+	void Close();
+
+	/**
+	 * Get the contents of the file, or an empty span if no file is mapped.
+	 */
+	std::span<const uint8_t> GetData() const;
+
+private:
+
+	/** The start of the mapping. */
+	const uint8_t* data = nullptr;
+
+	/** The size of the mapping, which is the size of the file. */
+	size_t size = 0;
+};
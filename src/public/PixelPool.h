@@ -0,0 +1,121 @@
+#pragma once
+
+#include <Vector.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+
+/**
+ * A pool of 64 byte aligned pixel buffers that are recycled rather than returned to the system.
+ * Buffers are handed out uninitialized, so an image that is about to be overwritten is never zeroed first, and a buffer
+ * released by one job is reused by the next, so a batch of images stops paying for fresh pages once the first few are done.
+ * Sizes are rounded up to one of eight steps between each power of two, so an image can reuse a slightly larger buffer.
+ */
+class PixelPool
+{
+public:
+
+	/** The alignment of every buffer, in bytes. */
+	static constexpr size_t ALIGNMENT = 64;
+
+	/** The most bytes the shared pool keeps for reuse. */
+	static constexpr uintmax_t DEFAULT_RETAIN_LIMIT = (uintmax_t)512 * 1024 * 1024;
+
+	/** Counts of how the pool has been used since it was created. */
+	struct Statistics
+	{
+		/** The number of buffers handed out. */
+		size_t Requests = 0;
+
+		/** The number of those that were recycled rather than allocated. */
+		size_t Reuses = 0;
+
+		/** The total bytes allocated from the system. */
+		uintmax_t AllocatedBytes = 0;
+
+		/** The most bytes held at once, in use and kept for reuse. */
+		uintmax_t PeakBytes = 0;
+
+		/** The bytes in buffers handed out and not yet released. */
+		uintmax_t InUseBytes = 0;
+
+		/** The bytes in buffers kept for reuse. */
+		uintmax_t RetainedBytes = 0;
+	};
+
+	/** Returns a buffer to the pool it came from. */
+	struct Deleter
+	{
+		/** The pool the buffer came from. */
+		PixelPool* Pool = nullptr;
+
+		/** The size of the buffer in bytes, which may be more than was asked for. */
+		size_t Capacity = 0;
+
+		void operator()(Vec4* pixels) const;
+	};
+
+	/** A buffer from a pool, which goes back to the pool when it is released. */
+	using Buffer = std::unique_ptr<Vec4[], Deleter>;
+
+	/**
+	 * Constructor.
+	 * @param retainLimit The most bytes to keep for reuse. Buffers released beyond this are freed.
+	 */
+	explicit PixelPool(const uintmax_t retainLimit = DEFAULT_RETAIN_LIMIT);
+
+	/**
+	 * Destructor. Frees the buffers kept for reuse. Every buffer handed out must be released first.
+	 */
+	~PixelPool();
+
+	PixelPool(const PixelPool&) = delete;
+	PixelPool& operator=(const PixelPool&) = delete;
+
+	/**
+	 * Get the pool shared by the whole process, which the effects and the TGA loader take their image buffers from.
+	 */
+	static PixelPool& GetShared();
+
+	/**
+	 * Get a buffer of at least count pixels, 64 byte aligned. Its contents are undefined.
+	 * @param count The number of pixels.
+	 */
+	Buffer Allocate(const size_t count);
+
+	/**
+	 * Free every buffer kept for reuse.
+	 */
+	void Trim();
+
+	/**
+	 * Get the counts of how the pool has been used.
+	 */
+	Statistics GetStatistics() const;
+
+private:
+
+	/** The most bytes to keep for reuse. */
+	const uintmax_t retainLimit;
+
+	/** The buffers kept for reuse, by size. */
+	std::multimap<size_t, Vec4*> retained = {};
+
+	/** The counts reported by GetStatistics. */
+	Statistics statistics = {};
+
+	/** Guards the retained buffers and the counts. Memory is allocated and freed outside of it. */
+	mutable std::mutex mutex;
+
+	/**
+	 * Get the size of buffer to allocate for a number of bytes, rounded up to a size step.
+	 */
+	static size_t GetCapacity(const size_t bytes);
+
+	/**
+	 * Keep a released buffer for reuse, or free it if the pool already keeps as much as it may.
+	 */
+	void Release(Vec4* pixels, const size_t capacity);
+};
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <Vector.h>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * This class converts blocks of pixels between the byte order they are stored in on disk and Vec4, in both directions.
+ * TGA stores color as B, G, R(, A) and Vec4 holds R, G, B, A in x, y, z, w.
+ * It also fills and compares blocks of pixels, for run-length coding.
+ * Each operation picks a vector implementation at runtime when the CPU supports one.
+ */
+class PixelSwizzle
+{
+public:
+
+	/**
+	 * Convert 24 bit B, G, R pixels to Vec4. w is set to zero.
+	 * @param source The packed source pixels, 3 bytes each.
+	 * @param destination The pixels to write to.
+	 * @param count The number of pixels to convert.
+	 */
+	static void BgrToVec4(const uint8_t* source, Vec4* destination, const size_t count);
+
+	/**
+	 * Convert 32 bit B, G, R, A pixels to Vec4. Swapping the first and third bytes works both ways,
+	 * so this also converts Vec4 back to B, G, R, A, and source may be the same memory as destination.
+	 * @param source The packed source pixels, 4 bytes each.
+	 * @param destination The pixels to write to.
+	 * @param count The number of pixels to convert.
+	 */
+	static void BgraToVec4(const uint8_t* source, Vec4* destination, const size_t count);
+
+	/**
+	 * Convert 8 bit black and white pixels to Vec4. The value is stored in x, every other channel is set to zero.
+	 * @param source The source pixels, 1 byte each.
+	 * @param destination The pixels to write to.
+	 * @param count The number of pixels to convert.
+	 */
+	static void GrayToVec4(const uint8_t* source, Vec4* destination, const size_t count);
+
+	/**
+	 * Convert 16 bit black and white pixels with alpha to Vec4. The value is stored in x and the alpha in w.
+	 * @param source The packed source pixels, 2 bytes each.
+	 * @param destination The pixels to write to.
+	 * @param count The number of pixels to convert.
+	 */
+	static void GrayAlphaToVec4(const uint8_t* source, Vec4* destination, const size_t count);
+
+	/**
+	 * Convert Vec4 to 24 bit B, G, R pixels. w is dropped.
+	 * @param source The pixels to convert.
+	 * @param destination The packed pixels to write to, 3 bytes each.
+	 * @param count The number of pixels to convert.
+	 */
+	static void Vec4ToBgr(const Vec4* source, uint8_t* destination, const size_t count);
+
+	/**
+	 * Convert Vec4 to 32 bit B, G, R, A pixels.
+	 * @param source The pixels to convert.
+	 * @param destination The packed pixels to write to, 4 bytes each.
+	 * @param count The number of pixels to convert.
+	 */
+	static void Vec4ToBgra(const Vec4* source, uint8_t* destination, const size_t count);
+
+	/**
+	 * Convert Vec4 to 8 bit black and white pixels, taken from x.
+	 * @param source The pixels to convert.
+	 * @param destination The pixels to write to, 1 byte each.
+	 * @param count The number of pixels to convert.
+	 */
+	static void Vec4ToGray(const Vec4* source, uint8_t* destination, const size_t count);
+
+	/**
+	 * Convert Vec4 to 16 bit black and white pixels with alpha, taken from x and w.
+	 * @param source The pixels to convert.
+	 * @param destination The packed pixels to write to, 2 bytes each.
+	 * @param count The number of pixels to convert.
+	 */
+	static void Vec4ToGrayAlpha(const Vec4* source, uint8_t* destination, const size_t count);
+
+	/**
+	 * Set every pixel in a block to the same value, as a run-length packet expands to.
+	 * @param destination The pixels to write to.
+	 * @param value The value to write.
+	 * @param count The number of pixels to write.
+	 */
+	static void Fill(Vec4* destination, const Vec4 value, const size_t count);
+
+	/**
+	 * Count the pixels at the start of a block that are the same as the first one, which is the length of the run it starts.
+	 * @param pixels The pixels to compare.
+	 * @param count The number of pixels in the block, at least one.
+	 * @param channelMask 0xFF for each channel to compare, zero for channels to ignore.
+	 * @return The length of the run, from 1 to count.
+	 */
+	static size_t CountRepeats(const Vec4* pixels, const size_t count, const Vec4 channelMask);
+
+	/**
+	 * Count the pixels at the start of a block before the first pixel that is the same as the one after it,
+	 * which is where the next run starts.
+	 * @param pixels The pixels to compare.
+	 * @param count The number of pixels in the block, at least one.
+	 * @param channelMask 0xFF for each channel to compare, zero for channels to ignore.
+	 * @return The number of pixels before the next run, from 1 to count. The first pixel is never counted as the start of a run.
+	 */
+	static size_t CountUntilRepeat(const Vec4* pixels, const size_t count, const Vec4 channelMask);
+
+private:
+
+	/**
+	 * Constructor not allowed for static class.
+	 */
+	PixelSwizzle() = delete;
+
+	/**
+	 * Destructor not allowed for static class.
+	 */
+	~PixelSwizzle() = delete;
+
+	/**
+	 * Indicates whether the CPU supports the vector conversions. Detected once and cached.
+	 */
+	static bool UseVectorSwizzle();
+
+	/*
+	 * Portable conversions, one pixel at a time.
+	 */
+
+	static void BgrToVec4Scalar(const uint8_t* source, Vec4* destination, const size_t count);
+	static void BgraToVec4Scalar(const uint8_t* source, Vec4* destination, const size_t count);
+	static void GrayToVec4Scalar(const uint8_t* source, Vec4* destination, const size_t count);
+	static void GrayAlphaToVec4Scalar(const uint8_t* source, Vec4* destination, const size_t count);
+	static void Vec4ToBgrScalar(const Vec4* source, uint8_t* destination, const size_t count);
+	static void Vec4ToGrayScalar(const Vec4* source, uint8_t* destination, const size_t count);
+	static void Vec4ToGrayAlphaScalar(const Vec4* source, uint8_t* destination, const size_t count);
+	static void FillScalar(Vec4* destination, const Vec4 value, const size_t count);
+	static size_t CountRepeatsScalar(const Vec4* pixels, const size_t count, const Vec4 channelMask);
+	static size_t CountUntilRepeatScalar(const Vec4* pixels, const size_t count, const Vec4 channelMask);
+
+	/*
+	 * SSE4.1 conversions, one byte shuffle per four Vec4 pixels. Fills and compares also take four pixels at a time.
+	 */
+
+	static void BgrToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count);
+	static void BgraToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count);
+	static void GrayToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count);
+	static void GrayAlphaToVec4SSE41(const uint8_t* source, Vec4* destination, const size_t count);
+	static void Vec4ToBgrSSE41(const Vec4* source, uint8_t* destination, const size_t count);
+	static void Vec4ToGraySSE41(const Vec4* source, uint8_t* destination, const size_t count);
+	static void Vec4ToGrayAlphaSSE41(const Vec4* source, uint8_t* destination, const size_t count);
+	static void FillSSE41(Vec4* destination, const Vec4 value, const size_t count);
+	static size_t CountRepeatsSSE41(const Vec4* pixels, const size_t count, const Vec4 channelMask);
+	static size_t CountUntilRepeatSSE41(const Vec4* pixels, const size_t count, const Vec4 channelMask);
+};
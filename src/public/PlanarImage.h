@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Vector.h>
+#include <PixelPool.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * An image stored as one plane per channel rather than as interleaved Vec4 pixels.
+ * Every plane and every row starts on a 64 byte boundary, so rows can be read with whole vector loads,
+ * and images with fewer than four channels only store and process the channels they have.
+ */
+class PlanarImage
+{
+public:
+
+	/** The alignment of every plane and row, in bytes. */
+	static constexpr size_t ALIGNMENT = 64;
+
+	/** The largest number of channels an image can have. */
+	static constexpr size_t MAX_CHANNELS = 4;
+
+	/**
+	 * Constructor. Every sample, including the padding at the end of each row, starts at zero.
+	 * @param width The width of the image.
+	 * @param height The height of the image.
+	 * @param channelCount The number of channels, 1-4. See FromInterleaved for how they map onto Vec4.
+	 */
+	PlanarImage(const size_t width, const size_t height, const size_t channelCount);
+
+	/**
+	 * Splits interleaved pixels into planes. One channel is taken from x, two from x and w (gray with alpha),
+	 * three from x, y and z, and four from every channel.
+	 * @param pixels The interleaved pixel data.
+	 * @param width The width of the pixel data.
+	 * @param height The height of the pixel data.
+	 * @param channelCount The number of channels to keep, 1-4.
+	 */
+	static PlanarImage FromInterleaved(const Vec4* pixels, const size_t width, const size_t height, const size_t channelCount);
+
+	/**
+	 * Interleaves the planes back into Vec4 pixels. Channels the image does not have are set to zero.
+	 */
+	PixelPool::Buffer ToInterleaved() const;
+
+	/**
+	 * Get the width of the image.
+	 */
+	size_t GetWidth() const;
+
+	/**
+	 * Get the height of the image.
+	 */
+	size_t GetHeight() const;
+
+	/**
+	 * Get the number of channels in the image.
+	 */
+	size_t GetChannelCount() const;
+
+	/**
+	 * Get the number of bytes from the start of one row of a plane to the start of the next. Always a multiple of ALIGNMENT.
+	 */
+	size_t GetStride() const;
+
+	/**
+	 * Get a row of one channel's plane. Rows of a plane are GetStride() bytes apart.
+	 * @param channel The channel of the plane.
+	 * @param row The row within the plane.
+	 */
+	uint8_t* GetRow(const size_t channel, const size_t row);
+
+	/**
+	 * Get a row of one channel's plane. Rows of a plane are GetStride() bytes apart.
+	 * @param channel The channel of the plane.
+	 * @param row The row within the plane.
+	 */
+	const uint8_t* GetRow(const size_t channel, const size_t row) const;
+
+private:
+
+	/** The width of the image. */
+	size_t width = 0;
+
+	/** The height of the image. */
+	size_t height = 0;
+
+	/** The number of channels in the image. */
+	size_t channelCount = 0;
+
+	/** The number of bytes between the starts of consecutive rows. */
+	size_t stride = 0;
+
+	/** Every plane, one after another, in a buffer from the shared PixelPool. */
+	PixelPool::Buffer data = nullptr;
+
+	/**
+	 * Get the member of Vec4 that a channel is stored in when interleaved.
+	 * @param channelCount The number of channels in the image.
+	 * @param channel The channel.
+	 */
+	static uint8_t Vec4::* GetInterleavedChannel(const size_t channelCount, const size_t channel);
+};
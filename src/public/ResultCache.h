@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+/**
+ * A directory of finished output files, each stored under a key made from the contents of the input file and the
+ * parameters it was processed with. A job whose key is found copies the stored file into place instead of being run.
+ * The total size of the stored files is capped, and the least recently used files are removed to stay under it.
+ * Files are stored by renaming them into place, so several processes may share a directory.
+ */
+class ResultCache
+{
+public:
+
+	/** Counts of how the cache has been used since it was opened. */
+	struct Statistics
+	{
+		/** The number of lookups that found a stored file. */
+		size_t Hits = 0;
+
+		/** The number of lookups that did not. */
+		size_t Misses = 0;
+
+		/** The number of files stored. */
+		size_t Stores = 0;
+
+		/** The number of files removed to stay under the size cap. */
+		size_t Evictions = 0;
+
+		/** The number of files held now. */
+		size_t EntryCount = 0;
+
+		/** The total size of the files held now. */
+		uintmax_t Bytes = 0;
+	};
+
+	/**
+	 * Constructor. Creates the directory if needed, removes copies left half stored by a killed process and indexes
+	 * the files already in it, oldest use first.
+	 * @param directory Where the files are stored.
+	 * @param capacity The most bytes to store. Files already in the directory beyond this are removed.
+	 */
+	ResultCache(const std::filesystem::path& directory, const uintmax_t capacity);
+
+	ResultCache(const ResultCache&) = delete;
+	ResultCache& operator=(const ResultCache&) = delete;
+
+	/**
+	 * Make the key of a job from the contents of its input file and a description of everything else that affects its output.
+	 * @param inputPath The file the job reads.
+	 * @param parameters The settings of the job, which must differ whenever the output would.
+	 * @param key Set to the key, 16 hexadecimal digits.
+	 * @return False if the input file could not be read.
+	 */
+	static bool MakeKey(const std::string& inputPath, const std::string& parameters, std::string& key);
+
+	/**
+	 * Hash a block of bytes to 64 bits with XXH64, which reads 32 bytes per step and runs at memory speed.
+	 * @param data The bytes to hash.
+	 * @param seed A value mixed into the hash, such as the hash of other data.
+	 */
+	static uint64_t Hash(std::span<const uint8_t> data, const uint64_t seed = 0);
+
+	/**
+	 * Copy the file stored under a key to an output path, and count it as the most recently used.
+	 * @param key The key from MakeKey.
+	 * @param outputPath Where to copy the file to.
+	 * @param replaceAtomically If true the file is copied beside the output and renamed over it, so the output is never partly written.
+	 * @return False if nothing is stored under the key, or it could not be copied.
+	 */
+	bool Fetch(const std::string& key, const std::string& outputPath, const bool replaceAtomically);
+
+	/**
+	 * Store a copy of a finished output file under a key, removing the least recently used files to make room.
+	 * Files larger than the whole capacity are not stored.
+	 * @param key The key from MakeKey.
+	 * @param outputPath The file to store.
+	 */
+	void Store(const std::string& key, const std::string& outputPath);
+
+	/**
+	 * Get the counts of how the cache has been used.
+	 */
+	Statistics GetStatistics() const;
+
+private:
+
+	/** A stored file. */
+	struct Entry
+	{
+		/** The size of the file. */
+		uintmax_t Size = 0;
+
+		/** The entry's place in the use order. */
+		std::list<std::string>::iterator Use;
+	};
+
+	/** Where the files are stored. */
+	const std::filesystem::path directory;
+
+	/** The most bytes to store. */
+	const uintmax_t capacity;
+
+	/** The stored files by key. */
+	std::unordered_map<std::string, Entry> entries = {};
+
+	/** The keys of the stored files, least recently used first. */
+	std::list<std::string> useOrder = {};
+
+	/** The counts reported by GetStatistics. */
+	Statistics statistics = {};
+
+	/** Guards the index and the counts. Files are copied outside of it. */
+	mutable std::mutex mutex;
+
+	/**
+	 * Get the path a key is stored at.
+	 */
+	std::filesystem::path GetEntryPath(const std::string& key) const;
+
+	/**
+	 * Remove the least recently used files until the total size is within the capacity. Called with the mutex held.
+	 */
+	void Evict();
+};
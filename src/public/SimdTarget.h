@@ -0,0 +1,21 @@
+#pragma once
+
+// SIMD_X86 is 1 when building for x86, where the SSE and AVX paths are compiled and picked between at runtime.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define SIMD_X86 0
+#endif
+
+// MSVC allows any intrinsic in any function. GCC and Clang need the instruction set enabled per function.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SIMD_TARGET_SSE41
+#define SIMD_TARGET_AVX2
+#else
+#define SIMD_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+
+/**
+ * Names for the temporary files that atomic saves write beside their destination before renaming them into place.
+ * A temporary file is named after its destination, followed by ".partial-", the id of the process and a count of the
+ * names that process has made, so no two writers in any process ever share one.
+ * A process killed mid-save leaves its temporary file behind, which RemoveStale finds by that name.
+ */
+class TemporaryPath
+{
+public:
+
+	/** The marker every temporary file name has after the name of its destination. */
+	static constexpr const char* MARKER = ".partial-";
+
+	/**
+	 * Get a path for a temporary file beside a destination, unique to this call.
+	 * @param destination The path the temporary file will be renamed to.
+	 */
+	static std::filesystem::path Make(const std::filesystem::path& destination);
+
+	/**
+	 * Check whether a path names a temporary file.
+	 * @param path The path to check.
+	 */
+	static bool IsTemporary(const std::filesystem::path& path);
+
+	/**
+	 * Remove the temporary files in a directory that have not been written to for a while. A save still in progress
+	 * keeps writing to its file, so only files abandoned by a process that stopped mid-save are this old.
+	 * @param directory The directory to clean. Subdirectories are not searched.
+	 * @param age How long a temporary file must have gone unwritten to be removed.
+	 * @return The number of files removed.
+	 */
+	static size_t RemoveStale(const std::filesystem::path& directory, const std::chrono::seconds age = std::chrono::hours(1));
+};
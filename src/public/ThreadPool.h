@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/** A fixed size pool of worker threads that tasks can be dispatched to. */
+class ThreadPool
+{
+public:
+
+	/**
+	 * Constructor. The calling thread takes part in ParallelFor, so threadCount - 1 background threads are started.
+	 * @param threadCount The total number of threads work is split across. A value of 0 uses one thread per hardware thread.
+	 */
+	explicit ThreadPool(size_t threadCount);
+
+	/**
+	 * The destructor. Finishes any queued tasks and joins the worker threads.
+	 */
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/**
+	 * Get the total number of threads work is split across, including the calling thread.
+	 */
+	size_t GetThreadCount() const;
+
+	/**
+	 * Queue a task to be run on a worker thread. If the pool has no background threads the task is run immediately.
+	 * @param task The task to run.
+	 * @return A future that becomes ready when the task has finished.
+	 */
+	std::future<void> Submit(std::function<void()> task);
+
+	/**
+	 * Split the range [0, count) into contiguous chunks, one per thread, and run them in parallel.
+	 * Blocks until every chunk has finished. The first chunk is run on the calling thread.
+	 * @param count The number of items in the range.
+	 * @param task The task to run for each chunk, given the half open range [begin, end) of items to process.
+	 */
+	void ParallelFor(size_t count, const std::function<void(size_t begin, size_t end)>& task);
+
+	/**
+	 * Get the number of hardware threads available, or 1 if it cannot be determined.
+	 */
+	static size_t GetHardwareThreadCount();
+
+private:
+
+	/** The background worker threads. */
+	std::vector<std::thread> workers = {};
+
+	/** Tasks waiting to be picked up by a worker. */
+	std::queue<std::packaged_task<void()>> tasks = {};
+
+	/** Guards the task queue and the stopping flag. */
+	std::mutex queueMutex;
+
+	/** Signalled when a task is queued or the pool is stopping. */
+	std::condition_variable queueCondition;
+
+	/** Set when the pool is being destroyed. */
+	bool stopping = false;
+
+	/**
+	 * The loop run by each worker thread. Pulls tasks off the queue until the pool is stopped.
+	 */
+	void WorkerLoop();
+};